@@ -0,0 +1,38 @@
+# Recursive Fibonacci: fib(27) through a call per node of the call
+# tree, saving $ra and the argument on the stack.
+# Result: $v1 = fib(27) = 196418
+
+        .text
+main:
+        li      $sp, 0x7FFFF000
+        li      $a0, 27
+        jal     fib
+        nop                             # jal links PC + 8
+        move    $v1, $v0
+        li      $v0, 10
+        syscall
+
+# $v0 = fib($a0)
+fib:
+        li      $t0, 2
+        slt     $t1, $a0, $t0
+        beq     $t1, $zero, fib_rec
+        move    $v0, $a0
+        jr      $ra
+fib_rec:
+        addiu   $sp, $sp, -12
+        sw      $ra, 0($sp)
+        sw      $a0, 4($sp)
+        addiu   $a0, $a0, -1
+        jal     fib
+        nop
+        sw      $v0, 8($sp)
+        lw      $a0, 4($sp)
+        addiu   $a0, $a0, -2
+        jal     fib
+        nop
+        lw      $t0, 8($sp)
+        addu    $v0, $v0, $t0
+        lw      $ra, 0($sp)
+        addiu   $sp, $sp, 12
+        jr      $ra
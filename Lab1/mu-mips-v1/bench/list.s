@@ -0,0 +1,42 @@
+# Linked-list traversal: 4096 8-byte nodes {next, value} linked in
+# the scattered order idx -> (5 * idx + 1) mod 4096, summed 600 times.
+# Result: $v1 = 600 * (0 + 1 + ... + 4095) = 0x2BED4000
+
+        .text
+main:
+        li      $s0, 0x10010000         # node 0, the head
+        move    $t0, $zero
+        li      $t8, 4095
+link:
+        sll     $t1, $t0, 2
+        addu    $t1, $t1, $t0
+        addiu   $t1, $t1, 1
+        andi    $t1, $t1, 4095          # next index
+        sll     $t2, $t0, 3
+        addu    $t2, $t2, $s0
+        sll     $t3, $t1, 3
+        addu    $t3, $t3, $s0
+        sw      $t3, 0($t2)
+        sw      $t0, 4($t2)
+        move    $t0, $t1
+        addiu   $t8, $t8, -1
+        bne     $t8, $zero, link
+        sll     $t2, $t0, 3             # the last node ends the list
+        addu    $t2, $t2, $s0
+        sw      $zero, 0($t2)
+        sw      $t0, 4($t2)
+
+        li      $s7, 600
+        move    $v1, $zero
+rep:
+        move    $t0, $s0
+walk:
+        lw      $t1, 4($t0)
+        addu    $v1, $v1, $t1
+        lw      $t0, 0($t0)
+        bne     $t0, $zero, walk
+        addiu   $s7, $s7, -1
+        bne     $s7, $zero, rep
+
+        li      $v0, 10
+        syscall
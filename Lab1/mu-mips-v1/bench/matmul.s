@@ -0,0 +1,65 @@
+# Integer matrix multiply: C = A * B for 24x24 matrices of small
+# pseudo-random values (xorshift32), repeated 64 times.
+# Result: $v1 = 64 * sum(C) = 0x0336D900
+
+        .text
+main:
+        li      $s0, 0x10010000         # A
+        li      $s1, 0x10010900         # B, right after A
+        li      $s2, 0x10011200         # C
+        li      $t9, 0x2545F491         # xorshift32 state
+
+        move    $t0, $s0                # fill A and B with values 0..15
+        li      $t1, 1152
+fill:
+        sll     $t2, $t9, 13
+        xor     $t9, $t9, $t2
+        srl     $t2, $t9, 17
+        xor     $t9, $t9, $t2
+        sll     $t2, $t9, 5
+        xor     $t9, $t9, $t2
+        move    $t3, $t9
+        andi    $t3, $t3, 15
+        sw      $t3, 0($t0)
+        addiu   $t0, $t0, 4
+        addiu   $t1, $t1, -1
+        bne     $t1, $zero, fill
+
+        li      $s7, 64
+        move    $v1, $zero
+rep:
+        move    $s3, $s0                # row of A
+        move    $s4, $s2                # next element of C
+        li      $s5, 24
+row:
+        move    $s6, $s1                # column of B
+        li      $t8, 24
+col:
+        move    $t0, $s3
+        move    $t1, $s6
+        move    $t4, $zero
+        li      $t5, 24
+dot:
+        lw      $t2, 0($t0)
+        lw      $t3, 0($t1)
+        mult    $t2, $t3
+        mflo    $t6
+        addu    $t4, $t4, $t6
+        addiu   $t0, $t0, 4
+        addiu   $t1, $t1, 96
+        addiu   $t5, $t5, -1
+        bne     $t5, $zero, dot
+        sw      $t4, 0($s4)
+        addu    $v1, $v1, $t4
+        addiu   $s4, $s4, 4
+        addiu   $s6, $s6, 4
+        addiu   $t8, $t8, -1
+        bne     $t8, $zero, col
+        addiu   $s3, $s3, 96
+        addiu   $s5, $s5, -1
+        bne     $s5, $zero, row
+        addiu   $s7, $s7, -1
+        bne     $s7, $zero, rep
+
+        li      $v0, 10
+        syscall
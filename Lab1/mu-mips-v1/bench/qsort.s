@@ -0,0 +1,87 @@
+# Recursive quicksort (Lomuto partition, unsigned keys) of 2048
+# pseudo-random words, refilled and re-sorted 48 times.
+# Result: $v1 = h = h * 33 + a[i] over every sorted array = 0x66D5E2CA
+
+        .text
+main:
+        li      $sp, 0x7FFFF000
+        li      $s0, 0x10010000         # array
+        li      $t9, 0x2545F491         # xorshift32 state
+        li      $s7, 48
+        move    $v1, $zero
+rep:
+        move    $t0, $s0
+        li      $t1, 2048
+fill:
+        sll     $t2, $t9, 13
+        xor     $t9, $t9, $t2
+        srl     $t2, $t9, 17
+        xor     $t9, $t9, $t2
+        sll     $t2, $t9, 5
+        xor     $t9, $t9, $t2
+        sw      $t9, 0($t0)
+        addiu   $t0, $t0, 4
+        addiu   $t1, $t1, -1
+        bne     $t1, $zero, fill
+
+        move    $a0, $s0
+        addiu   $a1, $s0, 8188          # last element
+        jal     qsort
+        nop
+
+        move    $t0, $s0
+        li      $t1, 2048
+hash:
+        lw      $t2, 0($t0)
+        sll     $t3, $v1, 5
+        addu    $v1, $v1, $t3
+        addu    $v1, $v1, $t2
+        addiu   $t0, $t0, 4
+        addiu   $t1, $t1, -1
+        bne     $t1, $zero, hash
+        addiu   $s7, $s7, -1
+        bne     $s7, $zero, rep
+
+        li      $v0, 10
+        syscall
+
+# Sort the words from $a0 to $a1 inclusive
+qsort:
+        slt     $t0, $a0, $a1
+        bne     $t0, $zero, partition
+        jr      $ra
+partition:
+        lw      $t1, 0($a1)             # pivot
+        move    $t2, $a0                # next slot for a smaller key
+        move    $t3, $a0
+scan:
+        beq     $t3, $a1, place
+        lw      $t4, 0($t3)
+        slt     $t5, $t4, $t1
+        beq     $t5, $zero, skip
+        lw      $t6, 0($t2)
+        sw      $t4, 0($t2)
+        sw      $t6, 0($t3)
+        addiu   $t2, $t2, 4
+skip:
+        addiu   $t3, $t3, 4
+        b       scan
+place:
+        lw      $t6, 0($t2)
+        sw      $t1, 0($t2)
+        sw      $t6, 0($a1)
+        addiu   $sp, $sp, -12
+        sw      $ra, 0($sp)
+        sw      $t2, 4($sp)
+        sw      $a1, 8($sp)
+        addiu   $a1, $t2, -4
+        jal     qsort
+        nop
+        lw      $t2, 4($sp)
+        addiu   $a0, $t2, 4
+        lw      $a1, 8($sp)
+        jal     qsort
+        nop
+        lw      $ra, 0($sp)
+        addiu   $sp, $sp, 12
+        jr      $ra
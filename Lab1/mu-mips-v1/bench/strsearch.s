@@ -0,0 +1,65 @@
+# Naive substring search: count occurrences of a 6-byte pattern
+# (copied from offset 5000) in 16 KiB of text over "abcd", 48 times.
+# Result: $v1 = 48 * 3 matches = 0x90
+
+        .text
+main:
+        li      $s0, 0x10010000         # text
+        li      $s1, 0x10014000         # pattern
+        li      $t9, 0x2545F491         # xorshift32 state
+
+        move    $t0, $s0
+        li      $t1, 16384
+fill:
+        sll     $t2, $t9, 13
+        xor     $t9, $t9, $t2
+        srl     $t2, $t9, 17
+        xor     $t9, $t9, $t2
+        sll     $t2, $t9, 5
+        xor     $t9, $t9, $t2
+        srl     $t2, $t9, 7
+        andi    $t2, $t2, 3
+        addiu   $t2, $t2, 97            # 'a'
+        sb      $t2, 0($t0)
+        addiu   $t0, $t0, 1
+        addiu   $t1, $t1, -1
+        bne     $t1, $zero, fill
+
+        addiu   $t0, $s0, 5000
+        move    $t1, $s1
+        li      $t3, 6
+copy:
+        lb      $t2, 0($t0)
+        sb      $t2, 0($t1)
+        addiu   $t0, $t0, 1
+        addiu   $t1, $t1, 1
+        addiu   $t3, $t3, -1
+        bne     $t3, $zero, copy
+
+        li      $s7, 48
+        move    $v1, $zero
+rep:
+        move    $t0, $s0                # candidate position
+        li      $t8, 16379
+position:
+        move    $t1, $t0
+        move    $t2, $s1
+        li      $t3, 6
+compare:
+        lb      $t4, 0($t1)
+        lb      $t5, 0($t2)
+        bne     $t4, $t5, mismatch
+        addiu   $t1, $t1, 1
+        addiu   $t2, $t2, 1
+        addiu   $t3, $t3, -1
+        bne     $t3, $zero, compare
+        addiu   $v1, $v1, 1
+mismatch:
+        addiu   $t0, $t0, 1
+        addiu   $t8, $t8, -1
+        bne     $t8, $zero, position
+        addiu   $s7, $s7, -1
+        bne     $s7, $zero, rep
+
+        li      $v0, 10
+        syscall
@@ -0,0 +1,88 @@
+# Calls to the library routines the simulator runs natively (memcpy,
+# memset, strlen): plain calls, an overlapping memcpy and a memset
+# across a 64 KiB boundary (both interpreted), then 2000 memcpy calls
+# in a loop so that interrupt checks and SimPoint intervals fall inside
+# them. Run it with and without -H and compare registers and memory.
+
+        .data
+msg:    .asciiz "Hello, high-level emulation world! The quick brown fox."
+
+        .text
+main:
+        beq     $zero, $zero, start     # the interrupt check due at reset comes first
+start:
+        la      $s0, msg
+        move    $a0, $s0                # strlen(msg)
+        jal     strlen
+        nop                             # jal links PC + 8
+        move    $s1, $v0
+        li      $a0, 0x10012000         # memset(0x10012000, 'A', 300)
+        li      $a1, 0x41
+        li      $a2, 300
+        jal     memset
+        nop
+        li      $a0, 0x10012010         # memcpy(0x10012010, msg, strlen + 1)
+        move    $a1, $s0
+        addiu   $a2, $s1, 1
+        jal     memcpy
+        nop
+        li      $a0, 0x10012001         # memcpy(0x10012001, 0x10012000, 50): overlaps
+        li      $a1, 0x10012000
+        li      $a2, 50
+        jal     memcpy
+        nop
+        li      $a0, 0x1001FFF0         # memset(0x1001FFF0, 0x7f, 0x20): crosses the remap
+        li      $a1, 0x7f
+        li      $a2, 0x20
+        jal     memset
+        nop
+        li      $a0, 0x10012000
+        jal     strlen
+        nop
+        move    $s2, $v0
+        li      $s4, 2000
+loop:
+        li      $a0, 0x10030000         # memcpy(0x10030000, 0x10012000, 5000)
+        li      $a1, 0x10012000
+        li      $a2, 5000
+        jal     memcpy
+        nop
+        addiu   $s4, $s4, -1
+        bne     $s4, $zero, loop
+        li      $v0, 10
+        syscall
+
+memcpy:
+        addu    $v0, $a0, $zero
+mc_loop:
+        beq     $a2, $zero, mc_done
+        lb      $t0, 0($a1)
+        sb      $t0, 0($a0)
+        addiu   $a0, $a0, 1
+        addiu   $a1, $a1, 1
+        addiu   $a2, $a2, -1
+        beq     $zero, $zero, mc_loop
+mc_done:
+        jr      $ra
+
+memset:
+        addu    $v0, $a0, $zero
+ms_loop:
+        beq     $a2, $zero, ms_done
+        sb      $a1, 0($a0)
+        addiu   $a0, $a0, 1
+        addiu   $a2, $a2, -1
+        beq     $zero, $zero, ms_loop
+ms_done:
+        jr      $ra
+
+strlen:
+        addu    $v0, $zero, $zero
+sl_loop:
+        lb      $t1, 0($a0)
+        beq     $t1, $zero, sl_done
+        addiu   $a0, $a0, 1
+        addiu   $v0, $v0, 1
+        beq     $zero, $zero, sl_loop
+sl_done:
+        jr      $ra
@@ -0,0 +1,55 @@
+# Library routines the simulator runs natively (memset, memcpy) on
+# ranges that cross 64 KiB boundaries. Every load/store ORs 0x00010000
+# into its address, so such a range does not map to contiguous memory
+# and a native call must touch exactly what the byte loop would.
+# Run it with and without -H and compare registers and memory.
+
+        .text
+main:
+        beq     $zero, $zero, start     # the interrupt check due at reset comes first
+start:
+        lui     $a0, 0x1000             # memset(0x10000000, 0x55, 0x30000)
+        li      $a1, 0x55
+        lui     $a2, 3
+        jal     memset
+        nop                             # jal links PC + 8
+        li      $a0, 0x1004FFF0         # memcpy(0x1004FFF0, 0x1000FFE0, 0x40)
+        li      $a1, 0x1000FFE0
+        li      $a2, 0x40
+        jal     memcpy
+        nop
+        move    $s0, $t0                # the last byte copied
+        li      $a0, 0x1001FFF8         # memcpy(0x1001FFF8, 0x1001FFF0, 0x20): overlaps
+        li      $a1, 0x1001FFF0
+        li      $a2, 0x20
+        jal     memcpy
+        nop
+        lui     $t1, 0x1003
+        lw      $s1, 0($t1)
+        lw      $s2, -4($t1)
+        li      $v0, 10
+        syscall
+
+memcpy:
+        addu    $v0, $a0, $zero
+mc_loop:
+        beq     $a2, $zero, mc_done
+        lb      $t0, 0($a1)
+        sb      $t0, 0($a0)
+        addiu   $a0, $a0, 1
+        addiu   $a1, $a1, 1
+        addiu   $a2, $a2, -1
+        beq     $zero, $zero, mc_loop
+mc_done:
+        jr      $ra
+
+memset:
+        addu    $v0, $a0, $zero
+ms_loop:
+        beq     $a2, $zero, ms_done
+        sb      $a1, 0($a0)
+        addiu   $a0, $a0, 1
+        addiu   $a2, $a2, -1
+        beq     $zero, $zero, ms_loop
+ms_done:
+        jr      $ra
@@ -0,0 +1,27 @@
+# Three program phases for SimPoint (-B, -I): six rounds of a strided
+# load/add/store loop over 16 KiB followed by a tight ALU loop, so
+# intervals fall into clearly different basic block vectors.
+
+        .text
+main:
+        li      $s4, 6                  # rounds
+round:
+        lui     $s1, 0x1001             # phase A: 4096 words at 0x10010000
+        li      $s3, 4096
+stride:
+        lw      $t0, 0($s1)
+        addu    $t0, $t0, $s4
+        sw      $t0, 0($s1)
+        addiu   $s1, $s1, 4
+        addiu   $s3, $s3, -1
+        bne     $s3, $zero, stride
+        li      $s3, 20000              # phase B: ALU only
+alu:
+        addu    $t1, $t1, $s3
+        subu    $t2, $t2, $t1
+        addiu   $s3, $s3, -1
+        bne     $s3, $zero, alu
+        addiu   $s4, $s4, -1
+        bne     $s4, $zero, round
+        li      $v0, 10
+        syscall
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+
+/***************************************************************/
+/* Performance regression check for two benchrun result files (a   */
+/* stored baseline and a new run). For every benchmark, engine and  */
+/* metric the repetitions of both runs are compared with a two-sided */
+/* Mann-Whitney U test (exact for small samples without ties, normal */
+/* approximation otherwise). A metric regresses when its median gets */
+/* worse by more than the threshold and the difference is           */
+/* significant; the exit status is 1 if anything regressed.          */
+/***************************************************************/
+
+#define MAX_ENTRIES       256
+#define MAX_REPS          100
+#define EXACT_MAX_SAMPLES 20       /* per side, for the exact U distribution */
+#define DEFAULT_THRESHOLD 10.0     /* percent */
+#define DEFAULT_ALPHA     0.05
+
+#define NUM_METRICS 5
+
+const char *METRIC_NAMES[NUM_METRICS] = {
+    "mips", "load_ms", "startup_ms", "peak_rss_kb", "host_cycles_per_instruction"
+};
+
+const int HIGHER_IS_BETTER[NUM_METRICS] = { 1, 0, 0, 0, 0 };
+
+typedef struct {
+    char benchmark[64], engine[32];
+    double samples[NUM_METRICS][MAX_REPS];
+    int n[NUM_METRICS];                     /* 0 if the metric is missing */
+} entry_t;
+
+typedef struct {
+    entry_t entries[MAX_ENTRIES];
+    int count;
+} results_t;
+
+results_t BASELINE, CURRENT;
+
+/***************************************************************/
+/* Read the samples of every metric from a file written by benchrun */
+/***************************************************************/
+void read_results(const char *path, results_t *results) {
+    FILE *fp;
+    char *text, *p, *next, *q, *end, pattern[64];
+    long size;
+    entry_t *e;
+    int m;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        printf("Error: Can't open results file %s\n", path);
+        exit(-1);
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+    text = malloc(size + 1);
+    size = fread(text, 1, size, fp);
+    text[size] = '\0';
+    fclose(fp);
+
+    for (p = strstr(text, "{\"benchmark\": "); p != NULL; p = next) {
+        next = strstr(p + 1, "{\"benchmark\": ");
+        if (next != NULL) {
+            *next = '\0';           /* searches below stay inside this entry */
+        }
+        if (results->count == MAX_ENTRIES) {
+            printf("Error: too many results in %s\n", path);
+            exit(-1);
+        }
+        e = &results->entries[results->count];
+        if (sscanf(p, "{\"benchmark\": \"%63[^\"]\", \"engine\": \"%31[^\"]\"", e->benchmark, e->engine) != 2) {
+            printf("Error: %s: malformed result\n", path);
+            exit(-1);
+        }
+        for (m = 0; m < NUM_METRICS; m++) {
+            snprintf(pattern, sizeof(pattern), "\"%s\": {", METRIC_NAMES[m]);
+            q = strstr(p, pattern);
+            q = (q != NULL) ? strstr(q, "\"samples\": [") : NULL;
+            if (q == NULL) {
+                continue;
+            }
+            q += strlen("\"samples\": [");
+            while (*q != ']' && e->n[m] < MAX_REPS) {
+                e->samples[m][e->n[m]] = strtod(q, &end);
+                if (end == q) {
+                    break;
+                }
+                e->n[m]++;
+                q = end + strspn(end, ", \n");
+            }
+        }
+        results->count++;
+        if (next != NULL) {
+            *next = '{';
+        }
+    }
+    free(text);
+}
+
+entry_t *find_entry(results_t *results, const char *benchmark, const char *engine) {
+    int i;
+
+    for (i = 0; i < results->count; i++) {
+        if (strcmp(results->entries[i].benchmark, benchmark) == 0 && strcmp(results->entries[i].engine, engine) == 0) {
+            return &results->entries[i];
+        }
+    }
+    return NULL;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+double median(const double *samples, int n) {
+    double sorted[MAX_REPS];
+
+    memcpy(sorted, samples, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), compare_doubles);
+    return (n % 2) ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+/***************************************************************/
+/* P(U <= u) for sample sizes na and nb with no ties: count the       */
+/* orderings of the pooled samples by the U each one produces         */
+/***************************************************************/
+double mann_whitney_cdf(int na, int nb, int u) {
+    int max_u = na * nb, i, a, v;
+    double *ways = calloc((size_t)(na + 1) * (max_u + 1), sizeof(double)), below = 0, total = 0;
+
+    /* ways[a][v]: orderings of the first i values with a from sample A and U = v so far */
+    ways[0] = 1;
+    for (i = 0; i < na + nb; i++) {
+        for (a = (i < na) ? i + 1 : na; a > 0; a--) {
+            for (v = max_u; v >= 0; v--) {
+                /* the next value is from B (nothing to add), or from A, beating the i - (a - 1) B values before it */
+                if (i - (a - 1) <= nb && v >= i - (a - 1)) {
+                    ways[a * (max_u + 1) + v] += ways[(a - 1) * (max_u + 1) + v - (i - (a - 1))];
+                }
+            }
+        }
+    }
+    for (v = 0; v <= max_u; v++) {
+        total += ways[na * (max_u + 1) + v];
+        below += (v <= u) ? ways[na * (max_u + 1) + v] : 0;
+    }
+    free(ways);
+    return below / total;
+}
+
+/***************************************************************/
+/* Two-sided p-value of the Mann-Whitney U test of samples a and b   */
+/***************************************************************/
+double mann_whitney(const double *a, int na, const double *b, int nb) {
+    double pooled[2 * MAX_REPS], rank_sum = 0, ties = 0, u, mean, sigma, z, p;
+    int n = na + nb, i, j, k, t;
+
+    memcpy(pooled, a, na * sizeof(double));
+    memcpy(pooled + na, b, nb * sizeof(double));
+    qsort(pooled, n, sizeof(double), compare_doubles);
+    /* rank of each value of a, tied values sharing their average rank */
+    for (i = 0; i < n; i = j) {
+        for (j = i; j < n && pooled[j] == pooled[i]; j++);
+        t = j - i;
+        ties += (double)t * t * t - t;
+        for (k = 0; k < na; k++) {
+            if (a[k] == pooled[i]) {
+                rank_sum += (i + 1 + j) / 2.0;
+            }
+        }
+    }
+    u = rank_sum - na * (na + 1) / 2.0;
+    mean = na * nb / 2.0;
+
+    if (ties == 0 && na <= EXACT_MAX_SAMPLES && nb <= EXACT_MAX_SAMPLES) {
+        p = 2 * ((u <= mean) ? mann_whitney_cdf(na, nb, (int)u) : mann_whitney_cdf(nb, na, na * nb - (int)u));
+        return (p > 1) ? 1 : p;
+    }
+    sigma = sqrt(na * nb / 12.0 * ((n + 1) - ties / ((double)n * (n - 1))));
+    if (sigma == 0) {
+        return 1;
+    }
+    z = (fabs(u - mean) - 0.5) / sigma;
+    return (z <= 0) ? 1 : erfc(z / sqrt(2));
+}
+
+/***************************************************************/
+/* Print usage                                                                         */
+/***************************************************************/
+void usage(const char *prog) {
+    printf("Usage: %s [-t <threshold %%>] [-a <alpha>] <baseline.json> <new.json>\n", prog);
+}
+
+/***************************************************************/
+/* main                                                                                */
+/***************************************************************/
+int main(int argc, char *argv[]) {
+    int opt, i, m, regressions = 0, improvements = 0;
+    double threshold = DEFAULT_THRESHOLD, alpha = DEFAULT_ALPHA, before, after, change, p, worse;
+    entry_t *base, *cur;
+    const char *verdict;
+
+    while ((opt = getopt(argc, argv, "t:a:")) != -1) {
+        switch (opt) {
+            case 't': threshold = atof(optarg); break;
+            case 'a': alpha = atof(optarg); break;
+            default: usage(argv[0]); exit(1);
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        exit(1);
+    }
+    read_results(argv[optind], &BASELINE);
+    read_results(argv[optind + 1], &CURRENT);
+
+    printf("Comparing %s against baseline %s (threshold %.1f%%, alpha %.3f)\n\n",
+           argv[optind + 1], argv[optind], threshold, alpha);
+    printf("%-12s %-12s %-28s %12s %12s %9s %8s  %s\n", "[Benchmark]", "[Engine]", "[Metric]",
+           "[Baseline]", "[New]", "[Change]", "[p]", "[Verdict]");
+    for (i = 0; i < CURRENT.count; i++) {
+        cur = &CURRENT.entries[i];
+        base = find_entry(&BASELINE, cur->benchmark, cur->engine);
+        if (base == NULL) {
+            printf("%-12s %-12s (not in the baseline)\n", cur->benchmark, cur->engine);
+            continue;
+        }
+        for (m = 0; m < NUM_METRICS; m++) {
+            if (base->n[m] == 0 || cur->n[m] == 0) {
+                continue;
+            }
+            before = median(base->samples[m], base->n[m]);
+            after = median(cur->samples[m], cur->n[m]);
+            change = (before != 0) ? 100 * (after - before) / before : 0;
+            worse = HIGHER_IS_BETTER[m] ? -change : change;
+            p = mann_whitney(base->samples[m], base->n[m], cur->samples[m], cur->n[m]);
+            verdict = "";
+            if (p < alpha && worse > threshold) {
+                verdict = "REGRESSION";
+                regressions++;
+            }
+            else if (p < alpha && -worse > threshold) {
+                verdict = "improved";
+                improvements++;
+            }
+            printf("%-12s %-12s %-28s %12.4f %12.4f %+8.1f%% %8.4f  %s\n", cur->benchmark, cur->engine,
+                   METRIC_NAMES[m], before, after, change, p, verdict);
+        }
+    }
+    for (i = 0; i < BASELINE.count; i++) {
+        if (find_entry(&CURRENT, BASELINE.entries[i].benchmark, BASELINE.entries[i].engine) == NULL) {
+            printf("%-12s %-12s (missing from the new run)\n", BASELINE.entries[i].benchmark, BASELINE.entries[i].engine);
+        }
+    }
+    printf("\n%d regression%s, %d improvement%s\n", regressions, regressions == 1 ? "" : "s",
+           improvements, improvements == 1 ? "" : "s");
+    return regressions > 0;
+}
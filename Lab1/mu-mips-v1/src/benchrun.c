@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+/***************************************************************/
+/* Benchmark driver for mu-mips (make bench). Every program is run  */
+/* under every execution engine, each run in a fresh process with    */
+/* mu-mips -q -J so that startup, load time and peak RSS are its    */
+/* own; the per-run JSON is collected and every metric is summarized */
+/* over the repetitions (median, mean, standard deviation, min, max */
+/* and the samples themselves, for comparing against a baseline).   */
+/***************************************************************/
+
+#define DEFAULT_REPS 5
+#define MAX_REPS     100
+
+typedef enum { ENGINE_INTERPRETER, ENGINE_FAST, ENGINE_LOCKSTEP, NUM_ENGINES } engine_t;
+
+const char *ENGINE_NAMES[NUM_ENGINES] = { "interpreter", "fast", "lockstep" };
+
+typedef enum { METRIC_MIPS, METRIC_LOAD_MS, METRIC_STARTUP_MS, METRIC_PEAK_RSS_KB, METRIC_HOST_CPI, NUM_METRICS } metric_t;
+
+const char *METRIC_NAMES[NUM_METRICS] = {
+    "mips", "load_ms", "startup_ms", "peak_rss_kb", "host_cycles_per_instruction"
+};
+
+typedef struct {
+    double median, mean, stddev, min, max;
+} summary_t;
+
+const char *SIMULATOR = "./mu-mips";
+char INPUT_FILE[] = "/tmp/benchrun-input-XXXXXX";      /* REPL commands fed to each run */
+char LANES_FILE[] = "/tmp/benchrun-lanes-XXXXXX";      /* a single lockstep lane */
+char RESULT_FILE[] = "/tmp/benchrun-result-XXXXXX";    /* mu-mips -J output */
+
+/***************************************************************/
+/* Create a temporary file holding text                                     */
+/***************************************************************/
+void make_temp(char *path, const char *text) {
+    int fd = mkstemp(path);
+
+    if (fd < 0 || write(fd, text, strlen(text)) != (ssize_t)strlen(text)) {
+        printf("Error: Can't create %s\n", path);
+        exit(-1);
+    }
+    close(fd);
+}
+
+void remove_temps() {
+    unlink(INPUT_FILE);
+    unlink(LANES_FILE);
+    unlink(RESULT_FILE);
+}
+
+/***************************************************************/
+/* The number after "key": in text, or -1 if there is none           */
+/***************************************************************/
+double json_number(const char *text, const char *key) {
+    char pattern[64];
+    const char *p;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+    p = strstr(text, pattern);
+    return (p == NULL) ? -1 : strtod(p + strlen(pattern), NULL);
+}
+
+/***************************************************************/
+/* Run one program on one engine; fills the metrics of the run      */
+/* (METRIC_HOST_CPI is -1 without host counters) and returns the     */
+/* guest instruction count, or 0 if the run failed                      */
+/***************************************************************/
+uint64_t run_once(const char *program, engine_t engine, double *metrics) {
+    char text[4096];
+    const char *argv[16];
+    int argc = 0, status, fd;
+    size_t n;
+    pid_t pid;
+    FILE *fp;
+
+    argv[argc++] = SIMULATOR;
+    argv[argc++] = "-q";
+    argv[argc++] = "-J";
+    argv[argc++] = RESULT_FILE;
+    switch (engine) {
+        case ENGINE_INTERPRETER:
+            argv[argc++] = "-H";
+            argv[argc++] = "-F";
+            break;
+        case ENGINE_LOCKSTEP:
+            argv[argc++] = "-V";
+            argv[argc++] = LANES_FILE;
+            break;
+        default:
+            break;
+    }
+    argv[argc++] = program;
+    argv[argc] = NULL;
+
+    truncate(RESULT_FILE, 0);
+    pid = fork();
+    if (pid == 0) {
+        fd = open(INPUT_FILE, O_RDONLY);
+        dup2(fd, 0);
+        fd = open("/dev/null", O_WRONLY);
+        dup2(fd, 1);
+        dup2(fd, 2);
+        execv(SIMULATOR, (char * const *)argv);
+        _exit(127);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("Error: %s failed on %s (%s engine)\n", SIMULATOR, program, ENGINE_NAMES[engine]);
+        return 0;
+    }
+
+    fp = fopen(RESULT_FILE, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    n = fread(text, 1, sizeof(text) - 1, fp);
+    text[n] = '\0';
+    fclose(fp);
+    metrics[METRIC_MIPS] = json_number(text, "mips");
+    metrics[METRIC_LOAD_MS] = json_number(text, "load_seconds") * 1e3;
+    metrics[METRIC_STARTUP_MS] = json_number(text, "startup_seconds") * 1e3;
+    metrics[METRIC_PEAK_RSS_KB] = json_number(text, "peak_rss_kb");
+    metrics[METRIC_HOST_CPI] = json_number(text, "cycles");
+    return (uint64_t)json_number(text, "instructions");
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/***************************************************************/
+/* Summary statistics of n samples                                          */
+/***************************************************************/
+summary_t summarize(const double *samples, int n) {
+    double sorted[MAX_REPS], var = 0;
+    summary_t s = { 0 };
+    int i;
+
+    memcpy(sorted, samples, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), compare_doubles);
+    s.median = (n % 2) ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    s.min = sorted[0];
+    s.max = sorted[n - 1];
+    for (i = 0; i < n; i++) {
+        s.mean += samples[i] / n;
+    }
+    for (i = 0; i < n && n > 1; i++) {
+        var += (samples[i] - s.mean) * (samples[i] - s.mean) / (n - 1);
+    }
+    s.stddev = sqrt(var);
+    return s;
+}
+
+/***************************************************************/
+/* Summary of n samples as a JSON object                                    */
+/***************************************************************/
+void write_summary(FILE *out, const double *samples, int n) {
+    summary_t s = summarize(samples, n);
+    int i;
+
+    fprintf(out, "{\"median\": %.4f, \"mean\": %.4f, \"stddev\": %.4f, \"min\": %.4f, \"max\": %.4f, \"samples\": [",
+            s.median, s.mean, s.stddev, s.min, s.max);
+    for (i = 0; i < n; i++) {
+        fprintf(out, "%s%.4f", i ? ", " : "", samples[i]);
+    }
+    fprintf(out, "]}");
+}
+
+/***************************************************************/
+/* Benchmark name: the program's file name without directory or .in */
+/***************************************************************/
+void bench_name(const char *program, char *name, size_t size) {
+    const char *base = strrchr(program, '/');
+    char *dot;
+
+    snprintf(name, size, "%s", base ? base + 1 : program);
+    dot = strrchr(name, '.');
+    if (dot != NULL && strcmp(dot, ".in") == 0) {
+        *dot = '\0';
+    }
+}
+
+/***************************************************************/
+/* Print usage                                                                         */
+/***************************************************************/
+void usage(const char *prog) {
+    printf("Usage: %s [-r <repetitions>] [-o <results.json>] [-s <simulator>] <program.in>...\n", prog);
+}
+
+/***************************************************************/
+/* main                                                                                */
+/***************************************************************/
+int main(int argc, char *argv[]) {
+    int opt, reps = DEFAULT_REPS, rep, p, m, failed = 0, first = 1, have_host;
+    engine_t engine;
+    double samples[NUM_METRICS][MAX_REPS], metrics[NUM_METRICS];
+    uint64_t instructions = 0;
+    const char *out_path = "bench.json";
+    char name[64], date[32];
+    time_t now = time(NULL);
+    summary_t mips;
+    FILE *out;
+
+    while ((opt = getopt(argc, argv, "r:o:s:")) != -1) {
+        switch (opt) {
+            case 'r': reps = atoi(optarg); break;
+            case 'o': out_path = optarg; break;
+            case 's': SIMULATOR = optarg; break;
+            default: usage(argv[0]); exit(1);
+        }
+    }
+    if (optind >= argc || reps < 1 || reps > MAX_REPS) {
+        usage(argv[0]);
+        exit(1);
+    }
+    if (access(SIMULATOR, X_OK) != 0) {
+        printf("Error: Can't run %s\n", SIMULATOR);
+        exit(-1);
+    }
+    make_temp(INPUT_FILE, "sim\nquit\n");
+    make_temp(LANES_FILE, "0=0\n");
+    make_temp(RESULT_FILE, "");
+    atexit(remove_temps);
+
+    out = fopen(out_path, "w");
+    if (out == NULL) {
+        printf("Error: Can't write %s\n", out_path);
+        exit(-1);
+    }
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+    fprintf(out, "{\n  \"date\": \"%s\",\n  \"simulator\": \"%s\",\n  \"repetitions\": %d,\n  \"results\": [",
+            date, SIMULATOR, reps);
+
+    printf("%-12s %-12s %14s %12s %10s %11s %10s\n", "[Benchmark]", "[Engine]", "[Instructions]",
+           "[MIPS/s]", "[+/-]", "[Load ms]", "[RSS KB]");
+    for (p = optind; p < argc; p++) {
+        bench_name(argv[p], name, sizeof(name));
+        for (engine = 0; engine < NUM_ENGINES; engine++) {
+            have_host = 1;
+            for (rep = 0; rep < reps; rep++) {
+                instructions = run_once(argv[p], engine, metrics);
+                if (instructions == 0) {
+                    break;
+                }
+                for (m = 0; m < NUM_METRICS; m++) {
+                    samples[m][rep] = metrics[m];
+                }
+                have_host &= (metrics[METRIC_HOST_CPI] >= 0);
+            }
+            if (rep < reps) {
+                failed = 1;
+                continue;
+            }
+
+            fprintf(out, "%s\n    {\"benchmark\": \"%s\", \"engine\": \"%s\", \"instructions\": %llu",
+                    first ? "" : ",", name, ENGINE_NAMES[engine], (unsigned long long)instructions);
+            first = 0;
+            for (m = 0; m < NUM_METRICS; m++) {
+                if (m == METRIC_HOST_CPI && !have_host) {
+                    continue;
+                }
+                fprintf(out, ",\n     \"%s\": ", METRIC_NAMES[m]);
+                write_summary(out, samples[m], reps);
+            }
+            fprintf(out, "}");
+
+            mips = summarize(samples[METRIC_MIPS], reps);
+            printf("%-12s %-12s %14llu %12.2f %10.2f %11.3f %10.0f\n", name, ENGINE_NAMES[engine],
+                   (unsigned long long)instructions, mips.median, mips.stddev,
+                   summarize(samples[METRIC_LOAD_MS], reps).median, summarize(samples[METRIC_PEAK_RSS_KB], reps).median);
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+    fclose(out);
+    printf("\nResults written to %s\n", out_path);
+    return failed;
+}
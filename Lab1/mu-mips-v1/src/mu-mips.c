@@ -1,8 +1,24 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <ctype.h>
 #include <string.h>
 #include <stdint.h>
 #include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <sys/resource.h>
 
 #include "mu-mips.h"
 
@@ -21,6 +37,9 @@ void help() {
     printf("high <val>\t-- set the HI register to <val>\n");
     printf("low <val>\t-- set the LO register to <val>\n");
     printf("print\t-- print the program loaded into memory\n");
+    printf("stats\t-- show the dynamic instruction mix\n");
+    printf("rstep [n]\t-- go back <n> instructions (default 1; needs -T)\n");
+    printf("rcontinue [pc]\t-- go back to the last time the PC was <pc>, or to the start (needs -T)\n");
     printf("?\t-- display help menu\n");
     printf("quit\t-- exit the simulator\n\n");
     printf("------------------------------------------------------------------\n\n");
@@ -32,6 +51,12 @@ void help() {
 uint32_t mem_read_32(uint32_t address)
 {
     int i;
+    if (REUSE_ACTIVE) {
+        reuse_access(address);
+    }
+    if (PAGE_TABLE[address >> PAGE_SHIFT] & PAGE_DEVICE_MASK) {
+        return mmio_read(address);
+    }
     for (i = 0; i < NUM_MEM_REGION; i++) {
         if ( (address >= MEM_REGIONS[i].begin) &&  ( address <= MEM_REGIONS[i].end) ) {
             uint32_t offset = address - MEM_REGIONS[i].begin;
@@ -51,6 +76,13 @@ void mem_write_32(uint32_t address, uint32_t value)
 {
     int i;
     uint32_t offset;
+    if (REUSE_ACTIVE) {
+        reuse_access(address);
+    }
+    if (PAGE_TABLE[address >> PAGE_SHIFT] & PAGE_DEVICE_MASK) {
+        mmio_write(address, value);
+        return;
+    }
     for (i = 0; i < NUM_MEM_REGION; i++) {
         if ( (address >= MEM_REGIONS[i].begin) && (address <= MEM_REGIONS[i].end) ) {
             offset = address - MEM_REGIONS[i].begin;
@@ -59,17 +91,76 @@ void mem_write_32(uint32_t address, uint32_t value)
             MEM_REGIONS[i].mem[offset+2] = (value >> 16) & 0xFF;
             MEM_REGIONS[i].mem[offset+1] = (value >>  8) & 0xFF;
             MEM_REGIONS[i].mem[offset+0] = (value >>  0) & 0xFF;
+            /* only mapped pages are marked: unmapped stores are dropped */
+            if (!(PAGE_TABLE[address >> PAGE_SHIFT] & PAGE_DIRTY) || (address & (PAGE_SIZE - 1)) > PAGE_SIZE - 4) {
+                mem_mark_written(address, 4);
+            }
         }
     }
 }
 
 /***************************************************************/
-/* Execute one cycle                                                                                                              */
+/* Write the low 1 or 2 bytes of value to memory. Device registers    */
+/* are always written as whole words.                                             */
+/***************************************************************/
+void mem_write_partial(uint32_t address, uint32_t value, uint32_t size)
+{
+    uint8_t *p;
+    uint32_t avail;
+    if (PAGE_TABLE[address >> PAGE_SHIFT] & PAGE_DEVICE_MASK) {
+        mem_write_32(address, value);
+        return;
+    }
+    if (REUSE_ACTIVE) {
+        reuse_access(address);
+    }
+    p = mem_host_ptr(address, &avail);
+    if (p == NULL || avail < size) {
+        return;
+    }
+    p[0] = value & 0xFF;
+    if (size == 2) {
+        p[1] = (value >> 8) & 0xFF;
+    }
+    if (!(PAGE_TABLE[address >> PAGE_SHIFT] & PAGE_DIRTY) || (address & (PAGE_SIZE - 1)) > PAGE_SIZE - size) {
+        mem_mark_written(address, size);
+    }
+}
+
+/***************************************************************/
+/* Execute one cycle; a block also ends after MAX_BLOCK_LENGTH        */
+/* instructions, so every driver splits straight-line code alike        */
 /***************************************************************/
 void cycle() {
+    REUSE_ACTIVE = REUSE_PROFILE;   /* only references made by the program itself */
     handle_instruction();
+    REUSE_ACTIVE = FALSE;
+    if (RETIRED.flags & TRACE_ILLEGAL) {
+        return;
+    }
+    if (RETIRE_HOOKS) {
+        retire();
+    }
     CURRENT_STATE = NEXT_STATE;
     INSTRUCTION_COUNT++;
+    CYCLE_COUNT++;
+    if (INSTRUCTION_COUNT - BLOCK_START_COUNT >= MAX_BLOCK_LENGTH) {
+        BLOCK_END = TRUE;
+    }
+}
+
+/***************************************************************/
+/* Execute instructions up to and including the next control transfer    */
+/* (or MAX_BLOCK_LENGTH of straight-line code), then do the per-block */
+/* work (interrupt polling, profiling) once                                      */
+/***************************************************************/
+void run_block() {
+    BLOCK_END = FALSE;
+    do {
+        cycle();
+    } while (!BLOCK_END && RUN_FLAG);
+    
+    end_block();
 }
 
 /***************************************************************/
@@ -83,14 +174,23 @@ void run(int num_cycles) {
     }
     
     printf("Running simulator for %d cycles...\n\n", num_cycles);
-    int i;
-    for (i = 0; i < num_cycles; i++) {
+    host_stats_start(INSTRUCTION_COUNT);
+    /* natively run routines and skipped loops stay within the budget too */
+    RUN_END = INSTRUCTION_COUNT + (num_cycles > 0 ? num_cycles : 0);
+    while (INSTRUCTION_COUNT < RUN_END) {
         if (RUN_FLAG == FALSE) {
             printf("Simulation Stopped.\n\n");
             break;
         }
+        BLOCK_END = FALSE;
         cycle();
+        if (BLOCK_END) {
+            end_block();
+        }
     }
+    RUN_END = ~0ULL;
+    flush_guest_output();
+    host_stats_stop((HLE_ENABLED || SPIN_FF) ? ENGINE_FAST : ENGINE_INTERPRETER, INSTRUCTION_COUNT);
 }
 
 /***************************************************************/
@@ -103,10 +203,13 @@ void runAll() {
     }
     
     printf("Simulation Started...\n\n");
+    host_stats_start(INSTRUCTION_COUNT);
     while (RUN_FLAG){
-        cycle();
+        run_block();
     }
+    flush_guest_output();
     printf("Simulation Finished.\n\n");
+    host_stats_stop((HLE_ENABLED || SPIN_FF) ? ENGINE_FAST : ENGINE_INTERPRETER, INSTRUCTION_COUNT);
 }
 
 /***************************************************************/
@@ -133,7 +236,13 @@ void rdump() {
     printf("-------------------------------------\n");
     printf("Dumping Register Content\n");
     printf("-------------------------------------\n");
-    printf("# Instructions Executed\t: %u\n", INSTRUCTION_COUNT);
+    printf("# Instructions Executed\t: %llu\n", (unsigned long long)INSTRUCTION_COUNT);
+    if (HOST_STATS && HOST.guest_instructions > 0) {
+        printf("# Guest MIPS/s\t\t: %.2f\n", HOST.seconds > 0 ? HOST.guest_instructions / HOST.seconds / 1e6 : 0.0);
+        if (HOST.fds[0] >= 0) {
+            printf("# Host cycles/instr\t: %.2f\n", (double)HOST.totals[0] / HOST.guest_instructions);
+        }
+    }
     printf("PC\t: 0x%08x\n", CURRENT_STATE.PC);
     printf("-------------------------------------\n");
     printf("[Register]\t[Value]\n");
@@ -145,13 +254,20 @@ void rdump() {
     printf("[HI]\t: 0x%08x\n", CURRENT_STATE.HI);
     printf("[LO]\t: 0x%08x\n", CURRENT_STATE.LO);
     printf("-------------------------------------\n");
+    printf("# Cycles\t: %llu\n", (unsigned long long)CYCLE_COUNT);
+    printf("[Count]\t: 0x%08x\n", cp0_read(CP0_COUNT, 0));
+    printf("[Compare]\t: 0x%08x\n", CURRENT_STATE.CP0[CP0_COMPARE]);
+    printf("[Status]\t: 0x%08x\n", CURRENT_STATE.CP0[CP0_STATUS]);
+    printf("[Cause]\t: 0x%08x\n", CURRENT_STATE.CP0[CP0_CAUSE]);
+    printf("[EPC]\t: 0x%08x\n", CURRENT_STATE.CP0[CP0_EPC]);
+    printf("-------------------------------------\n");
 }
 
 /***************************************************************/
 /* Read a command from standard input.                                                               */
 /***************************************************************/
 void handle_command() {
-    char buffer[20];
+    char buffer[20], line[64];
     uint32_t start, stop, cycles;
     uint32_t register_no;
     int register_value;
@@ -160,13 +276,19 @@ void handle_command() {
     printf("MU-MIPS SIM:> ");
     
     if (scanf("%s", buffer) == EOF){
+        close_guest_fds();
         exit(0);
     }
     
     switch(buffer[0]) {
         case 'S':
         case 's':
-            runAll();
+            if (buffer[1] == 't' || buffer[1] == 'T'){
+                print_mix();
+            }
+            else {
+                runAll();
+            }
             break;
         case 'M':
         case 'm':
@@ -180,6 +302,7 @@ void handle_command() {
             break;
         case 'Q':
         case 'q':
+            close_guest_fds();
             printf("**************************\n");
             printf("Exiting MU-MIPS! Good Bye...\n");
             printf("**************************\n");
@@ -191,6 +314,17 @@ void handle_command() {
             }else if(buffer[1] == 'e' || buffer[1] == 'E'){
                 reset();
             }
+            else if (buffer[1] == 's' || buffer[1] == 'S') {
+                if (fgets(line, sizeof(line), stdin) == NULL || sscanf(line, "%u", &cycles) != 1) {
+                    cycles = 1;
+                }
+                tt_rstep(cycles);
+            }
+            else if (buffer[1] == 'c' || buffer[1] == 'C') {
+                start = 0;
+                stop = (fgets(line, sizeof(line), stdin) != NULL && sscanf(line, "%x", &start) == 1);
+                tt_rcontinue(stop, start);
+            }
             else {
                 if (scanf("%d", &cycles) != 1) {
                     break;
@@ -205,6 +339,7 @@ void handle_command() {
             }
             CURRENT_STATE.REGS[register_no] = register_value;
             NEXT_STATE.REGS[register_no] = register_value;
+            tt_start();
             break;
         case 'H':
         case 'h':
@@ -213,6 +348,7 @@ void handle_command() {
             }
             CURRENT_STATE.HI = hi_reg_value;
             NEXT_STATE.HI = hi_reg_value;
+            tt_start();
             break;
         case 'L':
         case 'l':
@@ -221,6 +357,7 @@ void handle_command() {
             }
             CURRENT_STATE.LO = lo_reg_value;
             NEXT_STATE.LO = lo_reg_value;
+            tt_start();
             break;
         case 'P':
         case 'p':
@@ -243,20 +380,39 @@ void reset() {
     }
     CURRENT_STATE.HI = 0;
     CURRENT_STATE.LO = 0;
+    for (i = 0; i < CP0_REGS; i++){
+        CURRENT_STATE.CP0[i] = 0;
+    }
     
     for (i = 0; i < NUM_MEM_REGION; i++) {
         uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
         memset(MEM_REGIONS[i].mem, 0, region_size);
     }
+    for (i = 0; i < NUM_PAGES; i++) {
+        PAGE_TABLE[i] &= ~(PAGE_WRITTEN | PAGE_DIRTY);
+    }
+    NUM_DIRTY_PAGES = 0;
+    
+    memset(PMC, 0, sizeof(PMC));
+    close_guest_fds();
+    hle_flush();
     
     /*load program*/
     load_program();
+    load_kernel();
     
     /*reset PC*/
     INSTRUCTION_COUNT = 0;
+    CYCLE_COUNT = 0;
+    COUNT_BASE = 0;
+    clear_blocks();
+    BLOCK_START_PC = MEM_TEXT_BEGIN;
+    BLOCK_START_COUNT = 0;
     CURRENT_STATE.PC =  MEM_TEXT_BEGIN;
     NEXT_STATE = CURRENT_STATE;
+    schedule_timer();
     RUN_FLAG = TRUE;
+    tt_start();
 }
 
 /***************************************************************/
@@ -276,8 +432,17 @@ void init_memory() {
 /**************************************************************/
 void load_program() {
     FILE * fp;
-    int i, word;
-    uint32_t address;
+    int i, word, invalid = 0;
+    uint32_t address, first_invalid = 0;
+    
+    if (is_assembly(prog_file)) {
+        if (assemble(prog_file, MEM_TEXT_BEGIN, MEM_DATA_BEGIN) != 0) {
+            exit(-1);
+        }
+        PROGRAM_SIZE = (ASM.text - MEM_TEXT_BEGIN + 3) / 4;
+        printf("Program assembled into memory.\n%d words of text, %u bytes of data.\n\n", PROGRAM_SIZE, ASM.data - MEM_DATA_BEGIN);
+        return;
+    }
     
     /* Open program file. */
     fp = fopen(prog_file, "r");
@@ -293,1084 +458,5935 @@ void load_program() {
         address = MEM_TEXT_BEGIN + i;
         mem_write_32(address, word);
         printf("writing 0x%08x into address 0x%08x (%d)\n", word, address, address);
+        if (!instruction_valid(word) && invalid++ == 0) {
+            first_invalid = address;
+        }
         i += 4;
     }
     PROGRAM_SIZE = i/4;
     printf("Program loaded into memory.\n%d words written into memory.\n\n", PROGRAM_SIZE);
+    if (invalid > 0) {
+        printf("Warning: %d words are not valid instructions, the first at 0x%08x\n\n", invalid, first_invalid);
+    }
     fclose(fp);
 }
 
-/************************************************************/
-/* decode and execute instruction                                                                     */
-/************************************************************/
-void handle_instruction()
-{
-    /*IMPLEMENT THIS*/
-    /* execute one instruction at a time. Use/update CURRENT_STATE and and NEXT_STATE, as necessary.*/
-    uint32_t instruction = mem_read_32(CURRENT_STATE.PC);
-    uint32_t Op_Code_Special = 0;
-    uint32_t op = 0;
-    uint32_t rs = 0;
-    uint32_t rt = 0;
-    uint32_t rd = 0;
-    uint32_t sa = 0;
-    uint32_t immediate = 0;
-    uint32_t base = 0;
-    uint32_t mem_location = 0;
-    uint32_t temp = 0;
-    uint32_t target = 0;
-    printf("Instruction: %x\n",instruction);
-    if((instruction | 0x03ffffff) == 0x03ffffff){
-        Op_Code_Special = instruction & 0x0000003f;
-        
-        switch(Op_Code_Special){
-            case 0x00000020: case 0x00000021: //ADD, ADDU
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            rt = instruction & 0x001F0000;
-            rt = rt >> 16;
-            rd = instruction & 0x0000F800;
-            rd = rd >> 11;
-            NEXT_STATE.REGS[rd] = CURRENT_STATE.REGS[rs] + CURRENT_STATE.REGS[rt];
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            
-            break;
-
-            case 0x00000022: case 0x00000023: //SUB, SUBU
-			rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-			NEXT_STATE.REGS[rd] = CURRENT_STATE.REGS[rs] - CURRENT_STATE.REGS[rt];
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-			break;
-
-			case 0x00000018: case 0x00000019: //MULT, MULTU
-			rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-            temp = CURRENT_STATE.REGS[rs] * CURRENT_STATE.REGS[rt];
-            NEXT_STATE.HI = temp & 0xFFFF0000;
-            NEXT_STATE.LO = temp & 0x0000FFFF;
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-			break;
-
-            case 0x0000001A: case 0x00000001B: //DIV, DIVU
-            rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-            if(CURRENT_STATE.REGS[rt] != 0x0000){
-                NEXT_STATE.HI = CURRENT_STATE.REGS[rs] % CURRENT_STATE.REGS[rt];
-                NEXT_STATE.LO = CURRENT_STATE.REGS[rs] / CURRENT_STATE.REGS[rt];
-            }
-            else{
-                NEXT_STATE.HI = CURRENT_STATE.HI;
-                NEXT_STATE.LO = CURRENT_STATE.LO;
-            }
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-
-			case 0x00000024: //AND
-			rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-			NEXT_STATE.REGS[rd] = CURRENT_STATE.REGS[rs] & CURRENT_STATE.REGS[rt];
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-			break;
-
-			case 0x00000025: //OR
-			rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-			NEXT_STATE.REGS[rd] = CURRENT_STATE.REGS[rs] | CURRENT_STATE.REGS[rt];
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-			break;
-
-			case 0x00000026: //XOR
-			rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-			NEXT_STATE.REGS[rd] = CURRENT_STATE.REGS[rs] ^ CURRENT_STATE.REGS[rt];
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-			break;
-
-			case 0x00000027: //NOR
-			rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-			NEXT_STATE.REGS[rd] = ~ (CURRENT_STATE.REGS[rs] ^ CURRENT_STATE.REGS[rt]);
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-			break;
-
-            case 0x0000002A: //SLT
-            rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-            if(CURRENT_STATE.REGS[rs] < CURRENT_STATE.REGS[rt]){
-                NEXT_STATE.REGS[rd] = 0x01;
-            }
-            else{
-                NEXT_STATE.REGS[rd] = 0x00;
-            }
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-
-            case 0x00000000: //SLL
-            rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-            sa = instruction & 0x000007C0;
-            sa = sa >> 6;
-            NEXT_STATE.REGS[rd] = CURRENT_STATE.REGS[rt] << sa;
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-
-            case 0x00000002: //SRL
-            rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-            sa = instruction & 0x000007C0;
-            sa = sa >> 6;
-            NEXT_STATE.REGS[rd] = CURRENT_STATE.REGS[rt] >> sa;
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-
-            case 0x00000003: //SRA
-            rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-            sa = instruction & 0x000007C0;
-            sa = sa >> 6;
-            if((CURRENT_STATE.REGS[rt] & 0x80000000) == 0x80000000){
-                for(uint32_t i = 0; i<sa; i++){
-                    NEXT_STATE.REGS[rd] = (CURRENT_STATE.REGS[rt] >> 1) | 0x80000000;
-                }
-            }
-            else{
-                NEXT_STATE.REGS[rd] = CURRENT_STATE.REGS[rt] >> sa;
-            }
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-
-            case 0x00000010: //MFHI
-            rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-            NEXT_STATE.REGS[rd] = CURRENT_STATE.HI;
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-
-            case 0x00000012: //MFLO
-            rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-            NEXT_STATE.REGS[rd] = CURRENT_STATE.LO;
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-
-            case 0x00000011: //MTHI
-            rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-            NEXT_STATE.HI = CURRENT_STATE.REGS[rs];
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-
-            case 0x00000013: //MTLO
-            rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-            NEXT_STATE.LO = CURRENT_STATE.REGS[rs];
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-
-            case 0x00000008: //JR
-            rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-            NEXT_STATE.PC = CURRENT_STATE.REGS[rs];
-            break;
-
-            case 0x00000009: //JALR
-            rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-            NEXT_STATE.REGS[rd] = CURRENT_STATE.PC + 8;
-            NEXT_STATE.PC = CURRENT_STATE.REGS[rs];
-            break;
-
-			case 0x0000000C:  //SYSTEMCALL
-            CURRENT_STATE.REGS[2] = 0x0A;
-			// if(CURRENT_STATE.REGS[2] == 0x0A)
-			// {
-				RUN_FLAG = FALSE;
-			// }
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-			break;
-                
-        }
-    }
-    else{
-        op = instruction & 0xFC000000;
-        switch(op){
-            case 0x3C000000: //LUI
-            immediate = instruction & 0x0000FFFF;
-            immediate = immediate << 16;
-            rt = instruction & 0x001F0000;
-            rt = rt >> 16;
-            NEXT_STATE.REGS[rt] = immediate;
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-                
-            case 0x24000000: case 0x20000000: //ADDIU
-            immediate = instruction & 0x0000FFFF;
-            if((immediate & 0x00008000) == 0x00008000){
-                immediate = immediate | 0xFFFF0000;
-            }
-            else{
-                immediate = immediate & 0x0000FFFF;
-            }
-            rt = instruction & 0x001F0000;
-            rt = rt >> 16;
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            NEXT_STATE.REGS[rt] = immediate + CURRENT_STATE.REGS[rs];
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-                
-            case 0x8C000000: //LW
-            base = instruction & 0x03E00000;
-            base = base >> 21;
-            immediate = instruction & 0x0000FFFF;
-            if((immediate & 0x00008000) == 0x00008000){
-                immediate = immediate | 0xFFFF0000;
-            }
-            else{
-                immediate = immediate & 0x0000FFFF;
-            }
-            rt = instruction & 0x001F0000;
-            rt = rt >> 16;
-            mem_location = CURRENT_STATE.REGS[base] + immediate;
-            mem_location = mem_location | 0x00010000;
-            NEXT_STATE.REGS[rt] = mem_read_32(mem_location);
-            
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-
-            case 0x80000000: //LB
-            base = instruction & 0x03E00000;
-            base = base >> 21;
-            immediate = instruction & 0x0000FFFF;
-            if((immediate & 0x00008000) == 0x00008000){
-                immediate = immediate | 0xFFFF0000;
-            }
-            else{
-                immediate = immediate & 0x0000FFFF;
-            }
-            rt = instruction & 0x001F0000;
-            rt = rt >> 16;
-            mem_location = CURRENT_STATE.REGS[base] + immediate;
-            mem_location = mem_location | 0x00010000;
-            NEXT_STATE.REGS[rt] = mem_read_32(mem_location);
-            NEXT_STATE.REGS[rt] = NEXT_STATE.REGS[rt] & 0x000000FF;
-            if((NEXT_STATE.REGS[rt] & 0x00000080) == 0x00000080){
-                NEXT_STATE.REGS[rt] = NEXT_STATE.REGS[rt] | 0xFFFFFF00;
-            }
-            
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-
-            case 0x84000000: //LH
-            base = instruction & 0x03E00000;
-            base = base >> 21;
-            immediate = instruction & 0x0000FFFF;
-            if((immediate & 0x00008000) == 0x00008000){
-                immediate = immediate | 0xFFFF0000;
-            }
-            else{
-                immediate = immediate & 0x0000FFFF;
-            }
-            rt = instruction & 0x001F0000;
-            rt = rt >> 16;
-            mem_location = CURRENT_STATE.REGS[base] + immediate;
-            mem_location = mem_location | 0x00010000;
-            NEXT_STATE.REGS[rt] = mem_read_32(mem_location);
-            NEXT_STATE.REGS[rt] = NEXT_STATE.REGS[rt] & 0x0000FFFF;
-            if((NEXT_STATE.REGS[rt] & 0x00008000) == 0x00008000){
-                NEXT_STATE.REGS[rt] = NEXT_STATE.REGS[rt] | 0xFFFF0000;
-            }
-            
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-
-            case 0xAC000000: //SW
-			base = instruction & 0x03E00000;
-			base = base >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			immediate = instruction & 0x0000FFFF;
-            if((immediate & 0x00008000) == 0x00008000){
-                immediate = immediate | 0xFFFF0000;
-            }
-            else{
-                immediate = immediate & 0x0000FFFF;
-            }
-			mem_location = CURRENT_STATE.REGS[base] + immediate;
-            mem_location = mem_location | 0x00010000;
-			mem_write_32(mem_location, CURRENT_STATE.REGS[rt]);
-			
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-			break;
-
-            case 0x30000000: //ANDI
-            immediate = instruction & 0x0000FFFF;
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-            NEXT_STATE.REGS[rt] = immediate & CURRENT_STATE.REGS[rt];
-            
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-
-            case 0x34000000: //ORI
-            immediate = instruction & 0x0000FFFF;
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-            NEXT_STATE.REGS[rt] = immediate | CURRENT_STATE.REGS[rt];
-            
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-
-            case 0x38000000: //XORI
-            immediate = instruction & 0x0000FFFF;
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-            NEXT_STATE.REGS[rt] = immediate ^ CURRENT_STATE.REGS[rt];
-            
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-
-            case 0x28000000: //SLTI
-            immediate = instruction & 0x0000FFFF;
-            if((immediate & 0x00008000) == 0x00008000){
-                immediate = immediate | 0xFFFF0000;
-            }
-            else{
-                immediate = immediate & 0x0000FFFF;
-            }
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-            if(CURRENT_STATE.REGS[rs] < immediate){
-                NEXT_STATE.REGS[rt] = 0x01;
-            }
-            else{
-                NEXT_STATE.REGS[rt] = 0x00;
-            }
-            
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-
-            case 0xA4000000: //SH
-            base = instruction & 0x03E00000;
-			base = base >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			immediate = instruction & 0x0000FFFF;
-            if((immediate & 0x00008000) == 0x00008000){
-                immediate = immediate | 0xFFFF0000;
-            }
-            else{
-                immediate = immediate & 0x0000FFFF;
-            }
-			mem_location = CURRENT_STATE.REGS[base] + immediate;
-            mem_location = mem_location | 0x00010000;
-			mem_write_32(mem_location, (CURRENT_STATE.REGS[rt] & 0x0000FFFF));
-			
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-
-            case 0xA0000000: //SB
-            base = instruction & 0x03E00000;
-			base = base >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			immediate = instruction & 0x0000FFFF;
-            if((immediate & 0x00008000) == 0x00008000){
-                immediate = immediate | 0xFFFF0000;
-            }
-            else{
-                immediate = immediate & 0x0000FFFF;
-            }
-			mem_location = CURRENT_STATE.REGS[base] + immediate;
-            mem_location = mem_location | 0x00010000;
-			mem_write_32(mem_location, (CURRENT_STATE.REGS[rt] & 0x000000FF));
-			
-            NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-            break;
-
-            case 0x08000000: //J
-            target = instruction & 0x03FFFFFF;
-            target = target << 2;
-            temp = CURRENT_STATE.PC & 0xF0000000;
-            NEXT_STATE.PC = temp | target; //changed this to an OR, not sure if right
-            
-            break;
+/**************************************************************/
+/* load the optional exception handler image at EXCEPTION_VECTOR  */
+/**************************************************************/
+void load_kernel() {
+    FILE * fp;
+    int i, word;
+    
+    if (kernel_file[0] == '\0') {
+        return;
+    }
+    if (is_assembly(kernel_file)) {
+        if (assemble(kernel_file, EXCEPTION_VECTOR, MEM_KDATA_BEGIN) != 0) {
+            exit(-1);
+        }
+        printf("Kernel assembled at 0x%08x.\n%u words written into memory.\n\n", EXCEPTION_VECTOR, (ASM.text - EXCEPTION_VECTOR + 3) / 4);
+        return;
+    }
+    
+    fp = fopen(kernel_file, "r");
+    if (fp == NULL) {
+        printf("Error: Can't open kernel file %s\n", kernel_file);
+        exit(-1);
+    }
+    
+    i = 0;
+    while( fscanf(fp, "%x\n", &word) != EOF ) {
+        mem_write_32(EXCEPTION_VECTOR + i, word);
+        i += 4;
+    }
+    printf("Kernel loaded at 0x%08x.\n%d words written into memory.\n\n", EXCEPTION_VECTOR, i/4);
+    fclose(fp);
+}
 
-            case 0x0C000000: //JAL 
-            target = instruction & 0x03FFFFFF;
-            target = target << 2;
-            NEXT_STATE.REGS[31] = CURRENT_STATE.PC + 8;
-            temp = CURRENT_STATE.PC & 0xF0000000; //changed this to an OR, not sure if right
-            NEXT_STATE.PC = temp | target;
-            
-            break;
+/**************************************************************/
+/* Is this program written in assembly (.s, .asm) rather than hex?  */
+/**************************************************************/
+int is_assembly(const char *file) {
+    const char *dot = strrchr(file, '.');
+    
+    return dot != NULL && (strcmp(dot, ".s") == 0 || strcmp(dot, ".asm") == 0);
+}
 
-            case 0x10000000: //BEQ
-            target = instruction & 0x0000FFFF;
-            target = target << 2;
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-            if((target & 0x00008000) == 0x00008000){
-                target = target | 0xFFFF0000;
-            }
-            else{
-                target = target & 0x0000FFFF;
-            }
-            if(CURRENT_STATE.REGS[rt] == CURRENT_STATE.REGS[rs]){
-                NEXT_STATE.PC = CURRENT_STATE.PC + target;
-            }
-            
-            break;
+/**************************************************************/
+/* Report an assembly error at the current line                          */
+/**************************************************************/
+void asm_error(const char *format, ...) {
+    va_list args;
+    
+    printf("%s:%d: error: ", ASM.file, ASM.line);
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+    ASM.errors++;
+}
 
-            case 0x14000000: //BNE
-            target = instruction & 0x0000FFFF;
-            target = target << 2;
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-            if((target & 0x00008000) == 0x00008000){
-                target = target | 0xFFFF0000;
-            }
-            else{
-                target = target & 0x0000FFFF;
-            }
-            if(CURRENT_STATE.REGS[rt] != CURRENT_STATE.REGS[rs]){
-                NEXT_STATE.PC = CURRENT_STATE.PC + target;
-            }
-            
+/**************************************************************/
+/* The symbol table slot of name: its entry, or the free slot for it  */
+/**************************************************************/
+asm_symbol_t *asm_symbol(const char *name) {
+    uint32_t hash = 2166136261u, i;
+    const char *p;
+    
+    for (p = name; *p != '\0'; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    for (i = hash & (ASM_SYMBOL_SLOTS - 1); ASM_SYMBOLS[i].name != NULL; i = (i + 1) & (ASM_SYMBOL_SLOTS - 1)) {
+        if (strcmp(ASM_SYMBOLS[i].name, name) == 0) {
             break;
+        }
+    }
+    return &ASM_SYMBOLS[i];
+}
 
-            case 0x18000000: //BLEZ
-            target = instruction & 0x0000FFFF;
-            target = target << 2;
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            if((target & 0x00008000) == 0x00008000){
-                target = target | 0xFFFF0000;
-            }
-            else{
-                target = target & 0x0000FFFF;
-            }
-            if((CURRENT_STATE.REGS[rs] == 0x00) || ((CURRENT_STATE.REGS[rs] & 0x80000000) == 0x80000000)){
-                NEXT_STATE.PC = CURRENT_STATE.PC + target;
+/**************************************************************/
+/* Define a label (first pass), growing the table at half full          */
+/**************************************************************/
+void asm_define(const char *name, uint32_t address) {
+    asm_symbol_t *old = ASM_SYMBOLS, *slot;
+    uint32_t old_slots = ASM_SYMBOL_SLOTS, i;
+    
+    if (2 * (ASM_NUM_SYMBOLS + 1) > ASM_SYMBOL_SLOTS) {
+        ASM_SYMBOL_SLOTS = old_slots ? 2 * old_slots : 256;
+        ASM_SYMBOLS = calloc(ASM_SYMBOL_SLOTS, sizeof(asm_symbol_t));
+        for (i = 0; i < old_slots; i++) {
+            if (old[i].name != NULL) {
+                *asm_symbol(old[i].name) = old[i];
             }
-            break;
+        }
+        free(old);
+    }
+    slot = asm_symbol(name);
+    if (slot->name != NULL) {
+        asm_error("label '%s' is already defined", name);
+        return;
+    }
+    slot->name = strdup(name);
+    slot->address = address;
+    ASM_NUM_SYMBOLS++;
+}
 
-            case 0x1C000000: //BGTZ
-            target = instruction & 0x0000FFFF;
-            target = target << 2;
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            if((target & 0x00008000) == 0x00008000){
-                target = target | 0xFFFF0000;
-            }
-            else{
-                target = target & 0x0000FFFF;
-            }
-            if((CURRENT_STATE.REGS[rs] != 0x00) && ((CURRENT_STATE.REGS[rs] & 0x80000000) != 0x80000000)){
-                NEXT_STATE.PC = CURRENT_STATE.PC + target;
-            }
-            break;
+void asm_free_symbols() {
+    uint32_t i;
+    
+    for (i = 0; i < ASM_SYMBOL_SLOTS; i++) {
+        free(ASM_SYMBOLS[i].name);
+    }
+    free(ASM_SYMBOLS);
+    ASM_SYMBOLS = NULL;
+    ASM_SYMBOL_SLOTS = 0;
+    ASM_NUM_SYMBOLS = 0;
+}
 
-            case 0x04000000: //BLTZ, BGEZ
-            rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-            target = instruction & 0x0000FFFF;
-            target = target << 2;
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            if((target & 0x00008000) == 0x00008000){
-                target = target | 0xFFFF0000;
-            }
-            else{
-                target = target & 0x0000FFFF;
-            }
-            if(rt == 0x01){ //BGEZ
-                if((CURRENT_STATE.REGS[rs] == 0x00) || ((CURRENT_STATE.REGS[rs] & 0x80000000) != 0x80000000)){
-                    NEXT_STATE.PC = CURRENT_STATE.PC + target;
-                }
-            }
-            else{ //BLTZ
-                if((CURRENT_STATE.REGS[rs] & 0x80000000) == 0x80000000){
-                    NEXT_STATE.PC = CURRENT_STATE.PC + target;
-                }
+/**************************************************************/
+/* Parse a register: $0..$31 or $name                                           */
+/**************************************************************/
+int asm_register(const char *text, uint32_t *reg) {
+    char *end;
+    
+    if (text[0] == '$' && text[1] >= '0' && text[1] <= '9') {
+        *reg = strtoul(text + 1, &end, 10);
+        if (*end == '\0' && *reg < 32) {
+            return TRUE;
+        }
+    }
+    else if (text[0] == '$') {
+        for (*reg = 0; *reg < 32; (*reg)++) {
+            if (strcmp(text + 1, ASM_REGISTER_NAMES[*reg]) == 0) {
+                return TRUE;
             }
-            break;
         }
-        
     }
-    
-    
-    
+    asm_error("expected a register, got '%s'", text);
+    return FALSE;
 }
 
+/**************************************************************/
+/* Parse a value: a number, a character ('a') or a label, optionally */
+/* plus or minus a number. Labels are 0 until the second pass.        */
+/**************************************************************/
+int asm_value(const char *text, uint32_t *value) {
+    char name[ASM_MAX_LABEL], *end;
+    asm_symbol_t *symbol;
+    long long n;
+    size_t len;
+    
+    if (text[0] == '\'' && text[1] != '\0' && text[2] == '\'' && text[3] == '\0') {
+        *value = (uint8_t)text[1];
+        return TRUE;
+    }
+    if (isdigit((unsigned char)text[0]) || text[0] == '-' || text[0] == '+') {
+        n = strtoll(text, &end, 0);
+        if (*end != '\0' || end == text || n < -0x80000000LL || n > 0xFFFFFFFFLL) {
+            asm_error("bad number '%s'", text);
+            return FALSE;
+        }
+        *value = (uint32_t)n;
+        return TRUE;
+    }
+    len = strspn(text, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_.");
+    if (len == 0 || len >= sizeof(name) || isdigit((unsigned char)text[0])) {
+        asm_error("bad value '%s'", text);
+        return FALSE;
+    }
+    memcpy(name, text, len);
+    name[len] = '\0';
+    n = 0;
+    if (text[len] != '\0') {
+        n = strtoll(text + len, &end, 0);
+        if ((text[len] != '+' && text[len] != '-') || *end != '\0') {
+            asm_error("bad value '%s'", text);
+            return FALSE;
+        }
+    }
+    *value = (uint32_t)n;
+    symbol = (ASM_SYMBOLS != NULL) ? asm_symbol(name) : NULL;
+    if (symbol != NULL && symbol->name != NULL) {
+        *value += symbol->address;
+    }
+    else if (ASM.pass == 2) {
+        asm_error("undefined label '%s'", name);
+        return FALSE;
+    }
+    return TRUE;
+}
 
-/************************************************************/
-/* Initialize Memory                                                                                                    */
-/************************************************************/
-void initialize() {
-    init_memory();
-    CURRENT_STATE.PC = MEM_TEXT_BEGIN;
-    NEXT_STATE = CURRENT_STATE;
-    RUN_FLAG = TRUE;
+/**************************************************************/
+/* Emit size bytes at the current location (into memory on the      */
+/* second pass)                                                                       */
+/**************************************************************/
+void asm_emit(uint32_t value, uint32_t size) {
+    uint32_t *location = ASM.in_data ? &ASM.data : &ASM.text;
+    
+    if (ASM.pass == 2) {
+        if (size == 4) {
+            mem_write_32(*location, value);
+        }
+        else {
+            mem_write_partial(*location, value, size);
+        }
+    }
+    *location += size;
 }
 
-/************************************************************/
-/* Print the program loaded into memory (in MIPS assembly format)    */
-/************************************************************/
-void print_program(){
+/**************************************************************/
+/* Pad to a multiple of alignment and give the waiting labels the     */
+/* resulting address                                                                */
+/**************************************************************/
+void asm_align(uint32_t alignment) {
+    uint32_t *location = ASM.in_data ? &ASM.data : &ASM.text;
     int i;
-    uint32_t addr;
     
-    for(i=0; i<PROGRAM_SIZE; i++){
-        addr = MEM_TEXT_BEGIN + (i*4);
-        printf("[0x%x]\t", addr);
-        print_instruction(addr);
+    while (*location & (alignment - 1)) {
+        asm_emit(0, 1);
+    }
+    for (i = 0; i < ASM.num_pending && ASM.pass == 1; i++) {
+        asm_define(ASM.pending[i], *location);
     }
+    ASM.num_pending = 0;
 }
 
-/************************************************************/
-/* Print the instruction at given memory address (in MIPS assembly format)    */
-/************************************************************/
-void print_instruction(uint32_t addr){
-    uint32_t instruction = mem_read_32(addr);
-    uint32_t Op_Code_Special = 0;
-    uint32_t op = 0;
-    uint32_t rs = 0;
-    uint32_t rt = 0;
-    uint32_t rd = 0;
-    uint32_t sa = 0;
-    uint32_t immediate = 0;
-    uint32_t base = 0;
-    uint32_t mem_location = 0;
-    uint32_t target = 0;
-    if((instruction | 0x03ffffff) == 0x03ffffff){
-        Op_Code_Special = instruction & 0x0000003f;
-        
-        switch(Op_Code_Special){
-            case 0x00000020: //ADD
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            rt = instruction & 0x001F0000;
-            rt = rt >> 16;
-            rd = instruction & 0x0000F800;
-            rd = rd >> 11;
-            printf("ADD: $%u = $%u + $%u\n",rd, rs, rt);
-            break;
-
-            case 0x00000021: //ADDU
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            rt = instruction & 0x001F0000;
-            rt = rt >> 16;
-            rd = instruction & 0x0000F800;
-            rd = rd >> 11;
-            printf("ADDU: $%u = $%u + $%u\n",rd, rs, rt);
-            break;
+/**************************************************************/
+/* Split comma-separated operands in place, trimming blanks; returns */
+/* how many there are                                                              */
+/**************************************************************/
+int asm_split(char *text, char **operands) {
+    int count = 0;
+    char *p = text, *end;
+    
+    while (*p != '\0') {
+        p += strspn(p, " \t");
+        if (count == ASM_MAX_OPERANDS) {
+            asm_error("too many operands");
+            return count;
+        }
+        operands[count++] = p;
+        p += strcspn(p, ",");
+        end = p;
+        while (end > operands[count - 1] && (end[-1] == ' ' || end[-1] == '\t')) {
+            end--;
+        }
+        if (*p == ',') {
+            p++;
+            if (*(p + strspn(p, " \t")) == '\0') {
+                asm_error("missing operand after ','");
+            }
+        }
+        *end = '\0';
+    }
+    return count;
+}
 
-            case 0x00000022: //SUB
-            rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-			printf("SUB: $%u = $%u - $%u\n", rd, rs, rt);
-			break;
-
-            case 0x00000023: //SUBU
-            rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-			printf("SUBU: $%u = $%u - $%u\n", rd, rs, rt);
+/**************************************************************/
+/* Encode one instruction from its INSTRUCTION_SET operand list      */
+/**************************************************************/
+void asm_encode(opcode_t op, char **operands, int count) {
+    const char *format = OPCODE_OPERANDS[op], *p;
+    uint32_t word = OPCODE_MATCHES[op], pc = ASM.text, value, base, expected = 0;
+    int32_t delta;
+    char *open;
+    int i = 0, ok = TRUE;
+    
+    for (p = format; *p != '\0'; p++) {
+        expected += (*p != ',');
+    }
+    if (count != (int)expected && !(strchr(format, 'x') && count == (int)expected - 1)) {
+        asm_error("%s takes %u operand%s", OPCODE_NAMES[op], expected, expected == 1 ? "" : "s");
+        asm_emit(0, 4);
+        return;
+    }
+    for (p = format; *p != '\0' && i < count && ok; p++) {
+        switch (*p) {
+            case 'd':
+                ok = asm_register(operands[i++], &value);
+                word |= value << 11;
+                break;
+            case 's':
+                ok = asm_register(operands[i++], &value);
+                word |= value << 21;
+                break;
+            case 't':
+                ok = asm_register(operands[i++], &value);
+                word |= value << 16;
+                break;
+            case 'c':
+                ok = (operands[i][0] == '$') ? asm_register(operands[i], &value) : asm_value(operands[i], &value);
+                if (ok && value > 31) {
+                    asm_error("no CP0 register %u", value);
+                    ok = FALSE;
+                }
+                word |= (value & 0x1F) << 11;
+                i++;
+                break;
+            case 'a':
+            case 'x':
+                ok = asm_value(operands[i++], &value);
+                if (ok && value > (uint32_t)(*p == 'a' ? 31 : 7)) {
+                    asm_error("%s out of range: %d", *p == 'a' ? "shift amount" : "select", (int32_t)value);
+                    ok = FALSE;
+                }
+                word |= (*p == 'a') ? (value & 0x1F) << 6 : (value & 0x7);
+                break;
+            case 'i':
+            case 'u':
+                ok = asm_value(operands[i++], &value);
+                if (ok && value > 0xFFFF && value < 0xFFFF8000) {
+                    asm_error("immediate out of range: %d", (int32_t)value);
+                    ok = FALSE;
+                }
+                word |= value & 0xFFFF;
+                break;
+            case 'm':
+                /* offset(base), the offset optional */
+                open = strchr(operands[i], '(');
+                if (open == NULL || open[strlen(open) - 1] != ')') {
+                    asm_error("expected offset($base), got '%s'", operands[i]);
+                    ok = FALSE;
+                    break;
+                }
+                *open = '\0';
+                open[strlen(open + 1)] = '\0';
+                value = 0;
+                ok = (operands[i][0] == '\0' || asm_value(operands[i], &value)) && asm_register(open + 1, &base);
+                if (ok && value > 0x7FFF && value < 0xFFFF8000) {
+                    asm_error("offset out of range: %d", (int32_t)value);
+                    ok = FALSE;
+                }
+                word |= (base << 21) | (value & 0xFFFF);
+                i++;
+                break;
+            case 'b':
+                /* the simulator branches to PC + offset, with no delay slot and no +4 */
+                ok = asm_value(operands[i++], &value);
+                delta = (int32_t)(value - pc);
+                if (ok && ASM.pass == 2 && ((delta & 3) || delta < -0x8000 || delta > 0x7FFC)) {
+                    asm_error("branch target 0x%08x out of range", value);
+                    ok = FALSE;
+                }
+                word |= (uint32_t)(delta >> 2) & 0xFFFF;
+                break;
+            case 'j':
+                ok = asm_value(operands[i++], &value);
+                if (ok && ASM.pass == 2 && ((value & 3) || ((value ^ pc) & 0xF0000000))) {
+                    asm_error("jump target 0x%08x out of range", value);
+                    ok = FALSE;
+                }
+                word |= (value >> 2) & 0x03FFFFFF;
+                break;
+        }
+    }
+    /* the simulator's andi/ori/xori take rt as their source, so only rt == rs means the same thing */
+    if (ok && (op == OP_ANDI || op == OP_ORI || op == OP_XORI) && FIELD_RS(word) != FIELD_RT(word)) {
+        asm_error("%s needs the same source and destination register (it reads $%u, not $%u)",
+            OPCODE_NAMES[op], FIELD_RT(word), FIELD_RS(word));
+    }
+    asm_emit(word, 4);
+}
+
+/**************************************************************/
+/* Assemble an instruction or pseudo-instruction                           */
+/**************************************************************/
+void asm_instruction(const char *name, char **operands, int count) {
+    char line[ASM_MAX_LINE], mnemonic[16], upper[16], hi[16], lo[16], *args[3];
+    const asm_pseudo_t *pseudo;
+    const char *p;
+    uint32_t value, i;
+    opcode_t op;
+    
+    for (i = 0; name[i] != '\0' && i < sizeof(mnemonic) - 1; i++) {
+        mnemonic[i] = tolower((unsigned char)name[i]);
+        upper[i] = toupper((unsigned char)name[i]);
+    }
+    mnemonic[i] = upper[i] = '\0';
+    if (ASM.in_data) {
+        asm_error("instruction '%s' outside .text", name);
+        return;
+    }
+    asm_align(4);
+    if (strcmp(mnemonic, "li") == 0 || strcmp(mnemonic, "la") == 0) {
+        /* li: the shortest sequence for the constant, la: always lui and ori, as the label may move */
+        if (count != 2) {
+            asm_error("%s takes 2 operands", mnemonic);
+            return;
+        }
+        if (mnemonic[1] == 'i' && !isdigit((unsigned char)operands[1][0]) && operands[1][0] != '-' && operands[1][0] != '\'') {
+            asm_error("li takes a number (la loads an address)");
+            return;
+        }
+        if (!asm_value(operands[1], &value)) {
+            return;
+        }
+        snprintf(hi, sizeof(hi), "0x%x", value >> 16);
+        snprintf(lo, sizeof(lo), "0x%x", value & 0xFFFF);
+        args[0] = operands[0];
+        if (mnemonic[1] == 'i' && (value < 0x8000 || value >= 0xFFFF8000)) {
+            snprintf(lo, sizeof(lo), "%d", (int32_t)value);
+            args[1] = "$0";
+            args[2] = lo;
+            asm_instruction("addiu", args, 3);
+            return;
+        }
+        args[1] = hi;
+        asm_instruction("lui", args, 2);
+        if (mnemonic[1] == 'a' || (value & 0xFFFF) != 0) {
+            args[1] = operands[0];
+            args[2] = lo;
+            asm_instruction("ori", args, 3);
+        }
+        return;
+    }
+    for (pseudo = ASM_PSEUDOS; pseudo->name != NULL; pseudo++) {
+        if (strcmp(mnemonic, pseudo->name) == 0 && count == pseudo->operands) {
+            line[0] = '\0';
+            for (p = pseudo->expansion; *p != '\0'; p++) {
+                if (p[0] == '%' && p[1] >= '0' && p[1] < '0' + count) {
+                    strncat(line, operands[*++p - '0'], sizeof(line) - strlen(line) - 1);
+                }
+                else {
+                    strncat(line, p, 1);
+                }
+            }
+            asm_line(line);
+            return;
+        }
+    }
+    for (op = 0; op < OP_UNKNOWN; op++) {
+        if (strcmp(upper, OPCODE_NAMES[op]) == 0) {
+            asm_encode(op, operands, count);
+            return;
+        }
+    }
+    asm_error("unknown instruction '%s'", name);
+}
+
+/**************************************************************/
+/* Emit a quoted string for .ascii / .asciiz                                 */
+/**************************************************************/
+void asm_string(char *text, int terminate) {
+    char *p = text + strspn(text, " \t");
+    
+    if (*p++ != '"') {
+        asm_error("expected a string");
+        return;
+    }
+    for (; *p != '"'; p++) {
+        if (*p == '\0') {
+            asm_error("unterminated string");
+            return;
+        }
+        if (*p == '\\') {
+            switch (*++p) {
+                case 'n': asm_emit('\n', 1); break;
+                case 't': asm_emit('\t', 1); break;
+                case 'r': asm_emit('\r', 1); break;
+                case '0': asm_emit('\0', 1); break;
+                case '\\': case '"': case '\'': asm_emit(*p, 1); break;
+                default:
+                    asm_error("unknown escape '\\%c'", *p);
+                    return;
+            }
+        }
+        else {
+            asm_emit((uint8_t)*p, 1);
+        }
+    }
+    if (p[1 + strspn(p + 1, " \t")] != '\0') {
+        asm_error("junk after the string");
+    }
+    if (terminate) {
+        asm_emit(0, 1);
+    }
+}
+
+/**************************************************************/
+/* Assemble a directive                                                                  */
+/**************************************************************/
+void asm_directive(const char *name, char *args) {
+    char *operands[ASM_MAX_OPERANDS];
+    uint32_t value, size, i;
+    int count;
+    
+    if (strcmp(name, ".text") == 0 || strcmp(name, ".data") == 0) {
+        asm_align(1);
+        ASM.in_data = (name[1] == 'd');
+    }
+    else if (strcmp(name, ".globl") == 0 || strcmp(name, ".global") == 0) {
+        /* everything is global in a single file */
+    }
+    else if (strcmp(name, ".ascii") == 0 || strcmp(name, ".asciiz") == 0) {
+        asm_align(1);
+        asm_string(args, name[6] == 'z');
+    }
+    else if (strcmp(name, ".word") == 0 || strcmp(name, ".half") == 0 || strcmp(name, ".byte") == 0) {
+        size = (name[1] == 'w') ? 4 : (name[1] == 'h') ? 2 : 1;
+        asm_align(size);
+        count = asm_split(args, operands);
+        if (count == 0) {
+            asm_error("%s needs a value", name);
+        }
+        for (i = 0; i < (uint32_t)count; i++) {
+            value = 0;
+            if (asm_value(operands[i], &value) && size < 4 && value >> (8 * size) != 0 && value < (0xFFFFFFFF << (8 * size - 1))) {
+                asm_error("%s out of range: %d", name, (int32_t)value);
+            }
+            asm_emit(value, size);
+        }
+    }
+    else if (strcmp(name, ".space") == 0 || strcmp(name, ".align") == 0) {
+        if (asm_split(args, operands) != 1 || !asm_value(operands[0], &value)) {
+            asm_error("%s takes one number", name);
+            return;
+        }
+        if (name[1] == 'a' && value > 12) {
+            asm_error(".align %u is too large", value);
+            return;
+        }
+        asm_align(name[1] == 'a' ? 1 << value : 1);
+        for (i = 0; i < value && name[1] == 's'; i++) {
+            asm_emit(0, 1);
+        }
+    }
+    else {
+        asm_error("unknown directive '%s'", name);
+    }
+}
+
+/**************************************************************/
+/* Assemble one line: labels, then an instruction or a directive    */
+/**************************************************************/
+void asm_line(char *line) {
+    char *p, *mnemonic, *operands[ASM_MAX_OPERANDS];
+    size_t len;
+    int quoted = FALSE;
+    
+    /* strip the comment, but not a # inside a string */
+    for (p = line; *p != '\0'; p++) {
+        if (quoted && *p == '\\' && p[1] != '\0') {
+            p++;
+        }
+        else if (*p == '"') {
+            quoted = !quoted;
+        }
+        else if (*p == '#' && !quoted) {
+            break;
+        }
+    }
+    *p = '\0';
+    while (p > line && isspace((unsigned char)p[-1])) {
+        *--p = '\0';
+    }
+    p = line + strspn(line, " \t");
+    
+    /* labels wait for the next statement to know their (aligned) address */
+    while ((len = strspn(p, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_.")) > 0 && p[len] == ':') {
+        p[len] = '\0';
+        if (isdigit((unsigned char)p[0]) || len >= ASM_MAX_LABEL) {
+            asm_error("bad label '%s'", p);
+        }
+        else if (ASM.num_pending == ASM_MAX_PENDING) {
+            asm_error("too many labels in a row");
+        }
+        else {
+            strcpy(ASM.pending[ASM.num_pending++], p);
+        }
+        p += len + 1;
+        p += strspn(p, " \t");
+    }
+    if (*p == '\0') {
+        return;
+    }
+    
+    mnemonic = p;
+    p += strcspn(p, " \t");
+    if (*p != '\0') {
+        *p++ = '\0';
+    }
+    if (mnemonic[0] == '.') {
+        asm_directive(mnemonic, p);
+    }
+    else {
+        asm_instruction(mnemonic, operands, asm_split(p, operands));
+    }
+}
+
+/**************************************************************/
+/* Assemble a file into memory, text at text_begin and data at     */
+/* data_begin; returns 0, or -1 after printing the errors. ASM.text */
+/* and ASM.data are left at the end of each section.                   */
+/**************************************************************/
+int assemble(const char *file, uint32_t text_begin, uint32_t data_begin) {
+    char line[ASM_MAX_LINE];
+    FILE *fp;
+    
+    fp = fopen(file, "r");
+    if (fp == NULL) {
+        printf("Error: Can't open program file %s\n", file);
+        return -1;
+    }
+    memset(&ASM, 0, sizeof(ASM));
+    ASM.file = file;
+    for (ASM.pass = 1; ASM.pass <= 2 && ASM.errors == 0; ASM.pass++) {
+        rewind(fp);
+        ASM.line = 0;
+        ASM.text = text_begin;
+        ASM.data = data_begin;
+        ASM.in_data = FALSE;
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            ASM.line++;
+            if (strchr(line, '\n') == NULL && !feof(fp)) {
+                asm_error("line too long");
+                break;
+            }
+            asm_line(line);
+        }
+        asm_align(1);
+    }
+    fclose(fp);
+    asm_free_symbols();
+    if (ASM.errors > 0) {
+        printf("%d error%s in %s\n", ASM.errors, ASM.errors == 1 ? "" : "s", file);
+        return -1;
+    }
+    return 0;
+}
+
+/**************************************************************/
+/* -A: assemble a program and write its text in the .in hex format  */
+/**************************************************************/
+int assemble_hex(const char *file, const char *out_file) {
+    uint32_t address;
+    FILE *out;
+    
+    if (assemble(file, MEM_TEXT_BEGIN, MEM_DATA_BEGIN) != 0) {
+        return -1;
+    }
+    if (ASM.data != MEM_DATA_BEGIN) {
+        printf("Error: %s has a .data section, which the .in format cannot hold; run the .s file instead\n", file);
+        return -1;
+    }
+    out = fopen(out_file, "w");
+    if (out == NULL) {
+        printf("Error: Can't write %s\n", out_file);
+        return -1;
+    }
+    for (address = MEM_TEXT_BEGIN; address < ASM.text; address += 4) {
+        fprintf(out, "%08X\n", mem_read_32(address));
+    }
+    fclose(out);
+    printf("%u words written to %s\n", (ASM.text - MEM_TEXT_BEGIN + 3) / 4, out_file);
+    return 0;
+}
+
+/**************************************************************/
+/* Read a CP0 register; Count and the performance counters are    */
+/* materialized from the simulator's counts                                */
+/**************************************************************/
+uint32_t cp0_read(uint32_t reg, uint32_t sel) {
+    if (reg == CP0_COUNT) {
+        return COUNT_BASE + (uint32_t)(CYCLE_COUNT >> COUNT_RATE_SHIFT);
+    }
+    if (reg == CP0_PERF) {
+        return pmc_read(sel);
+    }
+    return CURRENT_STATE.CP0[reg];
+}
+
+/**************************************************************/
+/* Write a CP0 register (MTC0)                                                       */
+/**************************************************************/
+void cp0_write(uint32_t reg, uint32_t sel, uint32_t value) {
+    switch (reg) {
+        case CP0_PERF:
+            pmc_write(sel, value);
+            break;
+        case CP0_COUNT:
+            COUNT_BASE = value - (uint32_t)(CYCLE_COUNT >> COUNT_RATE_SHIFT);
+            schedule_timer();
+            break;
+        case CP0_COMPARE:
+            /* writing Compare acknowledges the timer interrupt */
+            NEXT_STATE.CP0[CP0_COMPARE] = value;
+            NEXT_STATE.CP0[CP0_CAUSE] &= ~CAUSE_IP7;
+            CURRENT_STATE.CP0[CP0_COMPARE] = value;
+            schedule_timer();
+            break;
+        case CP0_CAUSE:
+            /* only the software interrupt bits IP0/IP1 are writable */
+            NEXT_STATE.CP0[CP0_CAUSE] = (NEXT_STATE.CP0[CP0_CAUSE] & ~0x00000300) | (value & 0x00000300);
+            NEXT_EVENT_CYCLE = CYCLE_COUNT;
+            break;
+        case CP0_STATUS:
+            NEXT_STATE.CP0[CP0_STATUS] = value;
+            /* newly unmasked interrupts must be seen at the end of this block */
+            NEXT_EVENT_CYCLE = CYCLE_COUNT;
+            break;
+        default:
+            NEXT_STATE.CP0[reg] = value;
+            break;
+    }
+}
+
+/**************************************************************/
+/* Running total of a performance counter event                          */
+/**************************************************************/
+uint64_t pmc_total(uint32_t event) {
+    timing_model_t *m = &TIMING_MODELS[0];
+    
+    if (event == PMC_CYCLES) {
+        return CYCLE_COUNT;
+    }
+    if (event == PMC_INSTRUCTIONS) {
+        return INSTRUCTION_COUNT;
+    }
+    if (NUM_TIMING_MODELS == 0) {
+        return 0;
+    }
+    /* the model must have seen every instruction retired so far */
+    ring_sync();
+    switch (event) {
+        case PMC_BRANCHES: return m->branches;
+        case PMC_MISPREDICTS: return m->mispredicts;
+        case PMC_ICACHE_MISSES: return m->icache.misses;
+        case PMC_DCACHE_MISSES: return m->dcache.misses;
+        case PMC_MODEL_CYCLES: return m->cycles;
+    }
+    return 0;
+}
+
+/**************************************************************/
+/* MFC0 from register 25: PerfCtl (even sel) or PerfCnt (odd sel)    */
+/**************************************************************/
+uint32_t pmc_read(uint32_t sel) {
+    pmc_t *p = &PMC[sel >> 1];
+    
+    if (sel >= 2 * PMC_COUNTERS) {
+        return 0;
+    }
+    if (!(sel & 1)) {
+        return p->control | ((sel >> 1) < PMC_COUNTERS - 1 ? PMC_CTL_M : 0);
+    }
+    if (!(p->control & PMC_CTL_ENABLE)) {
+        return p->offset;
+    }
+    return p->offset + (uint32_t)pmc_total((p->control & PMC_CTL_EVENT) >> PMC_EVENT_SHIFT);
+}
+
+/**************************************************************/
+/* MTC0 to register 25: a new event or count takes effect from the  */
+/* current totals                                                                    */
+/**************************************************************/
+void pmc_write(uint32_t sel, uint32_t value) {
+    pmc_t *p = &PMC[sel >> 1];
+    uint32_t count;
+    
+    if (sel >= 2 * PMC_COUNTERS) {
+        return;
+    }
+    count = pmc_read(sel | 1);
+    if (sel & 1) {
+        count = value;
+    }
+    else {
+        p->control = value & (PMC_CTL_EVENT | PMC_CTL_IE | PMC_CTL_ENABLE);
+    }
+    p->offset = count;
+    if (p->control & PMC_CTL_ENABLE) {
+        p->offset -= (uint32_t)pmc_total((p->control & PMC_CTL_EVENT) >> PMC_EVENT_SHIFT);
+    }
+}
+
+/**************************************************************/
+/* Compute the cycle at which Count next equals Compare              */
+/**************************************************************/
+void schedule_timer() {
+    uint64_t ticks_now = CYCLE_COUNT >> COUNT_RATE_SHIFT;
+    uint32_t count = COUNT_BASE + (uint32_t)ticks_now;
+    uint64_t ticks = (uint32_t)(CURRENT_STATE.CP0[CP0_COMPARE] - count);
+    
+    if (ticks == 0) {
+        ticks = 0x100000000ULL;
+    }
+    TIMER_EVENT_CYCLE = (ticks_now + ticks) << COUNT_RATE_SHIFT;
+    /* re-evaluate the event horizon at the end of the current block */
+    NEXT_EVENT_CYCLE = CYCLE_COUNT;
+}
+
+/**************************************************************/
+/* Raise due interrupt sources and take a pending, enabled interrupt  */
+/* (called at basic-block boundaries only)                                         */
+/**************************************************************/
+void check_interrupts() {
+    uint32_t status, pending;
+    
+    if (CYCLE_COUNT >= TIMER_EVENT_CYCLE) {
+        /* Count == Compare drives hardware interrupt 5, i.e. IP7 */
+        CURRENT_STATE.CP0[CP0_CAUSE] |= CAUSE_IP7;
+        TIMER_EVENT_CYCLE += 0x100000000ULL << COUNT_RATE_SHIFT;
+    }
+    NEXT_EVENT_CYCLE = TIMER_EVENT_CYCLE;
+    
+    status = CURRENT_STATE.CP0[CP0_STATUS];
+    pending = CURRENT_STATE.CP0[CP0_CAUSE] & status & CAUSE_IP_MASK;
+    /* masked interrupts stay pending; MTC0 Status and ERET force another look */
+    if (pending != 0 && RUN_FLAG && (status & STATUS_IE) && !(status & (STATUS_EXL | STATUS_ERL))) {
+        /* take the interrupt: ExcCode = Int (0) */
+        CURRENT_STATE.CP0[CP0_EPC] = CURRENT_STATE.PC;
+        CURRENT_STATE.CP0[CP0_CAUSE] &= ~CAUSE_EXCCODE_MASK;
+        CURRENT_STATE.CP0[CP0_STATUS] |= STATUS_EXL;
+        CURRENT_STATE.PC = EXCEPTION_VECTOR;
+    }
+    NEXT_STATE = CURRENT_STATE;
+}
+
+/**************************************************************/
+/* Host pointer for a guest address. *avail receives the number of   */
+/* bytes that are contiguous in host memory from that address.       */
+/**************************************************************/
+uint8_t *mem_host_ptr(uint32_t address, uint32_t *avail)
+{
+    int i;
+    for (i = 0; i < NUM_MEM_REGION; i++) {
+        if ( (address >= MEM_REGIONS[i].begin) && (address <= MEM_REGIONS[i].end) ) {
+            if (avail != NULL) {
+                *avail = MEM_REGIONS[i].end - address + 1;
+            }
+            return MEM_REGIONS[i].mem + (address - MEM_REGIONS[i].begin);
+        }
+    }
+    if (avail != NULL) {
+        *avail = 0;
+    }
+    return NULL;
+}
+
+/**************************************************************/
+/* Find (or add) the block cache entry for a block starting at pc    */
+/**************************************************************/
+block_t *block_lookup(uint32_t pc) {
+    uint32_t i, mask;
+    block_t *old;
+    uint32_t old_capacity;
+    
+    if (2 * (NUM_BLOCKS + 1) > BLOCK_TABLE_SIZE) {
+        /* grow and rehash at 50% load */
+        old = BLOCKS;
+        old_capacity = BLOCK_TABLE_SIZE;
+        BLOCK_TABLE_SIZE = (BLOCK_TABLE_SIZE == 0) ? 1024 : 2 * BLOCK_TABLE_SIZE;
+        BLOCKS = calloc(BLOCK_TABLE_SIZE, sizeof(block_t));
+        NUM_BLOCKS = 0;
+        for (i = 0; i < old_capacity; i++) {
+            if (old[i].length != 0) {
+                *block_lookup(old[i].start) = old[i];
+            }
+        }
+        free(old);
+    }
+    
+    mask = BLOCK_TABLE_SIZE - 1;
+    i = ((pc >> 2) * 2654435761u) & mask;
+    while (BLOCKS[i].length != 0 && BLOCKS[i].start != pc) {
+        i = (i + 1) & mask;
+    }
+    if (BLOCKS[i].length == 0) {
+        BLOCKS[i].start = pc;
+        BLOCKS[i].length = 1;
+        NUM_BLOCKS++;
+    }
+    return &BLOCKS[i];
+}
+
+/**************************************************************/
+/* Forget all blocks (reset)                                                         */
+/**************************************************************/
+void clear_blocks() {
+    uint32_t i;
+    for (i = 0; i < BLOCK_TABLE_SIZE; i++) {
+        free(BLOCKS[i].ops);
+    }
+    if (BLOCKS != NULL) {
+        memset(BLOCKS, 0, BLOCK_TABLE_SIZE * sizeof(block_t));
+    }
+    NUM_BLOCKS = 0;
+}
+
+/**************************************************************/
+/* Basic-block boundary: poll interrupts, account the finished block */
+/* and start the next one                                                          */
+/**************************************************************/
+void end_block() {
+    block_t *block;
+    uint32_t length = INSTRUCTION_COUNT - BLOCK_START_COUNT;
+    
+    if (length > 0) {
+        block = block_lookup(BLOCK_START_PC);
+        block->count++;
+        if (length > block->length || block->ops == NULL) {
+            block->length = (length > block->length) ? length : block->length;
+            decode_block(block);
+        }
+        if (CURRENT_STATE.PC != block->start + 4 * length) {
+            block->taken++;
+        }
+        if (FUZZ_TRACE != NULL) {
+            /* edge = (this block, where its branch/jump went) */
+            FUZZ_TRACE[(FUZZ_HASH(BLOCK_START_PC) ^ (FUZZ_HASH(CURRENT_STATE.PC) >> 1)) & (FUZZ_MAP_SIZE - 1)]++;
+        }
+        if (BBV_FILE != NULL) {
+            bbv_count(block, length);
+        }
+        if (SPIN_FF && CURRENT_STATE.PC == block->start && CYCLE_COUNT < NEXT_EVENT_CYCLE
+            && !RETIRE_HOOKS && !REUSE_PROFILE) {
+            spin_check(block, length);
+        }
+    }
+    if (INSTRUCTION_COUNT >= INTERVAL_END) {
+        interval_end();
+    }
+    if (CYCLE_COUNT >= NEXT_EVENT_CYCLE) {
+        check_interrupts();
+    }
+    if (DIFF_OUT != NULL) {
+        diff_emit(FALSE);
+    }
+    BLOCK_START_PC = CURRENT_STATE.PC;
+    BLOCK_START_COUNT = INSTRUCTION_COUNT;
+    if (INSTRUCTION_COUNT >= TT_NEXT_SNAPSHOT) {
+        tt_snapshot();
+    }
+}
+
+/**************************************************************/
+/* Build DECODE_TABLE from INSTRUCTION_SET: a cell is decided by the */
+/* first line that can match it if that line looks at no bits beyond */
+/* the primary opcode and funct, otherwise it is scanned at decode   */
+/* time. Also rejects lines that could never be decoded.             */
+/**************************************************************/
+void decode_init() {
+    uint32_t cell, word, op;
+    
+    for (cell = 0; cell < 64 * 64; cell++) {
+        word = ((cell >> 6) << 26) | (cell & 0x3F);
+        for (op = 0; ((word ^ OPCODE_MATCHES[op]) & OPCODE_MASKS[op] & MASK_FUNCT) != 0; op++);
+        DECODE_TABLE[cell] = (OPCODE_MASKS[op] & ~MASK_FUNCT) ? DECODE_SCAN : op;
+    }
+    for (op = 0; op < OP_UNKNOWN; op++) {
+        if ((OPCODE_MATCHES[op] & ~OPCODE_MASKS[op]) != 0 || decode_opcode(OPCODE_MATCHES[op]) != op) {
+            printf("Error: %s in INSTRUCTION_SET can never be decoded\n", OPCODE_NAMES[op]);
+            exit(-1);
+        }
+    }
+}
+
+/**************************************************************/
+/* Classify an instruction word                                                     */
+/**************************************************************/
+opcode_t decode_opcode(uint32_t instruction) {
+    uint32_t op = DECODE_TABLE[((instruction >> 20) & 0xFC0) | (instruction & 0x3F)];
+    
+    if (op == DECODE_SCAN) {
+        for (op = 0; (instruction & OPCODE_MASKS[op]) != OPCODE_MATCHES[op]; op++);
+    }
+    return op;
+}
+
+/**************************************************************/
+/* Is this a valid encoding: a known instruction whose unused fields  */
+/* are zero?                                                                             */
+/**************************************************************/
+int instruction_valid(uint32_t instruction) {
+    opcode_t op = decode_opcode(instruction);
+    
+    return op != OP_UNKNOWN && (instruction & OPCODE_ZEROS[op]) == 0;
+}
+
+/**************************************************************/
+/* Decode a block's opcodes once, when its length is first known     */
+/**************************************************************/
+void decode_block(block_t *block) {
+    uint32_t i;
+    
+    free(block->ops);
+    block->ops = malloc(block->length);
+    for (i = 0; i < block->length; i++) {
+        block->ops[i] = decode_opcode(mem_read_32(block->start + 4 * i));
+    }
+}
+
+/**************************************************************/
+/* Dynamic instruction mix: block counts times decoded opcodes        */
+/**************************************************************/
+void print_mix() {
+    uint64_t op_counts[NUM_OPCODES] = {0};
+    uint64_t class_counts[NUM_CLASSES] = {0};
+    uint64_t total = 0, taken = 0;
+    uint32_t i, k;
+    
+    for (i = 0; i < BLOCK_TABLE_SIZE; i++) {
+        if (BLOCKS[i].count == 0 || BLOCKS[i].ops == NULL) {
+            continue;
+        }
+        for (k = 0; k < BLOCKS[i].length; k++) {
+            op_counts[BLOCKS[i].ops[k]] += BLOCKS[i].count;
+        }
+        total += BLOCKS[i].count * BLOCKS[i].length;
+        if (OPCODE_CLASS[BLOCKS[i].ops[BLOCKS[i].length - 1]] == CLASS_BRANCH) {
+            taken += BLOCKS[i].taken;
+        }
+    }
+    for (i = 0; i < NUM_OPCODES; i++) {
+        class_counts[OPCODE_CLASS[i]] += op_counts[i];
+    }
+    if (total == 0) {
+        printf("No instructions executed.\n\n");
+        return;
+    }
+    
+    printf("-------------------------------------\n");
+    printf("Instruction Mix (%llu instructions)\n", (unsigned long long)total);
+    printf("-------------------------------------\n");
+    printf("[Class]\t\t[Count]\t\t[%%]\n");
+    for (i = 0; i < NUM_CLASSES; i++) {
+        if (class_counts[i] == 0) {
+            continue;
+        }
+        printf("%-10s\t%-12llu\t%6.2f\n", CLASS_NAMES[i], (unsigned long long)class_counts[i], 100.0 * class_counts[i] / total);
+        if (i == CLASS_BRANCH) {
+            printf("  taken\t\t%-12llu\t%6.2f\n", (unsigned long long)taken, 100.0 * taken / total);
+            printf("  not taken\t%-12llu\t%6.2f\n", (unsigned long long)(class_counts[i] - taken),
+                   100.0 * (class_counts[i] - taken) / total);
+        }
+    }
+    printf("-------------------------------------\n");
+    printf("[Opcode]\t[Count]\t\t[%%]\n");
+    for (i = 0; i < NUM_OPCODES; i++) {
+        if (op_counts[i] != 0) {
+            printf("%-10s\t%-12llu\t%6.2f\n", OPCODE_NAMES[i], (unsigned long long)op_counts[i], 100.0 * op_counts[i] / total);
+        }
+    }
+    if (SPIN_SKIPPED != 0) {
+        printf("-------------------------------------\n");
+        printf("%llu instructions fast-forwarded in idle loops\n", (unsigned long long)SPIN_SKIPPED);
+    }
+    if (HLE_INSTRUCTIONS != 0) {
+        printf("-------------------------------------\n");
+        printf("[Native]\t[Calls]\n");
+        for (i = HLE_NONE + 1; i < NUM_HLE_ROUTINES; i++) {
+            if (HLE_CALLS[i] != 0) {
+                printf("%-10s\t%-12llu\n", HLE_NAMES[i], (unsigned long long)HLE_CALLS[i]);
+            }
+        }
+        printf("%llu instructions run natively, not in the mix above\n", (unsigned long long)HLE_INSTRUCTIONS);
+    }
+    printf("-------------------------------------\n\n");
+}
+
+/**************************************************************/
+/* Exit hook for -s                                                                     */
+/**************************************************************/
+void mix_report() {
+    if (MIX_REPORT) {
+        print_mix();
+    }
+}
+
+int compare_pc_counts(const void *a, const void *b) {
+    const pc_count_t *x = a, *y = b;
+    if (x->count != y->count) {
+        return (x->count < y->count) ? 1 : -1;
+    }
+    return (x->pc > y->pc) - (x->pc < y->pc);
+}
+
+int compare_pcs(const void *a, const void *b) {
+    const pc_count_t *x = a, *y = b;
+    return (x->pc > y->pc) - (x->pc < y->pc);
+}
+
+/**************************************************************/
+/* Expand block counts to per-PC counts, ranked hottest first.        */
+/* Returns the number of distinct PCs in *out (caller frees).         */
+/**************************************************************/
+uint32_t profile_pc_counts(pc_count_t **out) {
+    pc_count_t *pcs;
+    uint32_t i, k, n = 0, merged = 0;
+    uint64_t total = 0;
+    
+    for (i = 0; i < BLOCK_TABLE_SIZE; i++) {
+        if (BLOCKS[i].count != 0) {
+            total += BLOCKS[i].length;
+        }
+    }
+    pcs = malloc((total + 1) * sizeof(pc_count_t));
+    for (i = 0; i < BLOCK_TABLE_SIZE; i++) {
+        if (BLOCKS[i].count == 0) {
+            continue;
+        }
+        for (k = 0; k < BLOCKS[i].length; k++) {
+            pcs[n].pc = BLOCKS[i].start + 4 * k;
+            pcs[n].count = BLOCKS[i].count;
+            n++;
+        }
+    }
+    
+    /* a PC can belong to several blocks when control enters mid-block */
+    qsort(pcs, n, sizeof(pc_count_t), compare_pcs);
+    for (i = 0; i < n; i++) {
+        if (merged > 0 && pcs[merged - 1].pc == pcs[i].pc) {
+            pcs[merged - 1].count += pcs[i].count;
+        }
+        else {
+            pcs[merged++] = pcs[i];
+        }
+    }
+    qsort(pcs, merged, sizeof(pc_count_t), compare_pc_counts);
+    *out = pcs;
+    return merged;
+}
+
+/**************************************************************/
+/* Disassembly of addr as a single line without the newline          */
+/**************************************************************/
+void disassemble(uint32_t addr, char *text, size_t size) {
+    FILE *out = fmemopen(text, size, "w");
+    size_t len;
+    
+    text[0] = '\0';
+    if (out == NULL) {
+        return;
+    }
+    fprint_instruction(out, addr);
+    fclose(out);
+    len = strlen(text);
+    if (len > 0 && text[len - 1] == '\n') {
+        text[len - 1] = '\0';
+    }
+}
+
+/**************************************************************/
+/* Print the ranked hotspot report and write the -p file                */
+/**************************************************************/
+void profile_report() {
+    pc_count_t *pcs;
+    uint32_t i, n;
+    int first;
+    uint64_t executed = 0;
+    char text[128];
+    const char *ext;
+    FILE *fp;
+    
+    if (!PROFILE) {
+        return;
+    }
+    n = profile_pc_counts(&pcs);
+    for (i = 0; i < n; i++) {
+        executed += pcs[i].count;
+    }
+    
+    printf("-------------------------------------------------------------\n");
+    printf("Hotspots (%llu instructions in %u blocks)\n", (unsigned long long)executed, NUM_BLOCKS);
+    printf("-------------------------------------------------------------\n");
+    printf("[Rank]\t[PC]\t\t[Count]\t\t[%%]\t[Instruction]\n");
+    for (i = 0; i < n && i < PROFILE_TOP; i++) {
+        disassemble(pcs[i].pc, text, sizeof(text));
+        printf("%u\t0x%08x\t%-12llu\t%5.2f\t%s\n", i + 1, pcs[i].pc, (unsigned long long)pcs[i].count,
+               100.0 * pcs[i].count / executed, text);
+    }
+    printf("\n");
+    
+    if (profile_file[0] != '\0') {
+        fp = fopen(profile_file, "w");
+        if (fp == NULL) {
+            printf("Error: Can't open profile file %s\n", profile_file);
+            free(pcs);
+            return;
+        }
+        ext = strrchr(profile_file, '.');
+        if (ext != NULL && strcmp(ext, ".csv") == 0) {
+            fprintf(fp, "pc,count,percent,instruction\n");
+            for (i = 0; i < n; i++) {
+                disassemble(pcs[i].pc, text, sizeof(text));
+                fprintf(fp, "0x%08x,%llu,%.4f,\"%s\"\n", pcs[i].pc, (unsigned long long)pcs[i].count,
+                        100.0 * pcs[i].count / executed, text);
+            }
+        }
+        else {
+            fprintf(fp, "{\n  \"instructions\": %llu,\n  \"blocks\": [", (unsigned long long)executed);
+            for (i = 0, first = TRUE; i < BLOCK_TABLE_SIZE; i++) {
+                if (BLOCKS[i].count != 0) {
+                    fprintf(fp, "%s\n    {\"start\": \"0x%08x\", \"length\": %u, \"count\": %llu}",
+                            first ? "" : ",", BLOCKS[i].start, BLOCKS[i].length,
+                            (unsigned long long)BLOCKS[i].count);
+                    first = FALSE;
+                }
+            }
+            fprintf(fp, "\n  ],\n  \"hotspots\": [");
+            for (i = 0; i < n; i++) {
+                disassemble(pcs[i].pc, text, sizeof(text));
+                fprintf(fp, "%s\n    {\"pc\": \"0x%08x\", \"count\": %llu, \"instruction\": \"%s\"}",
+                        (i == 0) ? "" : ",", pcs[i].pc, (unsigned long long)pcs[i].count, text);
+            }
+            fprintf(fp, "\n  ]\n}\n");
+        }
+        fclose(fp);
+        printf("Profile written to %s\n", profile_file);
+    }
+    free(pcs);
+}
+
+/**************************************************************/
+/* Start the trace writer thread and write the file header             */
+/**************************************************************/
+void trace_open() {
+    uint32_t header[2] = { TRACE_RECORD_BYTES, TRACE_BLOCK_RECORDS };
+    
+    TRACE.fp = fopen(trace_file, "wb");
+    if (TRACE.fp == NULL) {
+        printf("Error: Can't open trace file %s\n", trace_file);
+        exit(-1);
+    }
+    fwrite(TRACE_MAGIC, 1, 8, TRACE.fp);
+    fwrite(header, sizeof(header), 1, TRACE.fp);
+    
+    TRACE.buf[0] = malloc(TRACE_BLOCK_RECORDS * sizeof(retire_t));
+    TRACE.buf[1] = malloc(TRACE_BLOCK_RECORDS * sizeof(retire_t));
+    pthread_mutex_init(&TRACE.lock, NULL);
+    pthread_cond_init(&TRACE.cond, NULL);
+    pthread_create(&TRACE.writer, NULL, trace_writer, NULL);
+    TRACING = TRUE;
+    RETIRE_HOOKS = TRUE;
+}
+
+/**************************************************************/
+/* Append the instruction that just retired (simulation thread)       */
+/**************************************************************/
+void trace_retire() {
+    TRACE.buf[TRACE.fill][TRACE.count] = RETIRED;
+    if (++TRACE.count == TRACE_BLOCK_RECORDS) {
+        trace_handoff();
+    }
+}
+
+/**************************************************************/
+/* Give the full buffer to the writer and switch to the other one.    */
+/* Blocks only if the writer is still busy with the previous block.   */
+/**************************************************************/
+void trace_handoff() {
+    pthread_mutex_lock(&TRACE.lock);
+    while (TRACE.pending) {
+        pthread_cond_wait(&TRACE.cond, &TRACE.lock);
+    }
+    TRACE.pending = TRUE;
+    TRACE.pending_count = TRACE.count;
+    TRACE.fill ^= 1;
+    TRACE.count = 0;
+    pthread_cond_broadcast(&TRACE.cond);
+    pthread_mutex_unlock(&TRACE.lock);
+}
+
+/**************************************************************/
+/* Delta-encode a block into field planes (all PC deltas, then all     */
+/* instruction words, address deltas, sizes and flags), so that the  */
+/* mostly-zero deltas and repeated fields compress well. Returns the  */
+/* encoded size.                                                                       */
+/**************************************************************/
+uint32_t trace_encode_block(retire_t *records, uint32_t n, uint8_t *out, uint32_t *last_pc, uint32_t *last_addr) {
+    uint32_t *pcs = (uint32_t *)out;
+    uint32_t *instructions = pcs + n;
+    uint32_t *addrs = instructions + n;
+    uint8_t *sizes = (uint8_t *)(addrs + n);
+    uint8_t *flags = sizes + n;
+    uint32_t i;
+    
+    for (i = 0; i < n; i++) {
+        pcs[i] = records[i].pc - (*last_pc + 4);
+        *last_pc = records[i].pc;
+        instructions[i] = records[i].instruction;
+        addrs[i] = 0;
+        if (records[i].size != 0) {
+            addrs[i] = records[i].addr - *last_addr;
+            *last_addr = records[i].addr;
+        }
+        sizes[i] = records[i].size;
+        flags[i] = records[i].flags;
+    }
+    return n * TRACE_RECORD_BYTES;
+}
+
+/**************************************************************/
+/* Writer thread: encode, compress and write each handed-off block */
+/**************************************************************/
+void *trace_writer(void *arg) {
+    uLong bound = compressBound(TRACE_BLOCK_RECORDS * TRACE_RECORD_BYTES);
+    uint8_t *planes = malloc(TRACE_BLOCK_RECORDS * TRACE_RECORD_BYTES);
+    uint8_t *compressed = malloc(bound);
+    uint32_t n, compressed_len, header[2];
+    retire_t *records;
+    z_stream zs;
+    
+    memset(&zs, 0, sizeof(zs));
+    deflateInit(&zs, Z_BEST_SPEED);
+    
+    pthread_mutex_lock(&TRACE.lock);
+    while (TRUE) {
+        while (!TRACE.pending && !TRACE.done) {
+            pthread_cond_wait(&TRACE.cond, &TRACE.lock);
+        }
+        if (!TRACE.pending) {
+            break;
+        }
+        records = TRACE.buf[TRACE.fill ^ 1];
+        n = TRACE.pending_count;
+        pthread_mutex_unlock(&TRACE.lock);
+        
+        header[0] = trace_encode_block(records, n, planes, &TRACE.last_pc, &TRACE.last_addr);
+        deflateReset(&zs);
+        zs.next_in = planes;
+        zs.avail_in = header[0];
+        zs.next_out = compressed;
+        zs.avail_out = bound;
+        deflate(&zs, Z_FINISH);
+        compressed_len = bound - zs.avail_out;
+        header[1] = compressed_len;
+        fwrite(header, sizeof(header), 1, TRACE.fp);
+        fwrite(compressed, 1, compressed_len, TRACE.fp);
+        
+        pthread_mutex_lock(&TRACE.lock);
+        TRACE.records += n;
+        TRACE.raw_bytes += header[0];
+        TRACE.compressed_bytes += compressed_len;
+        TRACE.pending = FALSE;
+        pthread_cond_broadcast(&TRACE.cond);
+    }
+    pthread_mutex_unlock(&TRACE.lock);
+    deflateEnd(&zs);
+    free(planes);
+    free(compressed);
+    return NULL;
+}
+
+/**************************************************************/
+/* Flush the partial block, stop the writer and close the file        */
+/**************************************************************/
+void trace_close() {
+    if (!TRACING) {
+        return;
+    }
+    TRACING = FALSE;
+    if (TRACE.count > 0) {
+        trace_handoff();
+    }
+    pthread_mutex_lock(&TRACE.lock);
+    TRACE.done = TRUE;
+    pthread_cond_broadcast(&TRACE.cond);
+    pthread_mutex_unlock(&TRACE.lock);
+    pthread_join(TRACE.writer, NULL);
+    fclose(TRACE.fp);
+    free(TRACE.buf[0]);
+    free(TRACE.buf[1]);
+    printf("Trace: %llu records, %llu bytes compressed to %llu (%s)\n", (unsigned long long)TRACE.records,
+           (unsigned long long)TRACE.raw_bytes, (unsigned long long)TRACE.compressed_bytes, trace_file);
+}
+
+/**************************************************************/
+/* Hand the instruction that just retired to the trace writer and    */
+/* the timing models                                                                  */
+/**************************************************************/
+void retire() {
+    int i;
+    
+    if (NEXT_STATE.PC != RETIRED.pc + 4) {
+        RETIRED.flags |= TRACE_TAKEN;
+    }
+    if (TRACING) {
+        trace_retire();
+    }
+    if (DECOUPLED) {
+        ring_push(&RETIRED);
+        return;
+    }
+    for (i = 0; i < NUM_TIMING_MODELS; i++) {
+        timing_retire(&TIMING_MODELS[i], &RETIRED);
+    }
+}
+
+/**************************************************************/
+/* Move the live timing models onto their own thread                  */
+/**************************************************************/
+void ring_start() {
+    atomic_init(&RING.head, 0);
+    atomic_init(&RING.tail, 0);
+    atomic_init(&RING.stop, FALSE);
+    atomic_init(&RING.sleeping, FALSE);
+    pthread_mutex_init(&RING.lock, NULL);
+    pthread_cond_init(&RING.wake, NULL);
+    RING.next = 0;
+    RING.tail_seen = 0;
+    if (pthread_create(&RING.consumer, NULL, ring_consumer, NULL) != 0) {
+        return;
+    }
+    DECOUPLED = TRUE;
+}
+
+/**************************************************************/
+/* Make the records pushed so far visible, waking the consumer if it */
+/* sleeps. (Sequentially consistent against its sleeping/head check, */
+/* so one of the two sides always sees the other.)                      */
+/**************************************************************/
+void ring_publish() {
+    atomic_store_explicit(&RING.head, RING.next, memory_order_seq_cst);
+    if (atomic_load_explicit(&RING.sleeping, memory_order_seq_cst)) {
+        pthread_mutex_lock(&RING.lock);
+        pthread_cond_signal(&RING.wake);
+        pthread_mutex_unlock(&RING.lock);
+    }
+}
+
+/**************************************************************/
+/* Producer side: append one record, waiting only if the ring is full */
+/**************************************************************/
+void ring_push(const retire_t *r) {
+    if (RING.next - RING.tail_seen == RING_SIZE) {
+        ring_publish();
+        while ((RING.tail_seen = atomic_load_explicit(&RING.tail, memory_order_acquire)) + RING_SIZE == RING.next) {
+            sched_yield();
+        }
+    }
+    RING.records[RING.next & (RING_SIZE - 1)] = *r;
+    if ((++RING.next & (RING_BATCH - 1)) == 0) {
+        ring_publish();
+    }
+}
+
+/**************************************************************/
+/* Consumer thread: feed every published record to each model         */
+/**************************************************************/
+void *ring_consumer(void *arg) {
+    uint64_t tail = 0, head, i;
+    int k, stopping, idle = 0;
+    
+    (void)arg;
+    for (;;) {
+        stopping = atomic_load_explicit(&RING.stop, memory_order_acquire);
+        head = atomic_load_explicit(&RING.head, memory_order_acquire);
+        if (head == tail) {
+            if (stopping) {
+                break;
+            }
+            if (++idle < RING_SPIN) {
+                sched_yield();
+                continue;
+            }
+            /* e.g. sitting at the prompt: sleep instead of burning a core */
+            pthread_mutex_lock(&RING.lock);
+            atomic_store_explicit(&RING.sleeping, TRUE, memory_order_seq_cst);
+            while (atomic_load_explicit(&RING.head, memory_order_seq_cst) == tail
+                   && !atomic_load_explicit(&RING.stop, memory_order_seq_cst)) {
+                pthread_cond_wait(&RING.wake, &RING.lock);
+            }
+            atomic_store_explicit(&RING.sleeping, FALSE, memory_order_relaxed);
+            pthread_mutex_unlock(&RING.lock);
+            idle = 0;
+            continue;
+        }
+        idle = 0;
+        /* model-major so each model's tables stay hot across the batch */
+        for (k = 0; k < NUM_TIMING_MODELS; k++) {
+            for (i = tail; i < head; i++) {
+                timing_retire(&TIMING_MODELS[k], &RING.records[i & (RING_SIZE - 1)]);
+            }
+        }
+        tail = head;
+        atomic_store_explicit(&RING.tail, tail, memory_order_release);
+    }
+    return NULL;
+}
+
+/**************************************************************/
+/* Wait until the timing thread has consumed every record pushed      */
+/**************************************************************/
+void ring_sync() {
+    if (!DECOUPLED) {
+        return;
+    }
+    ring_publish();
+    while ((RING.tail_seen = atomic_load_explicit(&RING.tail, memory_order_acquire)) != RING.next) {
+        sched_yield();
+    }
+}
+
+/**************************************************************/
+/* Publish what is left, let the consumer drain it and join it          */
+/**************************************************************/
+void ring_stop() {
+    if (!DECOUPLED) {
+        return;
+    }
+    atomic_store_explicit(&RING.stop, TRUE, memory_order_seq_cst);
+    ring_publish();
+    pthread_join(RING.consumer, NULL);
+    DECOUPLED = FALSE;
+}
+
+/**************************************************************/
+/* Set up an empty set-associative cache; sizes in bytes, powers of 2 */
+/**************************************************************/
+int cache_init(cache_t *c, uint32_t size, uint32_t assoc, uint32_t line) {
+    if (line == 0 || assoc == 0 || (line & (line - 1)) != 0 || size < assoc * line) {
+        return -1;
+    }
+    c->sets = size / (assoc * line);
+    if ((c->sets & (c->sets - 1)) != 0) {
+        return -1;
+    }
+    c->assoc = assoc;
+    for (c->line_shift = 0; (1u << c->line_shift) < line; c->line_shift++);
+    c->lines = malloc(c->sets * assoc * sizeof(uint32_t));
+    memset(c->lines, 0xFF, c->sets * assoc * sizeof(uint32_t));
+    c->accesses = 0;
+    c->misses = 0;
+    return 0;
+}
+
+/**************************************************************/
+/* Look up addr, filling on a miss. Returns TRUE on a hit.               */
+/**************************************************************/
+int cache_access(cache_t *c, uint32_t addr) {
+    uint32_t line = addr >> c->line_shift;
+    uint32_t *set = c->lines + (line & (c->sets - 1)) * c->assoc;
+    uint32_t i;
+    int hit = TRUE;
+    
+    c->accesses++;
+    for (i = 0; i < c->assoc && set[i] != line; i++);
+    if (i == c->assoc) {
+        /* miss: the least recently used line falls off the end */
+        c->misses++;
+        hit = FALSE;
+        i = c->assoc - 1;
+    }
+    memmove(set + 1, set, i * sizeof(uint32_t));
+    set[0] = line;
+    return hit;
+}
+
+/**************************************************************/
+/* Parse a configuration such as "i=16k:2:32,d=32k:4:32,bp=1024,mem=20,br=3" */
+/* (any field may be left out) and add it as a timing model                 */
+/**************************************************************/
+int timing_add_config(const char *spec) {
+    timing_model_t *m;
+    char buffer[64], *token, *end;
+    uint32_t isize = 16384, iassoc = 2, iline = 32;
+    uint32_t dsize = 16384, dassoc = 4, dline = 32;
+    uint32_t bp = 1024, mem = 20, br = 3;
+    uint32_t *size, *assoc, *line;
+    
+    if (NUM_TIMING_MODELS == MAX_TIMING_MODELS) {
+        printf("Error: at most %d timing configurations\n", MAX_TIMING_MODELS);
+        return -1;
+    }
+    strncpy(buffer, spec, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
+    for (token = strtok(buffer, ","); token != NULL; token = strtok(NULL, ",")) {
+        if (token[0] == 'i' || token[0] == 'd') {
+            size = (token[0] == 'i') ? &isize : &dsize;
+            assoc = (token[0] == 'i') ? &iassoc : &dassoc;
+            line = (token[0] == 'i') ? &iline : &dline;
+            *size = strtoul(token + 2, &end, 0);
+            if (*end == 'k' || *end == 'K') {
+                *size <<= 10;
+                end++;
+            }
+            else if (*end == 'm' || *end == 'M') {
+                *size <<= 20;
+                end++;
+            }
+            if (*end == ':') {
+                *assoc = strtoul(end + 1, &end, 0);
+            }
+            if (*end == ':') {
+                *line = strtoul(end + 1, &end, 0);
+            }
+        }
+        else if (strncmp(token, "bp=", 3) == 0) {
+            bp = strtoul(token + 3, NULL, 0);
+        }
+        else if (strncmp(token, "mem=", 4) == 0) {
+            mem = strtoul(token + 4, NULL, 0);
+        }
+        else if (strncmp(token, "br=", 3) == 0) {
+            br = strtoul(token + 3, NULL, 0);
+        }
+    }
+    
+    m = &TIMING_MODELS[NUM_TIMING_MODELS];
+    memset(m, 0, sizeof(timing_model_t));
+    if (cache_init(&m->icache, isize, iassoc, iline) != 0 || cache_init(&m->dcache, dsize, dassoc, dline) != 0
+        || bp == 0 || (bp & (bp - 1)) != 0) {
+        printf("Error: invalid timing configuration %s\n", spec);
+        return -1;
+    }
+    strncpy(m->name, spec, sizeof(m->name) - 1);
+    m->bp_entries = bp;
+    m->bp_table = malloc(bp);
+    memset(m->bp_table, 1, bp);    /* weakly not taken */
+    m->miss_penalty = mem;
+    m->mispredict_penalty = br;
+    NUM_TIMING_MODELS++;
+    RETIRE_HOOKS = TRUE;
+    return 0;
+}
+
+/**************************************************************/
+/* Charge one retired instruction to a timing model                      */
+/**************************************************************/
+void timing_retire(timing_model_t *m, const retire_t *r) {
+    uint8_t *counter;
+    int taken;
+    
+    m->instructions++;
+    m->cycles++;
+    if (!cache_access(&m->icache, r->pc)) {
+        m->cycles += m->miss_penalty;
+    }
+    if (r->size != 0 && !cache_access(&m->dcache, r->addr)) {
+        m->cycles += m->miss_penalty;
+    }
+    if (r->flags & TRACE_BRANCH) {
+        m->branches++;
+        counter = &m->bp_table[(r->pc >> 2) & (m->bp_entries - 1)];
+        taken = (r->flags & TRACE_TAKEN) != 0;
+        if ((*counter >= 2) != taken) {
+            m->mispredicts++;
+            m->cycles += m->mispredict_penalty;
+        }
+        if (taken && *counter < 3) {
+            (*counter)++;
+        }
+        else if (!taken && *counter > 0) {
+            (*counter)--;
+        }
+    }
+}
+
+/**************************************************************/
+/* One line of results per timing configuration                           */
+/**************************************************************/
+void timing_report() {
+    timing_model_t *m;
+    int i;
+    
+    if (NUM_TIMING_MODELS == 0) {
+        return;
+    }
+    ring_stop();
+    printf("-------------------------------------------------------------------------------\n");
+    printf("[Configuration]\t\t\t\t[Instructions]\t[CPI]\t[I-miss%%]\t[D-miss%%]\t[Mispredict%%]\n");
+    printf("-------------------------------------------------------------------------------\n");
+    for (i = 0; i < NUM_TIMING_MODELS; i++) {
+        m = &TIMING_MODELS[i];
+        printf("%-40s\t%-12llu\t%.3f\t%.3f\t\t%.3f\t\t%.3f\n", m->name[0] ? m->name : "default",
+               (unsigned long long)m->instructions,
+               m->instructions ? (double)m->cycles / m->instructions : 0.0,
+               m->icache.accesses ? 100.0 * m->icache.misses / m->icache.accesses : 0.0,
+               m->dcache.accesses ? 100.0 * m->dcache.misses / m->dcache.accesses : 0.0,
+               m->branches ? 100.0 * m->mispredicts / m->branches : 0.0);
+    }
+    printf("-------------------------------------------------------------------------------\n\n");
+}
+
+/**************************************************************/
+/* Drive the timing models from a recorded trace without executing  */
+/* anything. The file is mapped and inflated one block at a time.     */
+/**************************************************************/
+void replay_trace() {
+    struct stat st;
+    uint8_t *map, *pos, *end, *block;
+    uint32_t header[2], record_bytes, block_records, n, i, last_pc = 0, last_addr = 0;
+    uint32_t *pcs, *instructions, *addrs;
+    uint8_t *sizes, *flags;
+    retire_t *records;
+    uint64_t total = 0;
+    z_stream zs;
+    int fd, k;
+    
+    fd = open(replay_file, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < 16) {
+        printf("Error: Can't open trace file %s\n", replay_file);
+        exit(-1);
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED || memcmp(map, TRACE_MAGIC, 8) != 0) {
+        printf("Error: %s is not a trace file\n", replay_file);
+        exit(-1);
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    memcpy(header, map + 8, sizeof(header));
+    record_bytes = header[0];
+    block_records = header[1];
+    if (record_bytes != TRACE_RECORD_BYTES) {
+        printf("Error: unsupported trace record size %u\n", record_bytes);
+        exit(-1);
+    }
+    
+    block = malloc(block_records * record_bytes);
+    records = malloc(block_records * sizeof(retire_t));
+    memset(&zs, 0, sizeof(zs));
+    inflateInit(&zs);
+    
+    pos = map + 16;
+    end = map + st.st_size;
+    while (pos + sizeof(header) <= end) {
+        memcpy(header, pos, sizeof(header));
+        pos += sizeof(header);
+        if (header[1] > (uint32_t)(end - pos) || header[0] > block_records * record_bytes) {
+            printf("Warning: truncated trace\n");
+            break;
+        }
+        inflateReset(&zs);
+        zs.next_in = pos;
+        zs.avail_in = header[1];
+        zs.next_out = block;
+        zs.avail_out = header[0];
+        if (inflate(&zs, Z_FINISH) != Z_STREAM_END) {
+            printf("Warning: corrupt trace block\n");
+            break;
+        }
+        pos += header[1];
+        
+        /* undo the field planes and deltas written by trace_encode_block() */
+        n = header[0] / record_bytes;
+        pcs = (uint32_t *)block;
+        instructions = pcs + n;
+        addrs = instructions + n;
+        sizes = (uint8_t *)(addrs + n);
+        flags = sizes + n;
+        for (i = 0; i < n; i++) {
+            last_pc += 4 + pcs[i];
+            records[i].pc = last_pc;
+            records[i].instruction = instructions[i];
+            records[i].size = sizes[i];
+            records[i].flags = flags[i];
+            if (sizes[i] != 0) {
+                last_addr += addrs[i];
+            }
+            records[i].addr = last_addr;
+        }
+        for (k = 0; k < NUM_TIMING_MODELS; k++) {
+            for (i = 0; i < n; i++) {
+                timing_retire(&TIMING_MODELS[k], &records[i]);
+            }
+        }
+        total += n;
+    }
+    
+    inflateEnd(&zs);
+    munmap(map, st.st_size);
+    close(fd);
+    free(block);
+    free(records);
+    printf("Replayed %llu instructions from %s\n\n", (unsigned long long)total, replay_file);
+    timing_report();
+}
+
+/**************************************************************/
+/* Allocate the stack-distance profiler                                      */
+/**************************************************************/
+void reuse_init() {
+    int k;
+    
+    REUSE.table_size = 1 << 16;
+    REUSE.keys = malloc(REUSE.table_size * sizeof(uint32_t));
+    REUSE.stamps = malloc(REUSE.table_size * sizeof(uint32_t));
+    memset(REUSE.keys, 0xFF, REUSE.table_size * sizeof(uint32_t));
+    REUSE.capacity = 1 << 20;
+    REUSE.tree = calloc(REUSE.capacity + 1, sizeof(uint32_t));
+    REUSE.hist_size = REUSE.table_size;
+    REUSE.hist = calloc(REUSE.hist_size, sizeof(uint64_t));
+    for (k = 0; k < REUSE_SET_LEVELS; k++) {
+        REUSE.sets[k].lines = malloc((REUSE_MAX_WAYS << k) * sizeof(uint32_t));
+        memset(REUSE.sets[k].lines, 0xFF, (REUSE_MAX_WAYS << k) * sizeof(uint32_t));
+    }
+    REUSE_PROFILE = TRUE;
+}
+
+/**************************************************************/
+/* Slot of line in the last-access table (empty slot if absent)      */
+/**************************************************************/
+static uint32_t reuse_slot(uint32_t line) {
+    uint32_t mask = REUSE.table_size - 1;
+    uint32_t i = (line * 2654435761u) & mask;
+    
+    while (REUSE.keys[i] != line && REUSE.keys[i] != REUSE_EMPTY) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/**************************************************************/
+/* Double the last-access table and the distance histogram         */
+/**************************************************************/
+static void reuse_grow() {
+    uint32_t *keys = REUSE.keys, *stamps = REUSE.stamps;
+    uint32_t i, slot, old_size = REUSE.table_size;
+    
+    REUSE.table_size *= 2;
+    REUSE.keys = malloc(REUSE.table_size * sizeof(uint32_t));
+    REUSE.stamps = malloc(REUSE.table_size * sizeof(uint32_t));
+    memset(REUSE.keys, 0xFF, REUSE.table_size * sizeof(uint32_t));
+    for (i = 0; i < old_size; i++) {
+        if (keys[i] != REUSE_EMPTY) {
+            slot = reuse_slot(keys[i]);
+            REUSE.keys[slot] = keys[i];
+            REUSE.stamps[slot] = stamps[i];
+        }
+    }
+    free(keys);
+    free(stamps);
+    
+    REUSE.hist = realloc(REUSE.hist, REUSE.table_size * sizeof(uint64_t));
+    memset(REUSE.hist + REUSE.hist_size, 0, (REUSE.table_size - REUSE.hist_size) * sizeof(uint64_t));
+    REUSE.hist_size = REUSE.table_size;
+}
+
+/**************************************************************/
+/* The Fenwick tree has run out of timestamps: renumber the live  */
+/* lines 1..n keeping their order, growing the tree if it is      */
+/* more than half full, and rebuild it                                          */
+/**************************************************************/
+static void reuse_compact() {
+    uint32_t *rank, i, j, n = 0;
+    
+    rank = calloc(REUSE.capacity + 1, sizeof(uint32_t));
+    for (i = 0; i < REUSE.table_size; i++) {
+        if (REUSE.keys[i] != REUSE_EMPTY) {
+            rank[REUSE.stamps[i]] = 1;
+        }
+    }
+    for (i = 1; i <= REUSE.capacity; i++) {
+        if (rank[i]) {
+            rank[i] = ++n;
+        }
+    }
+    for (i = 0; i < REUSE.table_size; i++) {
+        if (REUSE.keys[i] != REUSE_EMPTY) {
+            REUSE.stamps[i] = rank[REUSE.stamps[i]];
+        }
+    }
+    free(rank);
+    
+    if (n > REUSE.capacity / 2) {
+        REUSE.capacity *= 2;
+        free(REUSE.tree);
+        REUSE.tree = malloc((REUSE.capacity + 1) * sizeof(uint32_t));
+    }
+    memset(REUSE.tree, 0, (REUSE.capacity + 1) * sizeof(uint32_t));
+    for (i = 1; i <= REUSE.capacity; i++) {
+        REUSE.tree[i] += (i <= n);
+        j = i + (i & -i);
+        if (j <= REUSE.capacity) {
+            REUSE.tree[j] += REUSE.tree[i];
+        }
+    }
+    REUSE.now = n;
+}
+
+/**************************************************************/
+/* Record one reference: its LRU stack distance among all lines   */
+/* (fully associative) and its stack depth within its set for each */
+/* power-of-two number of sets                                                */
+/**************************************************************/
+void reuse_access(uint32_t address) {
+    uint32_t line = address >> REUSE_LINE_SHIFT;
+    uint32_t slot, stamp, distance, i, *stack;
+    reuse_sets_t *level;
+    int k;
+    
+    REUSE.accesses++;
+    if (REUSE.now == REUSE.capacity) {
+        reuse_compact();
+    }
+    
+    slot = reuse_slot(line);
+    if (REUSE.keys[slot] == line) {
+        /* distance = lines touched since the previous access = marks in (stamp, now] */
+        stamp = REUSE.stamps[slot];
+        distance = 0;
+        for (i = REUSE.now; i > 0; i -= i & -i) {
+            distance += REUSE.tree[i];
+        }
+        for (i = stamp; i > 0; i -= i & -i) {
+            distance -= REUSE.tree[i];
+        }
+        REUSE.hist[distance]++;
+        for (i = stamp; i <= REUSE.capacity; i += i & -i) {
+            REUSE.tree[i]--;
+        }
+    }
+    else {
+        REUSE.cold++;
+        REUSE.keys[slot] = line;
+        if (++REUSE.used * 2 > REUSE.table_size) {
+            reuse_grow();
+            slot = reuse_slot(line);
+        }
+    }
+    REUSE.stamps[slot] = ++REUSE.now;
+    for (i = REUSE.now; i <= REUSE.capacity; i += i & -i) {
+        REUSE.tree[i]++;
+    }
+    
+    for (k = 0; k < REUSE_SET_LEVELS; k++) {
+        level = &REUSE.sets[k];
+        stack = level->lines + (line & ((1u << k) - 1)) * REUSE_MAX_WAYS;
+        for (i = 0; i < REUSE_MAX_WAYS && stack[i] != line; i++);
+        if (i < REUSE_MAX_WAYS) {
+            level->hits[i]++;
+        }
+        else {
+            i = REUSE_MAX_WAYS - 1;
+        }
+        memmove(stack + 1, stack, i * sizeof(uint32_t));
+        stack[0] = line;
+    }
+}
+
+/**************************************************************/
+/* Write miss-ratio curves for every fully associative size and   */
+/* every power-of-two sets x ways LRU cache                                */
+/**************************************************************/
+void reuse_report() {
+    uint64_t hits;
+    uint32_t lines, ways, d;
+    FILE *fp;
+    int k;
+    
+    if (!REUSE_PROFILE || REUSE.accesses == 0) {
+        return;
+    }
+    fp = fopen(reuse_file, "w");
+    if (fp == NULL) {
+        printf("Error: Can't open miss-ratio file %s\n", reuse_file);
+        return;
+    }
+    fprintf(fp, "# %llu references, %u distinct %d-byte lines\n", (unsigned long long)REUSE.accesses,
+            REUSE.used, 1 << REUSE_LINE_SHIFT);
+    fprintf(fp, "organization,sets,ways,bytes,miss_ratio\n");
+    
+    /* fully associative: hit iff the stack distance is below the number of lines */
+    hits = 0;
+    d = 0;
+    for (lines = 1; ; lines *= 2) {
+        for (; d < lines && d < REUSE.hist_size; d++) {
+            hits += REUSE.hist[d];
+        }
+        fprintf(fp, "full,1,%u,%llu,%.6f\n", lines, (unsigned long long)lines << REUSE_LINE_SHIFT,
+                (double)(REUSE.accesses - hits) / REUSE.accesses);
+        if (lines >= REUSE.used) {
+            break;
+        }
+    }
+    
+    for (k = 0; k < REUSE_SET_LEVELS; k++) {
+        hits = 0;
+        d = 0;
+        for (ways = 1; ways <= REUSE_MAX_WAYS; ways *= 2) {
+            for (; d < ways; d++) {
+                hits += REUSE.sets[k].hits[d];
+            }
+            fprintf(fp, "set,%u,%u,%llu,%.6f\n", 1u << k, ways,
+                    (unsigned long long)(ways << k) << REUSE_LINE_SHIFT,
+                    (double)(REUSE.accesses - hits) / REUSE.accesses);
+        }
+    }
+    fclose(fp);
+    printf("Miss-ratio curves for %llu references written to %s\n", (unsigned long long)REUSE.accesses, reuse_file);
+}
+
+/**************************************************************/
+/* Mark guest pages as written so checkpoints only carry those,  */
+/* and list newly dirty ones for the fuzzer's restore              */
+/**************************************************************/
+void mem_mark_written(uint32_t address, uint32_t len) {
+    uint32_t page;
+    
+    if (len == 0) {
+        return;
+    }
+    for (page = address >> PAGE_SHIFT; page <= (address + len - 1) >> PAGE_SHIFT; page++) {
+        if (DIRTY_PAGES != NULL && !(PAGE_TABLE[page] & PAGE_DIRTY)) {
+            DIRTY_PAGES[NUM_DIRTY_PAGES++] = page;
+        }
+        PAGE_TABLE[page] |= PAGE_WRITTEN | PAGE_DIRTY;
+    }
+}
+
+/**************************************************************/
+/* Start interval tracking for BBV collection and/or checkpoints    */
+/**************************************************************/
+void interval_init() {
+    if (INTERVAL_LENGTH == 0) {
+        INTERVAL_LENGTH = INTERVAL_DEFAULT;
+    }
+    INTERVAL_END = (uint64_t)(INTERVAL_INDEX + 1) * INTERVAL_LENGTH;
+    if (bbv_file[0] != '\0') {
+        BBV_FILE = fopen(bbv_file, "w");
+        if (BBV_FILE == NULL) {
+            printf("Error: Can't open BBV file %s\n", bbv_file);
+            exit(-1);
+        }
+    }
+    if (NUM_SIMPOINTS > 0 && INSTRUCTION_COUNT == 0) {
+        interval_checkpoint();
+    }
+}
+
+/**************************************************************/
+/* Add a finished block to the current interval's BBV                     */
+/**************************************************************/
+void bbv_count(block_t *block, uint32_t length) {
+    if (block->bbv_id == 0) {
+        block->bbv_id = ++BBV_NEXT_ID;
+    }
+    if (block->bbv_count == 0) {
+        if (BBV_NUM_TOUCHED == BBV_TOUCHED_SIZE) {
+            BBV_TOUCHED_SIZE = (BBV_TOUCHED_SIZE == 0) ? 1024 : 2 * BBV_TOUCHED_SIZE;
+            BBV_TOUCHED = realloc(BBV_TOUCHED, BBV_TOUCHED_SIZE * sizeof(uint32_t));
+        }
+        BBV_TOUCHED[BBV_NUM_TOUCHED++] = block->start;
+    }
+    block->bbv_count += length;
+}
+
+/**************************************************************/
+/* Write the current interval's BBV in SimPoint .bb format and clear it */
+/**************************************************************/
+void bbv_flush() {
+    block_t *block;
+    uint32_t i;
+    
+    if (BBV_NUM_TOUCHED == 0) {
+        return;
+    }
+    fputc('T', BBV_FILE);
+    for (i = 0; i < BBV_NUM_TOUCHED; i++) {
+        block = block_lookup(BBV_TOUCHED[i]);
+        fprintf(BBV_FILE, ":%u:%llu ", block->bbv_id, (unsigned long long)block->bbv_count);
+        block->bbv_count = 0;
+    }
+    fputc('\n', BBV_FILE);
+    BBV_NUM_TOUCHED = 0;
+}
+
+/**************************************************************/
+/* Called at the first block boundary at or past INTERVAL_END          */
+/**************************************************************/
+void interval_end() {
+    if (BBV_FILE != NULL) {
+        bbv_flush();
+    }
+    INTERVAL_INDEX++;
+    INTERVAL_END = (uint64_t)(INTERVAL_INDEX + 1) * INTERVAL_LENGTH;
+    if (NUM_SIMPOINTS > 0) {
+        interval_checkpoint();
+    }
+}
+
+/**************************************************************/
+/* Flush the last, partial interval (atexit)                                  */
+/**************************************************************/
+void bbv_close() {
+    if (BBV_FILE == NULL) {
+        return;
+    }
+    bbv_flush();
+    fclose(BBV_FILE);
+    BBV_FILE = NULL;
+    printf("Basic block vectors for %u intervals of %llu instructions written to %s\n", INTERVAL_INDEX + 1,
+           (unsigned long long)INTERVAL_LENGTH, bbv_file);
+}
+
+/**************************************************************/
+/* Read the interval numbers (first column) of a SimPoint .simpoints file */
+/**************************************************************/
+void load_simpoints() {
+    FILE *fp;
+    uint32_t interval, cluster;
+    
+    fp = fopen(simpoint_file, "r");
+    if (fp == NULL) {
+        printf("Error: Can't open simpoints file %s\n", simpoint_file);
+        exit(-1);
+    }
+    while (fscanf(fp, "%u %u", &interval, &cluster) == 2) {
+        SIMPOINTS = realloc(SIMPOINTS, (NUM_SIMPOINTS + 1) * sizeof(uint32_t));
+        SIMPOINTS[NUM_SIMPOINTS++] = interval;
+    }
+    fclose(fp);
+}
+
+/**************************************************************/
+/* Checkpoint the machine if the interval just starting was selected */
+/**************************************************************/
+void interval_checkpoint() {
+    char path[96];
+    uint32_t i;
+    
+    for (i = 0; i < NUM_SIMPOINTS; i++) {
+        if (SIMPOINTS[i] == INTERVAL_INDEX) {
+            snprintf(path, sizeof(path), "%s.%u.ckpt", simpoint_file, INTERVAL_INDEX);
+            if (checkpoint_save(path) == 0) {
+                printf("Checkpoint for interval %u at instruction %llu written to %s\n", INTERVAL_INDEX,
+                       (unsigned long long)INSTRUCTION_COUNT, path);
+            }
+            return;
+        }
+    }
+}
+
+/**************************************************************/
+/* Save CPU state and every written page to a compressed checkpoint */
+/**************************************************************/
+int checkpoint_save(const char *path) {
+    gzFile gz;
+    uint32_t page, end = CHECKPOINT_END, k, value;
+    uint8_t *mem;
+    
+    gz = gzopen(path, "wb1");
+    if (gz == NULL) {
+        printf("Error: Can't create checkpoint %s\n", path);
+        return -1;
+    }
+    gzwrite(gz, CHECKPOINT_MAGIC, 8);
+    gzwrite(gz, &CURRENT_STATE, sizeof(CURRENT_STATE));
+    gzwrite(gz, &INSTRUCTION_COUNT, sizeof(INSTRUCTION_COUNT));
+    gzwrite(gz, &CYCLE_COUNT, sizeof(CYCLE_COUNT));
+    gzwrite(gz, &COUNT_BASE, sizeof(COUNT_BASE));
+    for (k = 0; k < 2 * PMC_COUNTERS; k++) {
+        value = pmc_read(k);
+        gzwrite(gz, &value, sizeof(value));
+    }
+    gzwrite(gz, &HEAP_BREAK, sizeof(HEAP_BREAK));
+    gzwrite(gz, &PROGRAM_SIZE, sizeof(PROGRAM_SIZE));
+    gzwrite(gz, &INTERVAL_INDEX, sizeof(INTERVAL_INDEX));
+    for (page = 0; page < NUM_PAGES; page++) {
+        if (!(PAGE_TABLE[page] & PAGE_WRITTEN) || (PAGE_TABLE[page] & PAGE_DEVICE_MASK)) {
+            continue;
+        }
+        mem = mem_host_ptr(page << PAGE_SHIFT, NULL);
+        if (mem != NULL) {
+            gzwrite(gz, &page, sizeof(page));
+            gzwrite(gz, mem, PAGE_SIZE);
+        }
+    }
+    gzwrite(gz, &end, sizeof(end));
+    if (gzclose(gz) != Z_OK) {
+        printf("Error: Can't write checkpoint %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/**************************************************************/
+/* Replace the machine state with a checkpoint. Host files opened by */
+/* the program are not part of it.                                               */
+/**************************************************************/
+int checkpoint_load(const char *path) {
+    gzFile gz;
+    char magic[8];
+    uint32_t page, k, value;
+    uint8_t *mem;
+    
+    gz = gzopen(path, "rb");
+    if (gz == NULL) {
+        printf("Error: Can't open checkpoint %s\n", path);
+        return -1;
+    }
+    if (gzread(gz, magic, 8) != 8 || memcmp(magic, CHECKPOINT_MAGIC, 8) != 0) {
+        printf("Error: %s is not a checkpoint\n", path);
+        gzclose(gz);
+        return -1;
+    }
+    
+    /* start from empty memory */
+    for (page = 0; page < NUM_PAGES; page++) {
+        if ((PAGE_TABLE[page] & PAGE_WRITTEN) && !(PAGE_TABLE[page] & PAGE_DEVICE_MASK)) {
+            mem = mem_host_ptr(page << PAGE_SHIFT, NULL);
+            if (mem != NULL) {
+                memset(mem, 0, PAGE_SIZE);
+            }
+            PAGE_TABLE[page] &= ~(PAGE_WRITTEN | PAGE_DIRTY);
+        }
+    }
+    
+    gzread(gz, &CURRENT_STATE, sizeof(CURRENT_STATE));
+    gzread(gz, &INSTRUCTION_COUNT, sizeof(INSTRUCTION_COUNT));
+    gzread(gz, &CYCLE_COUNT, sizeof(CYCLE_COUNT));
+    gzread(gz, &COUNT_BASE, sizeof(COUNT_BASE));
+    for (k = 0; k < 2 * PMC_COUNTERS; k++) {
+        /* controls come first, so each count is rebased on its event */
+        gzread(gz, &value, sizeof(value));
+        pmc_write(k, value);
+    }
+    gzread(gz, &HEAP_BREAK, sizeof(HEAP_BREAK));
+    gzread(gz, &PROGRAM_SIZE, sizeof(PROGRAM_SIZE));
+    gzread(gz, &INTERVAL_INDEX, sizeof(INTERVAL_INDEX));
+    while (gzread(gz, &page, sizeof(page)) == sizeof(page) && page != CHECKPOINT_END) {
+        mem = (page < NUM_PAGES) ? mem_host_ptr(page << PAGE_SHIFT, NULL) : NULL;
+        if (mem == NULL || gzread(gz, mem, PAGE_SIZE) != PAGE_SIZE) {
+            printf("Error: corrupt checkpoint %s\n", path);
+            gzclose(gz);
+            return -1;
+        }
+        PAGE_TABLE[page] |= PAGE_WRITTEN;
+    }
+    gzclose(gz);
+    
+    NEXT_STATE = CURRENT_STATE;
+    BLOCK_START_PC = CURRENT_STATE.PC;
+    BLOCK_START_COUNT = INSTRUCTION_COUNT;
+    hle_flush();
+    schedule_timer();
+    RUN_FLAG = TRUE;
+    printf("Restored %s: PC 0x%08x, %llu instructions executed\n", path, CURRENT_STATE.PC, (unsigned long long)INSTRUCTION_COUNT);
+    return 0;
+}
+
+/**************************************************************/
+/* Weight of each simulation point, from the .weights file that    */
+/* simpoint wrote next to the .simpoints file                            */
+/**************************************************************/
+void load_simpoint_weights(double *weights) {
+    char path[96], *dot;
+    FILE *fp;
+    uint32_t i, interval, cluster, *clusters;
+    double weight, *by_cluster = NULL;
+    uint32_t num_clusters = 0;
+    
+    /* cluster of each simulation point, in file order */
+    clusters = malloc(NUM_SIMPOINTS * sizeof(uint32_t));
+    fp = fopen(simpoint_file, "r");
+    for (i = 0; fp != NULL && i < NUM_SIMPOINTS && fscanf(fp, "%u %u", &interval, &cluster) == 2; i++) {
+        clusters[i] = cluster;
+    }
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    
+    strncpy(path, simpoint_file, sizeof(path) - 16);
+    path[sizeof(path) - 16] = '\0';
+    dot = strrchr(path, '.');
+    if (dot == NULL || strcmp(dot, ".simpoints") != 0) {
+        dot = path + strlen(path);
+    }
+    strcpy(dot, ".weights");
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        printf("Warning: no weights file %s, weighting intervals equally\n", path);
+        for (i = 0; i < NUM_SIMPOINTS; i++) {
+            weights[i] = 1.0 / NUM_SIMPOINTS;
+        }
+        free(clusters);
+        return;
+    }
+    while (fscanf(fp, "%lf %u", &weight, &cluster) == 2) {
+        if (cluster >= num_clusters) {
+            by_cluster = realloc(by_cluster, (cluster + 1) * sizeof(double));
+            memset(by_cluster + num_clusters, 0, (cluster + 1 - num_clusters) * sizeof(double));
+            num_clusters = cluster + 1;
+        }
+        by_cluster[cluster] = weight;
+    }
+    fclose(fp);
+    for (i = 0; i < NUM_SIMPOINTS; i++) {
+        weights[i] = (clusters[i] < num_clusters) ? by_cluster[clusters[i]] : 0.0;
+    }
+    free(by_cluster);
+    free(clusters);
+}
+
+/**************************************************************/
+/* Worker process: restore one checkpoint, simulate its interval in */
+/* detail and send the timing model counters back                  */
+/**************************************************************/
+void sample_worker(uint32_t interval, int fd) {
+    char path[96];
+    sample_result_t result[MAX_TIMING_MODELS];
+    uint64_t end;
+    int k, null_fd;
+    
+    snprintf(path, sizeof(path), "%s.%u.ckpt", simpoint_file, interval);
+    if (checkpoint_load(path) != 0) {
+        _exit(1);
+    }
+    /* keep the guest's and the simulator's output out of the report */
+    null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    
+    end = INSTRUCTION_COUNT + INTERVAL_LENGTH;
+    while (RUN_FLAG && INSTRUCTION_COUNT < end) {
+        run_block();
+    }
+    flush_guest_output();
+    for (k = 0; k < NUM_TIMING_MODELS; k++) {
+        result[k].instructions = TIMING_MODELS[k].instructions;
+        result[k].cycles = TIMING_MODELS[k].cycles;
+        result[k].icache_accesses = TIMING_MODELS[k].icache.accesses;
+        result[k].icache_misses = TIMING_MODELS[k].icache.misses;
+        result[k].dcache_accesses = TIMING_MODELS[k].dcache.accesses;
+        result[k].dcache_misses = TIMING_MODELS[k].dcache.misses;
+        result[k].branches = TIMING_MODELS[k].branches;
+        result[k].mispredicts = TIMING_MODELS[k].mispredicts;
+    }
+    if (write(fd, result, NUM_TIMING_MODELS * sizeof(sample_result_t)) < 0) {
+        _exit(1);
+    }
+    _exit(0);
+}
+
+/**************************************************************/
+/* Simulate every simulation point from its checkpoint, one worker  */
+/* process per host CPU, and report the weighted estimate                */
+/**************************************************************/
+void sampled_run() {
+    sample_result_t *results, *r;
+    double *weights, w, cpi = 0, imiss = 0, iacc = 0, dmiss = 0, dacc = 0, mispredicts = 0, branches = 0;
+    pid_t *pids, pid;
+    int *fds, pipe_fd[2], status, k, cpus, running = 0;
+    uint32_t i, next = 0, done = 0, failed = 0;
+    ssize_t bytes;
+    
+    if (NUM_SIMPOINTS == 0) {
+        printf("Error: no simulation points in %s\n", simpoint_file);
+        exit(-1);
+    }
+    weights = malloc(NUM_SIMPOINTS * sizeof(double));
+    load_simpoint_weights(weights);
+    results = calloc((size_t)NUM_SIMPOINTS * NUM_TIMING_MODELS, sizeof(sample_result_t));
+    pids = calloc(NUM_SIMPOINTS, sizeof(pid_t));
+    fds = calloc(NUM_SIMPOINTS, sizeof(int));
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        cpus = 1;
+    }
+    fflush(stdout);
+    
+    while (done < NUM_SIMPOINTS) {
+        if (next < NUM_SIMPOINTS && running < cpus) {
+            if (pipe(pipe_fd) != 0) {
+                printf("Error: pipe failed\n");
+                exit(-1);
+            }
+            pid = fork();
+            if (pid == 0) {
+                close(pipe_fd[0]);
+                sample_worker(SIMPOINTS[next], pipe_fd[1]);
+            }
+            close(pipe_fd[1]);
+            pids[next] = pid;
+            fds[next] = pipe_fd[0];
+            next++;
+            running++;
+            continue;
+        }
+        
+        pid = wait(&status);
+        for (i = 0; i < next && pids[i] != pid; i++);
+        if (i == next) {
+            continue;
+        }
+        r = &results[i * NUM_TIMING_MODELS];
+        bytes = read(fds[i], r, NUM_TIMING_MODELS * sizeof(sample_result_t));
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || bytes != (ssize_t)(NUM_TIMING_MODELS * sizeof(sample_result_t))) {
+            printf("Warning: interval %u failed, left out of the estimate\n", SIMPOINTS[i]);
+            weights[i] = 0;
+            failed++;
+        }
+        close(fds[i]);
+        running--;
+        done++;
+    }
+    
+    /* renormalize in case some points failed */
+    for (i = 0, w = 0; i < NUM_SIMPOINTS; i++) {
+        w += weights[i];
+    }
+    printf("Sampled %u of %u simulation points (%llu instructions each) from %s\n\n", NUM_SIMPOINTS - failed,
+           NUM_SIMPOINTS, (unsigned long long)INTERVAL_LENGTH, simpoint_file);
+    printf("-------------------------------------------------------------------------------\n");
+    printf("[Configuration]\t\t\t\t[CPI]\t[I-miss%%]\t[D-miss%%]\t[Mispredict%%]\n");
+    printf("-------------------------------------------------------------------------------\n");
+    for (k = 0; k < NUM_TIMING_MODELS; k++) {
+        cpi = imiss = iacc = dmiss = dacc = mispredicts = branches = 0;
+        for (i = 0; i < NUM_SIMPOINTS && w > 0; i++) {
+            r = &results[i * NUM_TIMING_MODELS + k];
+            if (weights[i] == 0 || r->instructions == 0) {
+                continue;
+            }
+            /* combine per-instruction rates so every interval counts by its weight alone */
+            cpi += weights[i] / w * r->cycles / r->instructions;
+            imiss += weights[i] / w * r->icache_misses / r->instructions;
+            iacc += weights[i] / w * r->icache_accesses / r->instructions;
+            dmiss += weights[i] / w * r->dcache_misses / r->instructions;
+            dacc += weights[i] / w * r->dcache_accesses / r->instructions;
+            mispredicts += weights[i] / w * r->mispredicts / r->instructions;
+            branches += weights[i] / w * r->branches / r->instructions;
+        }
+        printf("%-40s\t%.3f\t%.3f\t\t%.3f\t\t%.3f\n", TIMING_MODELS[k].name[0] ? TIMING_MODELS[k].name : "default",
+               cpi, iacc > 0 ? 100.0 * imiss / iacc : 0.0, dacc > 0 ? 100.0 * dmiss / dacc : 0.0,
+               branches > 0 ? 100.0 * mispredicts / branches : 0.0);
+    }
+    printf("-------------------------------------------------------------------------------\n\n");
+    free(weights);
+    free(results);
+    free(pids);
+    free(fds);
+}
+
+/**************************************************************/
+/* Does the code at addr match a signature? (*temp gets the rt  */
+/* field of the first masked word, the routine's scratch register) */
+/**************************************************************/
+int hle_match(uint32_t addr, const hle_pattern_t *pattern, int length, uint32_t *temp) {
+    uint32_t word;
+    int i;
+    
+    *temp = 0;
+    for (i = 0; i < length; i++) {
+        word = mem_read_32(addr + 4 * i);
+        if ((word & pattern[i].mask) != pattern[i].word) {
+            return FALSE;
+        }
+        if (pattern[i].mask != 0xFFFFFFFF && *temp == 0) {
+            *temp = (pattern[i].mask == 0xFFE0FFFF) ? (word >> 16) & 0x1F : (word >> 21) & 0x1F;
+        }
+    }
+    return TRUE;
+}
+
+/**************************************************************/
+/* Identify the routine at a JAL target (cached per target)              */
+/**************************************************************/
+hle_entry_t *hle_lookup(uint32_t target) {
+    hle_entry_t *entry = &HLE_CACHE[(target >> 2) & (HLE_CACHE_SIZE - 1)];
+    uint32_t temp, used, i;
+    int routine, scratch;
+    
+    if (entry->valid && entry->target == target) {
+        return entry;
+    }
+    entry->valid = TRUE;
+    entry->target = target;
+    entry->routine = HLE_NONE;
+    for (routine = HLE_NONE + 1; routine < NUM_HLE_ROUTINES; routine++) {
+        if (!hle_match(target, HLE_SIGNATURES[routine], HLE_SIGNATURE_LENGTH[routine], &temp)) {
+            continue;
+        }
+        /* every use of the scratch register must name the same one, and it */
+        /* must not be an argument, the result or the return address        */
+        for (i = 0, scratch = FALSE; i < (uint32_t)HLE_SIGNATURE_LENGTH[routine]; i++) {
+            if (HLE_SIGNATURES[routine][i].mask == 0xFFFFFFFF) {
+                continue;
+            }
+            scratch = TRUE;
+            used = mem_read_32(target + 4 * i);
+            used = (HLE_SIGNATURES[routine][i].mask == 0xFFE0FFFF) ? (used >> 16) & 0x1F : (used >> 21) & 0x1F;
+            if (used != temp) {
+                temp = 0;
+            }
+        }
+        if (scratch && (temp == 0 || temp == 2 || (temp >= 4 && temp <= 6) || temp == 31)) {
+            continue;
+        }
+        entry->routine = routine;
+        entry->temp = temp;
+        break;
+    }
+    return entry;
+}
+
+/**************************************************************/
+/* Host pointer for the bytes a guest byte loop touches at         */
+/* [address, address+len) -- every load/store ORs 0x00010000 into */
+/* the address -- if the range stays in one 64 KiB segment (only    */
+/* then is its image contiguous) and is RAM, otherwise NULL           */
+/**************************************************************/
+uint8_t *hle_range(uint32_t address, uint32_t len) {
+    uint32_t first = address | 0x00010000, last = first + len - 1, avail, page;
+    uint8_t *p;
+    
+    if (len == 0 || ((address ^ (address + len - 1)) & 0xFFFF0000) != 0) {
+        return NULL;
+    }
+    for (page = first >> PAGE_SHIFT; page <= last >> PAGE_SHIFT; page++) {
+        if (PAGE_TABLE[page] & PAGE_DEVICE_MASK) {
+            return NULL;
+        }
+    }
+    p = mem_host_ptr(first, &avail);
+    return (p != NULL && avail >= len) ? p : NULL;
+}
+
+/**************************************************************/
+/* memcpy (copy) or memset of n bytes the way the guest byte loop     */
+/* does it: forwards, one piece per 64 KiB remap segment of the        */
+/* destination and source. Without apply, only checks that every piece */
+/* is RAM and that no piece overwrites source bytes it has yet to read. */
+/**************************************************************/
+int hle_pieces(uint32_t dst, uint32_t src, uint32_t n, int copy, uint8_t value, int apply) {
+    uint32_t done, piece, d, s;
+    uint8_t *dp, *sp = NULL;
+    
+    for (done = 0; done < n; done += piece) {
+        d = dst + done;
+        s = src + done;
+        piece = 0x10000 - (d & 0xFFFF);
+        if (copy && 0x10000 - (s & 0xFFFF) < piece) {
+            piece = 0x10000 - (s & 0xFFFF);
+        }
+        if (piece > n - done) {
+            piece = n - done;
+        }
+        dp = hle_range(d, piece);
+        if (copy) {
+            sp = hle_range(s, piece);
+        }
+        if (!apply) {
+            if (dp == NULL || (copy && (sp == NULL || (dp > sp && dp - sp < piece)))) {
+                return FALSE;
+            }
+            continue;
+        }
+        if (copy) {
+            memmove(dp, sp, piece);
+        }
+        else {
+            memset(dp, value, piece);
+        }
+        mem_mark_written(d | 0x00010000, piece);
+    }
+    return TRUE;
+}
+
+/**************************************************************/
+/* Can executed instructions be skipped at once? Not past a pending  */
+/* interrupt check or the end of an interval, as the guest code would */
+/* have stopped at a block boundary there, nor past the end of a run n. */
+/**************************************************************/
+int hle_fits(uint64_t executed) {
+    return CYCLE_COUNT + executed < NEXT_EVENT_CYCLE && INSTRUCTION_COUNT + executed < INTERVAL_END
+        && INSTRUCTION_COUNT + executed < RUN_END;
+}
+
+/**************************************************************/
+/* Run a recognised routine natively in place of the guest code a JAL */
+/* is about to enter. Registers, memory, the return and the           */
+/* instruction/cycle counts end up as if the guest loop had run. Returns */
+/* FALSE (guest code runs) for cases the host version cannot reproduce */
+/* exactly, e.g. copies onto bytes not yet read or ranges reaching   */
+/* device pages.                                                                         */
+/**************************************************************/
+int hle_call(uint32_t target) {
+    hle_entry_t *entry;
+    uint32_t a0 = CURRENT_STATE.REGS[4], a1 = CURRENT_STATE.REGS[5], n = CURRENT_STATE.REGS[6];
+    uint32_t len, seg;
+    uint64_t executed;
+    uint8_t *p, *nul;
+    
+    if (RETIRE_HOOKS || REUSE_PROFILE) {
+        /* something is watching every instruction */
+        return FALSE;
+    }
+    entry = hle_lookup(target);
+    switch (entry->routine) {
+        case HLE_MEMCPY:
+            executed = 7 * (uint64_t)n + 3;
+            if (!hle_fits(executed)) {
+                return FALSE;
+            }
+            if (n == 0) {
+                break;
+            }
+            if (!hle_pieces(a0, a1, n, TRUE, 0, FALSE)) {
+                return FALSE;
+            }
+            hle_pieces(a0, a1, n, TRUE, 0, TRUE);
+            /* the last byte loaded: only its own store came after the load */
+            NEXT_STATE.REGS[entry->temp] = (uint32_t)(int32_t)(int8_t)*hle_range(a1 + n - 1, 1);
+            NEXT_STATE.REGS[4] = a0 + n;
+            NEXT_STATE.REGS[5] = a1 + n;
+            NEXT_STATE.REGS[6] = 0;
+            break;
+            
+        case HLE_MEMSET:
+            executed = 5 * (uint64_t)n + 3;
+            if (!hle_fits(executed)) {
+                return FALSE;
+            }
+            if (n != 0) {
+                if (!hle_pieces(a0, a0, n, FALSE, a1 & 0xFF, FALSE)) {
+                    return FALSE;
+                }
+                hle_pieces(a0, a0, n, FALSE, a1 & 0xFF, TRUE);
+                NEXT_STATE.REGS[4] = a0 + n;
+                NEXT_STATE.REGS[6] = 0;
+            }
+            break;
+            
+        case HLE_STRLEN:
+            /* scan one remap-contiguous 64 KiB segment at a time */
+            for (len = 0; ; len += seg) {
+                seg = 0x10000 - ((a0 + len) & 0xFFFF);
+                if (len > HLE_MAX_STRING || (p = hle_range(a0 + len, seg)) == NULL) {
+                    return FALSE;
+                }
+                nul = memchr(p, 0, seg);
+                if (nul != NULL) {
+                    len += nul - p;
+                    break;
+                }
+            }
+            executed = 5 * (uint64_t)len + 4;
+            if (!hle_fits(executed)) {
+                return FALSE;
+            }
+            NEXT_STATE.REGS[2] = len;
+            NEXT_STATE.REGS[4] = a0 + len;
+            NEXT_STATE.REGS[entry->temp] = 0;
+            break;
+            
+        default:
+            return FALSE;
+    }
+    
+    if (entry->routine != HLE_STRLEN) {
+        NEXT_STATE.REGS[2] = a0;
+    }
+    NEXT_STATE.PC = NEXT_STATE.REGS[31];
+    /* the routine's instructions count as executed, but not towards this block */
+    INSTRUCTION_COUNT += executed;
+    CYCLE_COUNT += executed;
+    BLOCK_START_COUNT += executed;
+    HLE_CALLS[entry->routine]++;
+    HLE_INSTRUCTIONS += executed;
+    return TRUE;
+}
+
+/**************************************************************/
+/* Forget identified routines (the code may have changed)              */
+/**************************************************************/
+void hle_flush() {
+    memset(HLE_CACHE, 0, sizeof(HLE_CACHE));
+}
+
+/**************************************************************/
+/* Registers an instruction reads and writes, as bit masks (bit 32 =  */
+/* HI, bit 33 = LO, $zero never included). Returns FALSE for          */
+/* instructions with effects beyond registers: stores, syscalls,     */
+/* CP0 writes, ERET and JAL (which may run natively).                      */
+/**************************************************************/
+int instruction_regs(uint32_t instruction, uint64_t *reads, uint64_t *writes) {
+    uint64_t rs = 1ULL << ((instruction >> 21) & 0x1F);
+    uint64_t rt = 1ULL << ((instruction >> 16) & 0x1F);
+    uint64_t rd = 1ULL << ((instruction >> 11) & 0x1F);
+    uint64_t hi = 1ULL << 32, lo = 1ULL << 33;
+    
+    *reads = 0;
+    *writes = 0;
+    switch (decode_opcode(instruction)) {
+        case OP_ADD: case OP_ADDU: case OP_SUB: case OP_SUBU: case OP_AND: case OP_OR:
+        case OP_XOR: case OP_NOR: case OP_SLT:
+            *reads = rs | rt; *writes = rd; break;
+        case OP_SLL: case OP_SRL: case OP_SRA:
+            *reads = rt; *writes = rd; break;
+        case OP_MULT: case OP_MULTU: case OP_DIV: case OP_DIVU:
+            *reads = rs | rt; *writes = hi | lo; break;
+        case OP_MFHI: *reads = hi; *writes = rd; break;
+        case OP_MFLO: *reads = lo; *writes = rd; break;
+        case OP_MTHI: *reads = rs; *writes = hi; break;
+        case OP_MTLO: *reads = rs; *writes = lo; break;
+        case OP_JR: *reads = rs; break;
+        case OP_JALR: *reads = rs; *writes = rd; break;
+        case OP_LUI: *writes = rt; break;
+        case OP_ADDI: case OP_ADDIU: case OP_SLTI: case OP_LW: case OP_LB: case OP_LH:
+            *reads = rs; *writes = rt; break;
+        case OP_ANDI: case OP_ORI: case OP_XORI:
+            /* these take their register operand from rt */
+            *reads = rt; *writes = rt; break;
+        case OP_J: break;
+        case OP_BEQ: case OP_BNE: *reads = rs | rt; break;
+        case OP_BLEZ: case OP_BGTZ: case OP_BLTZ: case OP_BGEZ: *reads = rs; break;
+        case OP_MFC0: *writes = rt; break;
+        default:
+            return FALSE;
+    }
+    *reads &= ~1ULL;
+    *writes &= ~1ULL;
+    return TRUE;
+}
+
+/**************************************************************/
+/* Can iterations of this self-looping block be skipped? Only if it */
+/* has no side effects and no register carries a value from one     */
+/* iteration to the next, so every iteration computes the same       */
+/* thing -- except through CP0 reads such as Count (SPIN_TIMED).     */
+/**************************************************************/
+uint8_t spin_classify(block_t *block) {
+    uint64_t reads, writes, written = 0, inputs = 0;
+    uint32_t i, instruction;
+    int timed = FALSE;
+    
+    for (i = 0; i < block->length; i++) {
+        instruction = mem_read_32(block->start + 4 * i);
+        if (!instruction_regs(instruction, &reads, &writes)) {
+            return SPIN_NO;
+        }
+        if (decode_opcode(instruction) == OP_MFC0) {
+            if (((instruction >> 11) & 0x1F) == CP0_PERF) {
+                /* only Count can be predicted from the cycle count alone */
+                return SPIN_NO;
+            }
+            timed = TRUE;
+        }
+        inputs |= reads & ~written;
+        written |= writes;
+    }
+    if (inputs & written) {
+        return SPIN_NO;
+    }
+    return timed ? SPIN_TIMED : SPIN_PURE;
+}
+
+/**************************************************************/
+/* Would the iteration starting at start_cycle leave the loop? Runs */
+/* it on a copy of the state; the block has no side effects.            */
+/**************************************************************/
+int spin_exits(block_t *block, uint64_t start_cycle) {
+    CPU_State current = CURRENT_STATE, next = NEXT_STATE;
+    uint64_t cycles = CYCLE_COUNT;
+    retire_t retired = RETIRED;
+    int verbose = VERBOSE, block_end = BLOCK_END, exits;
+    uint32_t i;
+    
+    VERBOSE = FALSE;
+    CYCLE_COUNT = start_cycle;
+    for (i = 0; i < block->length; i++) {
+        handle_instruction();
+        CURRENT_STATE = NEXT_STATE;
+        CYCLE_COUNT++;
+    }
+    exits = (CURRENT_STATE.PC != block->start);
+    
+    CURRENT_STATE = current;
+    NEXT_STATE = next;
+    CYCLE_COUNT = cycles;
+    RETIRED = retired;
+    VERBOSE = verbose;
+    BLOCK_END = block_end;
+    return exits;
+}
+
+/**************************************************************/
+/* A block has just branched back to itself: if it is an idle or     */
+/* polling loop, account for the iterations up to the next event    */
+/* (timer interrupt, interval end) or up to the one that leaves the */
+/* loop, without interpreting them -- and within a run n's budget     */
+/**************************************************************/
+void spin_check(block_t *block, uint32_t length) {
+    uint64_t limit = SPIN_MAX_SKIP, iterations, lo, hi, mid;
+    uint32_t status = CURRENT_STATE.CP0[CP0_STATUS];
+    int bounded = FALSE;
+    
+    if (block->spin == SPIN_UNKNOWN) {
+        block->spin = spin_classify(block);
+    }
+    if (DEVICE_READ) {
+        /* device registers may change or have read side effects */
+        DEVICE_READ = FALSE;
+        return;
+    }
+    if (block->spin == SPIN_NO || length != block->length) {
+        return;
+    }
+    
+    if ((status & STATUS_IE) && !(status & (STATUS_EXL | STATUS_ERL)) && (status & STATUS_IM7)) {
+        if (TIMER_EVENT_CYCLE <= CYCLE_COUNT) {
+            return;
+        }
+        if (TIMER_EVENT_CYCLE - CYCLE_COUNT < limit) {
+            limit = TIMER_EVENT_CYCLE - CYCLE_COUNT;
+        }
+        bounded = TRUE;
+    }
+    if (INTERVAL_END != ~0ULL) {
+        if (INTERVAL_END <= INSTRUCTION_COUNT) {
+            return;
+        }
+        if (INTERVAL_END - INSTRUCTION_COUNT < limit) {
+            limit = INTERVAL_END - INSTRUCTION_COUNT;
+        }
+        bounded = TRUE;
+    }
+    /* first iteration boundary at or past the limit */
+    iterations = (limit + length - 1) / length;
+    
+    if (RUN_END <= INSTRUCTION_COUNT) {
+        return;
+    }
+    
+    if (block->spin == SPIN_PURE) {
+        /* only a run to completion stops; a run n just uses up its budget */
+        if (!bounded && RUN_END == ~0ULL) {
+            printf("Program is spinning at 0x%08x with no event pending; stopping.\n", block->start);
+            SPIN_STUCK = TRUE;
+            RUN_FLAG = FALSE;
+            return;
+        }
+    }
+    else if (spin_exits(block, CYCLE_COUNT + (iterations - 1) * length)) {
+        /* smallest k whose iteration exits; skip the k - 1 before it */
+        lo = 1;
+        hi = iterations;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (spin_exits(block, CYCLE_COUNT + (mid - 1) * length)) {
+                hi = mid;
+            }
+            else {
+                lo = mid + 1;
+            }
+        }
+        iterations = lo - 1;
+    }
+    if (RUN_END != ~0ULL && iterations > (RUN_END - INSTRUCTION_COUNT) / length) {
+        /* whole iterations that fit; run() interprets the rest */
+        iterations = (RUN_END - INSTRUCTION_COUNT) / length;
+    }
+    if (iterations == 0) {
+        return;
+    }
+    
+    block->count += iterations;
+    block->taken += iterations;
+    if (BBV_FILE != NULL) {
+        bbv_count(block, iterations * length);
+    }
+    INSTRUCTION_COUNT += iterations * length;
+    CYCLE_COUNT += iterations * length;
+    SPIN_SKIPPED += iterations * length;
+}
+
+/**************************************************************/
+/* Read the lanes file (-V): one lane per line, each a list of     */
+/* "<reg>=<value>", "hi=<value>" or "lo=<value>" on top of the     */
+/* registers of the loaded program. Blank lines and # comments are  */
+/* skipped.                                                                             */
+/**************************************************************/
+int lockstep_load(const char *path) {
+    FILE *fp;
+    char *line = NULL, *token, *value;
+    size_t size = 0;
+    uint32_t lanes = 0, capacity = 0, r;
+    uint32_t (*inits)[MIPS_REGS + 2] = NULL;
+    
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        printf("Error: Can't open lanes file %s\n", path);
+        return -1;
+    }
+    while (getline(&line, &size, fp) != -1) {
+        token = strtok(line, " \t\r\n");
+        if (token == NULL || token[0] == '#') {
+            continue;
+        }
+        if (lanes == capacity) {
+            capacity = (capacity == 0) ? 1024 : 2 * capacity;
+            inits = realloc(inits, capacity * sizeof(*inits));
+        }
+        memcpy(inits[lanes], CURRENT_STATE.REGS, sizeof(CURRENT_STATE.REGS));
+        inits[lanes][MIPS_REGS] = CURRENT_STATE.HI;
+        inits[lanes][MIPS_REGS + 1] = CURRENT_STATE.LO;
+        for (; token != NULL && token[0] != '#'; token = strtok(NULL, " \t\r\n")) {
+            value = strchr(token, '=');
+            if (value == NULL) {
+                printf("Error: %s: expected <reg>=<value>, got \"%s\"\n", path, token);
+                return -1;
+            }
+            *value++ = '\0';
+            if (strcmp(token, "hi") == 0) {
+                r = MIPS_REGS;
+            }
+            else if (strcmp(token, "lo") == 0) {
+                r = MIPS_REGS + 1;
+            }
+            else {
+                r = (uint32_t)strtoul(token, NULL, 0);
+                if (r >= MIPS_REGS) {
+                    printf("Error: %s: no register %s\n", path, token);
+                    return -1;
+                }
+            }
+            inits[lanes][r] = (uint32_t)strtoul(value, NULL, 0);
+        }
+        lanes++;
+    }
+    free(line);
+    fclose(fp);
+    if (lanes == 0) {
+        printf("Error: no lanes in %s\n", path);
+        return -1;
+    }
+    lockstep_init(lanes, inits);
+    free(inits);
+    return 0;
+}
+
+/**************************************************************/
+/* Set up lanes starting at the loaded program's PC, lane i with the */
+/* registers (then HI, LO) in inits[i]                                      */
+/**************************************************************/
+void lockstep_init(uint32_t lanes, uint32_t (*inits)[MIPS_REGS + 2]) {
+    uint32_t lane, c, j, r;
+    
+    LOCKSTEP.lanes = lanes;
+    LOCKSTEP.running = lanes;
+    LOCKSTEP.chunks = (lanes + LOCKSTEP_WIDTH - 1) / LOCKSTEP_WIDTH;
+    for (r = 0; r < MIPS_REGS + 2; r++) {
+        LOCKSTEP.regs[r] = aligned_alloc(sizeof(lane_vec_t), LOCKSTEP.chunks * sizeof(lane_vec_t));
+    }
+    LOCKSTEP.pc = aligned_alloc(sizeof(lane_vec_t), LOCKSTEP.chunks * sizeof(lane_vec_t));
+    LOCKSTEP.count = aligned_alloc(sizeof(lane_vec_t), LOCKSTEP.chunks * sizeof(lane_vec_t));
+    LOCKSTEP.active = aligned_alloc(sizeof(lane_vec_t), LOCKSTEP.chunks * sizeof(lane_vec_t));
+    LOCKSTEP.mask = aligned_alloc(sizeof(lane_vec_t), LOCKSTEP.chunks * sizeof(lane_vec_t));
+    LOCKSTEP.live = malloc(LOCKSTEP.chunks * sizeof(uint32_t));
+    LOCKSTEP.status = calloc(LOCKSTEP.chunks * LOCKSTEP_WIDTH, sizeof(uint8_t));
+    LOCKSTEP.code = calloc(LOCKSTEP.chunks * LOCKSTEP_WIDTH, sizeof(uint32_t));
+    LOCKSTEP.overlay = calloc(LOCKSTEP.chunks * LOCKSTEP_WIDTH, sizeof(lane_overlay_t));
+    for (c = 0; c < LOCKSTEP.chunks; c++) {
+        for (j = 0; j < LOCKSTEP_WIDTH; j++) {
+            /* padding lanes copy lane 0 and never run */
+            lane = c * LOCKSTEP_WIDTH + j;
+            for (r = 0; r < MIPS_REGS + 2; r++) {
+                LOCKSTEP.regs[r][c][j] = inits[lane < lanes ? lane : 0][r];
+            }
+            LOCKSTEP.pc[c][j] = CURRENT_STATE.PC;
+            LOCKSTEP.count[c][j] = 0;
+            LOCKSTEP.active[c][j] = (lane < lanes) ? 0xFFFFFFFF : 0;
+            LOCKSTEP.mask[c][j] = 0;
+        }
+    }
+}
+
+/**************************************************************/
+/* Take a lane out of the run, leaving it at pc                           */
+/**************************************************************/
+void lane_stop(uint32_t lane, lane_status_t status, uint32_t pc, uint32_t code) {
+    uint32_t c = lane / LOCKSTEP_WIDTH, j = lane % LOCKSTEP_WIDTH;
+    
+    LOCKSTEP.status[lane] = status;
+    LOCKSTEP.code[lane] = code;
+    LOCKSTEP.pc[c][j] = pc;
+    LOCKSTEP.active[c][j] = 0;
+    LOCKSTEP.mask[c][j] = 0;
+    LOCKSTEP.running--;
+}
+
+/**************************************************************/
+/* Find a word in a lane's store overlay. With insert, a missing word */
+/* is added holding its contents in the loaded image.                    */
+/**************************************************************/
+uint32_t *lane_overlay_slot(lane_overlay_t *o, uint32_t word, int insert) {
+    uint32_t i, k, mask, old_size;
+    lane_word_t *old;
+    
+    if (insert && 2 * (o->used + 1) > o->size) {
+        /* grow and rehash at 50% load */
+        old = o->words;
+        old_size = o->size;
+        o->size = (o->size == 0) ? 64 : 2 * o->size;
+        o->words = malloc(o->size * sizeof(lane_word_t));
+        for (i = 0; i < o->size; i++) {
+            o->words[i].address = LANE_EMPTY;
+        }
+        for (k = 0; k < old_size; k++) {
+            if (old[k].address == LANE_EMPTY) {
+                continue;
+            }
+            i = ((old[k].address >> 2) * 2654435761u) & (o->size - 1);
+            while (o->words[i].address != LANE_EMPTY) {
+                i = (i + 1) & (o->size - 1);
+            }
+            o->words[i] = old[k];
+        }
+        free(old);
+    }
+    if (o->size == 0) {
+        return NULL;
+    }
+    
+    mask = o->size - 1;
+    i = ((word >> 2) * 2654435761u) & mask;
+    while (o->words[i].address != word) {
+        if (o->words[i].address == LANE_EMPTY) {
+            if (!insert) {
+                return NULL;
+            }
+            o->words[i].address = word;
+            o->words[i].value = mem_read_32(word);
+            o->used++;
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return &o->words[i].value;
+}
+
+/**************************************************************/
+/* Read a 32-bit word as seen by one lane                                  */
+/**************************************************************/
+uint32_t lane_read(uint32_t lane, uint32_t address) {
+    lane_overlay_t *o = &LOCKSTEP.overlay[lane];
+    uint32_t value = 0, byte, k, *slot;
+    
+    if (o->used == 0) {
+        return mem_read_32(address);
+    }
+    if ((address & 3) == 0) {
+        slot = lane_overlay_slot(o, address, FALSE);
+        return (slot != NULL) ? *slot : mem_read_32(address);
+    }
+    for (k = 0; k < 4; k++) {
+        slot = lane_overlay_slot(o, (address + k) & ~3u, FALSE);
+        byte = (slot != NULL) ? *slot >> (8 * ((address + k) & 3)) : mem_read_32(address + k);
+        value |= (byte & 0xFF) << (8 * k);
+    }
+    return value;
+}
+
+/**************************************************************/
+/* Write the low size bytes of value into a lane's overlay                */
+/**************************************************************/
+void lane_write(uint32_t lane, uint32_t address, uint32_t value, uint32_t size) {
+    lane_overlay_t *o = &LOCKSTEP.overlay[lane];
+    uint32_t k, shift, avail, *slot;
+    
+    if (mem_host_ptr(address, &avail) == NULL || avail < size) {
+        return;
+    }
+    if (DIFF_OUT != NULL) {
+        /* for diff_digest */
+        mem_mark_written(address, size);
+    }
+    if (size == 4 && (address & 3) == 0) {
+        *lane_overlay_slot(o, address, TRUE) = value;
+        return;
+    }
+    for (k = 0; k < size; k++) {
+        slot = lane_overlay_slot(o, (address + k) & ~3u, TRUE);
+        shift = 8 * ((address + k) & 3);
+        *slot = (*slot & ~(0xFFu << shift)) | (((value >> (8 * k)) & 0xFF) << shift);
+    }
+}
+
+/**************************************************************/
+/* Loads and stores for the masked lanes of chunk c, one lane at a   */
+/* time (same address arithmetic as handle_instruction)                      */
+/**************************************************************/
+void lockstep_memory(opcode_t op, uint32_t instruction, uint32_t pc, uint32_t c) {
+    uint32_t base = (instruction >> 21) & 0x1F, rt = (instruction >> 16) & 0x1F;
+    uint32_t immediate = instruction & 0x0000FFFF, address, value, lane, j;
+    
+    if ((immediate & 0x00008000) == 0x00008000) {
+        immediate |= 0xFFFF0000;
+    }
+    for (j = 0; j < LOCKSTEP_WIDTH; j++) {
+        if (!LOCKSTEP.mask[c][j]) {
+            continue;
+        }
+        lane = c * LOCKSTEP_WIDTH + j;
+        address = (LOCKSTEP.regs[base][c][j] + immediate) | 0x00010000;
+        if (PAGE_TABLE[address >> PAGE_SHIFT] & PAGE_DEVICE_MASK) {
+            lane_stop(lane, LANE_DEVICE, pc, address);
+            continue;
+        }
+        switch (op) {
+            case OP_LW:
+                LOCKSTEP.regs[rt][c][j] = lane_read(lane, address);
+                break;
+            case OP_LB:
+                value = lane_read(lane, address) & 0x000000FF;
+                LOCKSTEP.regs[rt][c][j] = (value & 0x00000080) ? value | 0xFFFFFF00 : value;
+                break;
+            case OP_LH:
+                value = lane_read(lane, address) & 0x0000FFFF;
+                LOCKSTEP.regs[rt][c][j] = (value & 0x00008000) ? value | 0xFFFF0000 : value;
+                break;
+            case OP_SW:
+                lane_write(lane, address, LOCKSTEP.regs[rt][c][j], 4);
+                break;
+            case OP_SH:
+                lane_write(lane, address, LOCKSTEP.regs[rt][c][j], 2);
+                break;
+            case OP_SB:
+                lane_write(lane, address, LOCKSTEP.regs[rt][c][j], 1);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**************************************************************/
+/* Run the block at pc for every lane in LOCKSTEP.mask (the chunks   */
+/* listed in LOCKSTEP.live). Mirrors handle_instruction, including   */
+/* its quirks, so each lane ends where the interpreter would.          */
+/**************************************************************/
+__attribute__((target_clones("avx512f", "avx2", "default")))
+void lockstep_block(uint32_t pc, uint32_t nlive) {
+    lane_vec_t **regs = LOCKSTEP.regs, *m = LOCKSTEP.mask, *s, *t, *d;
+    lane_vec_t v, q, r, neg, taken, npc;
+    uint32_t instruction, rs, rt, rd, sa, immediate, simm, offset, target, c, l, j, lane, issued = 0;
+    opcode_t op;
+    int done = FALSE;
+    
+    while (!done) {
+        instruction = mem_read_32(pc);
+        op = decode_opcode(instruction);
+        rs = FIELD_RS(instruction);
+        rt = FIELD_RT(instruction);
+        rd = FIELD_RD(instruction);
+        sa = FIELD_SA(instruction);
+        immediate = FIELD_IMM(instruction);
+        simm = FIELD_SIMM(instruction);
+        offset = FIELD_OFFSET(instruction);
+        target = FIELD_TARGET(pc, instruction);
+        s = regs[rs];
+        t = regs[rt];
+        d = regs[rd];
+        done = OPCODE_CLASS[op] == CLASS_BRANCH || OPCODE_CLASS[op] == CLASS_JUMP || op == OP_SYSCALL;
+        
+        for (l = 0; l < nlive; l++) {
+            c = LOCKSTEP.live[l];
+            npc = LANE_SPLAT(pc + 4);
+            switch (op) {
+                case OP_ADD: case OP_ADDU:
+                    LANE_SELECT(d[c], s[c] + t[c], m[c]);
+                    break;
+                case OP_SUB: case OP_SUBU:
+                    LANE_SELECT(d[c], s[c] - t[c], m[c]);
+                    break;
+                case OP_MULT: case OP_MULTU:
+                    v = s[c] * t[c];
+                    LANE_SELECT(regs[MIPS_REGS][c], v & 0xFFFF0000, m[c]);
+                    LANE_SELECT(regs[MIPS_REGS + 1][c], v & 0x0000FFFF, m[c]);
+                    break;
+                case OP_DIV: case OP_DIVU:
+                    /* divide by zero leaves HI and LO alone */
+                    v = (lane_vec_t)(t[c] == 0);
+                    q = s[c] / (t[c] - v);
+                    r = s[c] % (t[c] - v);
+                    LANE_SELECT(regs[MIPS_REGS][c], r, m[c] & ~v);
+                    LANE_SELECT(regs[MIPS_REGS + 1][c], q, m[c] & ~v);
+                    break;
+                case OP_AND:
+                    LANE_SELECT(d[c], s[c] & t[c], m[c]);
+                    break;
+                case OP_OR:
+                    LANE_SELECT(d[c], s[c] | t[c], m[c]);
+                    break;
+                case OP_XOR:
+                    LANE_SELECT(d[c], s[c] ^ t[c], m[c]);
+                    break;
+                case OP_NOR:
+                    LANE_SELECT(d[c], ~(s[c] ^ t[c]), m[c]);
+                    break;
+                case OP_SLT:
+                    LANE_SELECT(d[c], (lane_vec_t)(s[c] < t[c]) & 1, m[c]);
+                    break;
+                case OP_SLL:
+                    LANE_SELECT(d[c], t[c] << sa, m[c]);
+                    break;
+                case OP_SRL:
+                    LANE_SELECT(d[c], t[c] >> sa, m[c]);
+                    break;
+                case OP_SRA:
+                    neg = -(t[c] >> 31);
+                    if (sa > 0) {
+                        LANE_SELECT(d[c], (((t[c] >> 1) | 0x80000000) & neg) | ((t[c] >> sa) & ~neg), m[c]);
+                    }
+                    else {
+                        LANE_SELECT(d[c], t[c], m[c] & ~neg);
+                    }
+                    break;
+                case OP_MFHI:
+                    LANE_SELECT(d[c], regs[MIPS_REGS][c], m[c]);
+                    break;
+                case OP_MFLO:
+                    LANE_SELECT(d[c], regs[MIPS_REGS + 1][c], m[c]);
+                    break;
+                case OP_MTHI:
+                    LANE_SELECT(regs[MIPS_REGS][c], s[c], m[c]);
+                    break;
+                case OP_MTLO:
+                    LANE_SELECT(regs[MIPS_REGS + 1][c], s[c], m[c]);
+                    break;
+                case OP_JR:
+                    npc = s[c];
+                    break;
+                case OP_JALR:
+                    npc = s[c];
+                    LANE_SELECT(d[c], LANE_SPLAT(pc + 8), m[c]);
+                    break;
+                case OP_SYSCALL:
+                    for (j = 0; j < LOCKSTEP_WIDTH; j++) {
+                        if (!m[c][j]) {
+                            continue;
+                        }
+                        lane = c * LOCKSTEP_WIDTH + j;
+                        if (regs[2][c][j] == SYS_EXIT || regs[2][c][j] == SYS_EXIT2) {
+                            LOCKSTEP.count[c][j]++;
+                            lane_stop(lane, LANE_EXITED, pc + 4, regs[2][c][j] == SYS_EXIT2 ? regs[4][c][j] : 0);
+                        }
+                        else {
+                            lane_stop(lane, LANE_SYSCALL, pc, regs[2][c][j]);
+                        }
+                    }
+                    break;
+                case OP_LUI:
+                    LANE_SELECT(t[c], LANE_SPLAT(immediate << 16), m[c]);
+                    break;
+                case OP_ADDI: case OP_ADDIU:
+                    LANE_SELECT(t[c], s[c] + simm, m[c]);
+                    break;
+                case OP_LW: case OP_LB: case OP_LH: case OP_SW: case OP_SH: case OP_SB:
+                    lockstep_memory(op, instruction, pc, c);
+                    break;
+                case OP_ANDI:
+                    LANE_SELECT(t[c], t[c] & immediate, m[c]);
+                    break;
+                case OP_ORI:
+                    LANE_SELECT(t[c], t[c] | immediate, m[c]);
+                    break;
+                case OP_XORI:
+                    LANE_SELECT(t[c], t[c] ^ immediate, m[c]);
+                    break;
+                case OP_SLTI:
+                    LANE_SELECT(t[c], (lane_vec_t)(s[c] < simm) & 1, m[c]);
+                    break;
+                case OP_J:
+                    npc = LANE_SPLAT(target);
+                    break;
+                case OP_JAL:
+                    LANE_SELECT(regs[31][c], LANE_SPLAT(pc + 8), m[c]);
+                    npc = LANE_SPLAT(target);
+                    break;
+                case OP_BEQ: case OP_BNE: case OP_BLEZ: case OP_BGTZ: case OP_BLTZ: case OP_BGEZ:
+                    neg = -(s[c] >> 31);
+                    if (op == OP_BEQ) {
+                        taken = (lane_vec_t)(s[c] == t[c]);
+                    }
+                    else if (op == OP_BNE) {
+                        taken = (lane_vec_t)(s[c] != t[c]);
+                    }
+                    else if (op == OP_BLEZ) {
+                        taken = (lane_vec_t)(s[c] == 0) | neg;
+                    }
+                    else if (op == OP_BGTZ) {
+                        taken = ~((lane_vec_t)(s[c] == 0) | neg);
+                    }
+                    else if (op == OP_BGEZ) {
+                        taken = ~neg;
+                    }
+                    else {
+                        taken = neg;
+                    }
+                    LANE_SELECT(npc, LANE_SPLAT(pc + offset), taken);
+                    break;
+                default:
+                    /* CP0 accesses and unknown instructions (which stop the interpreter) */
+                    for (j = 0; j < LOCKSTEP_WIDTH; j++) {
+                        if (m[c][j]) {
+                            lane_stop(c * LOCKSTEP_WIDTH + j, (instruction >> 26) == 0x10 ? LANE_CP0 : LANE_ILLEGAL, pc, instruction);
+                        }
+                    }
+                    break;
+            }
+            LOCKSTEP.count[c] -= m[c];
+            if (done || issued + 1 == LOCKSTEP_MAX_BLOCK) {
+                LANE_SELECT(LOCKSTEP.pc[c], npc, m[c]);
+            }
+        }
+        LOCKSTEP.issued++;
+        issued++;
+        pc += 4;
+        if (issued == LOCKSTEP_MAX_BLOCK) {
+            break;
+        }
+    }
+}
+
+/**************************************************************/
+/* Run every lane to completion (-V) and print their final state       */
+/**************************************************************/
+void lockstep_run() {
+    lane_vec_t v, low, lower;
+    uint32_t c, j, r, lane, pc, nlive;
+    uint64_t executed = 0, blocks = 0, statuses[NUM_LANE_STATUS] = {0};
+    int any;
+    
+    printf("Running %u lanes in lockstep (%d per vector)...\n\n", LOCKSTEP.lanes, LOCKSTEP_WIDTH);
+    host_stats_start(0);
+    while (LOCKSTEP.running > 0) {
+        /* lanes past the limit stop where they are; the rest meet at the lowest PC */
+        low = LANE_SPLAT(0xFFFFFFFF);
+        for (c = 0; c < LOCKSTEP.chunks; c++) {
+            v = LOCKSTEP.active[c] & (lane_vec_t)(LOCKSTEP.count[c] >= LOCKSTEP_LIMIT);
+            for (j = 0; j < LOCKSTEP_WIDTH; j++) {
+                if (v[j]) {
+                    lane_stop(c * LOCKSTEP_WIDTH + j, LANE_LIMIT, LOCKSTEP.pc[c][j], 0);
+                }
+            }
+            v = LOCKSTEP.pc[c] | ~LOCKSTEP.active[c];
+            lower = (lane_vec_t)(v < low);
+            LANE_SELECT(low, v, lower);
+        }
+        if (LOCKSTEP.running == 0) {
+            break;
+        }
+        pc = 0xFFFFFFFF;
+        for (j = 0; j < LOCKSTEP_WIDTH; j++) {
+            pc = (low[j] < pc) ? low[j] : pc;
+        }
+        nlive = 0;
+        for (c = 0; c < LOCKSTEP.chunks; c++) {
+            LOCKSTEP.mask[c] = LOCKSTEP.active[c] & (lane_vec_t)(LOCKSTEP.pc[c] == pc);
+            for (j = 0, any = FALSE; j < LOCKSTEP_WIDTH; j++) {
+                any |= (LOCKSTEP.mask[c][j] != 0);
+            }
+            if (any) {
+                LOCKSTEP.live[nlive++] = c;
+            }
+        }
+        lockstep_block(pc, nlive);
+        blocks++;
+        if (DIFF_OUT != NULL) {
+            diff_emit(FALSE);
+        }
+    }
+    
+    printf("lane,status,code,instructions,pc");
+    for (r = 0; r < MIPS_REGS; r++) {
+        printf(",r%u", r);
+    }
+    printf(",hi,lo\n");
+    for (lane = 0; lane < LOCKSTEP.lanes; lane++) {
+        c = lane / LOCKSTEP_WIDTH;
+        j = lane % LOCKSTEP_WIDTH;
+        printf("%u,%s,0x%x,%u,0x%08x", lane, LANE_STATUS_NAMES[LOCKSTEP.status[lane]], LOCKSTEP.code[lane],
+               LOCKSTEP.count[c][j], LOCKSTEP.pc[c][j]);
+        for (r = 0; r < MIPS_REGS + 2; r++) {
+            printf(",0x%08x", LOCKSTEP.regs[r][c][j]);
+        }
+        printf("\n");
+        executed += LOCKSTEP.count[c][j];
+        statuses[LOCKSTEP.status[lane]]++;
+    }
+    host_stats_stop(ENGINE_LOCKSTEP, executed);
+    
+    printf("\n%u lanes:", LOCKSTEP.lanes);
+    for (r = 0; r < NUM_LANE_STATUS; r++) {
+        if (statuses[r] > 0) {
+            printf(" %llu %s", (unsigned long long)statuses[r], LANE_STATUS_NAMES[r]);
+        }
+    }
+    printf("\n%llu instructions in %llu vector issues over %llu blocks (%.1f lanes per issue)\n",
+           (unsigned long long)executed, (unsigned long long)LOCKSTEP.issued, (unsigned long long)blocks,
+           LOCKSTEP.issued ? (double)executed / LOCKSTEP.issued : 0.0);
+}
+
+/**************************************************************/
+/* xorshift64 generator for the mutator                                 */
+/**************************************************************/
+uint64_t fuzz_rand() {
+    FUZZ_RNG ^= FUZZ_RNG << 13;
+    FUZZ_RNG ^= FUZZ_RNG >> 7;
+    FUZZ_RNG ^= FUZZ_RNG << 17;
+    return FUZZ_RNG;
+}
+
+/**************************************************************/
+/* Keep the loaded program's pages and CPU state to restore before   */
+/* every run, and start listing pages as they are dirtied                 */
+/**************************************************************/
+void fuzz_snapshot() {
+    uint32_t page, i;
+    uint8_t *mem;
+    
+    FUZZ_SNAPSHOT = calloc(NUM_PAGES, sizeof(uint8_t *));
+    for (page = 0; page < NUM_PAGES; page++) {
+        PAGE_TABLE[page] &= ~PAGE_DIRTY;
+        if (!(PAGE_TABLE[page] & PAGE_WRITTEN) || (PAGE_TABLE[page] & PAGE_DEVICE_MASK)) {
+            continue;
+        }
+        mem = mem_host_ptr(page << PAGE_SHIFT, NULL);
+        if (mem != NULL) {
+            FUZZ_SNAPSHOT[page] = malloc(PAGE_SIZE);
+            memcpy(FUZZ_SNAPSHOT[page], mem, PAGE_SIZE);
+        }
+    }
+    DIRTY_PAGES = malloc(NUM_PAGES * sizeof(uint32_t));
+    NUM_DIRTY_PAGES = 0;
+    FUZZ_STATE = CURRENT_STATE;
+    FUZZ_HEAP_BREAK = HEAP_BREAK;
+    FUZZ_TRACE = calloc(FUZZ_MAP_SIZE, 1);
+    memset(FUZZ_VIRGIN, 0xFF, sizeof(FUZZ_VIRGIN));
+    /* AFL's buckets: 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+ */
+    for (i = 1; i < 256; i++) {
+        FUZZ_BUCKETS[i] = (i <= 3) ? 1 << (i - 1) : (i < 8) ? 8 : (i < 16) ? 16 : (i < 32) ? 32 : (i < 128) ? 64 : 128;
+    }
+}
+
+/**************************************************************/
+/* Put memory and CPU back as they were after loading, touching only */
+/* the pages written since the last restore                                   */
+/**************************************************************/
+void fuzz_restore() {
+    uint32_t i, page;
+    uint8_t *mem;
+    
+    for (i = 0; i < NUM_DIRTY_PAGES; i++) {
+        page = DIRTY_PAGES[i];
+        PAGE_TABLE[page] &= ~PAGE_DIRTY;
+        mem = mem_host_ptr(page << PAGE_SHIFT, NULL);
+        if (mem == NULL) {
+            continue;
+        }
+        if (FUZZ_SNAPSHOT[page] != NULL) {
+            memcpy(mem, FUZZ_SNAPSHOT[page], PAGE_SIZE);
+        }
+        else {
+            memset(mem, 0, PAGE_SIZE);
+        }
+    }
+    NUM_DIRTY_PAGES = 0;
+    
+    /* guest output is dropped; files the program opened are closed */
+    for (i = 0; i < SYSCALL_FDS; i++) {
+        GUEST_FDS[i].out_len = 0;
+        GUEST_FDS[i].in_pos = GUEST_FDS[i].in_len = 0;
+        if (GUEST_FDS[i].owned) {
+            close(GUEST_FDS[i].host_fd);
+            GUEST_FDS[i].host_fd = -1;
+            GUEST_FDS[i].owned = FALSE;
+        }
+    }
+    HEAP_BREAK = FUZZ_HEAP_BREAK;
+    EXIT_CODE = 0;
+    GUEST_EXITED = FALSE;
+    SPIN_STUCK = FALSE;
+    
+    CURRENT_STATE = FUZZ_STATE;
+    memset(PMC, 0, sizeof(PMC));
+    INSTRUCTION_COUNT = 0;
+    CYCLE_COUNT = 0;
+    COUNT_BASE = 0;
+    BLOCK_START_PC = CURRENT_STATE.PC;
+    BLOCK_START_COUNT = 0;
+    RUN_FLAG = TRUE;
+}
+
+/**************************************************************/
+/* Run the program once on an input and classify how it ended          */
+/**************************************************************/
+fuzz_result_t fuzz_exec(const uint8_t *data, uint32_t len) {
+    fuzz_restore();
+    memcpy(mem_host_ptr(FUZZ_INPUT_BASE, NULL), data, len);
+    mem_mark_written(FUZZ_INPUT_BASE, len);
+    CURRENT_STATE.REGS[4] = FUZZ_INPUT_BASE;
+    CURRENT_STATE.REGS[5] = len;
+    NEXT_STATE = CURRENT_STATE;
+    schedule_timer();
+    memset(FUZZ_TRACE, 0, FUZZ_MAP_SIZE);
+    
+    while (RUN_FLAG && INSTRUCTION_COUNT < FUZZ_BUDGET) {
+        run_block();
+    }
+    FUZZ_EXECS++;
+    if (RUN_FLAG || SPIN_STUCK) {
+        return FUZZ_HANG;
+    }
+    if (!GUEST_EXITED || EXIT_CODE != 0) {
+        return FUZZ_CRASH;
+    }
+    return FUZZ_OK;
+}
+
+/**************************************************************/
+/* Bucket the hit counts of the last run; does it show anything not  */
+/* yet seen for this kind of outcome? (records it if so)                  */
+/**************************************************************/
+int fuzz_novel(fuzz_result_t kind) {
+    uint64_t *trace = (uint64_t *)FUZZ_TRACE;
+    uint8_t *virgin = FUZZ_VIRGIN[kind];
+    uint32_t i, k;
+    int novel = FALSE;
+    
+    for (i = 0; i < FUZZ_MAP_SIZE / 8; i++) {
+        if (trace[i] == 0) {
+            continue;
+        }
+        for (k = 8 * i; k < 8 * i + 8; k++) {
+            FUZZ_TRACE[k] = FUZZ_BUCKETS[FUZZ_TRACE[k]];
+            if (FUZZ_TRACE[k] & virgin[k]) {
+                virgin[k] &= ~FUZZ_TRACE[k];
+                novel = TRUE;
+            }
+        }
+    }
+    return novel;
+}
+
+/**************************************************************/
+/* Write an input into the corpus directory, or its crashes/ or    */
+/* hangs/ subdirectory                                                               */
+/**************************************************************/
+void fuzz_save(fuzz_result_t kind, const uint8_t *data, uint32_t len) {
+    static const char *dirs[3] = { "", "crashes/", "hangs/" };
+    char path[256];
+    FILE *fp;
+    
+    snprintf(path, sizeof(path), "%s/%sid_%06llu", fuzz_dir, dirs[kind], (unsigned long long)FUZZ_SAVED[kind]++);
+    fp = fopen(path, "wb");
+    if (fp == NULL) {
+        return;
+    }
+    fwrite(data, 1, len, fp);
+    fclose(fp);
+}
+
+/**************************************************************/
+/* Add a copy of an input to the queue                                        */
+/**************************************************************/
+void fuzz_enqueue(const uint8_t *data, uint32_t len) {
+    if (FUZZ_QUEUE_LEN == FUZZ_QUEUE_SIZE) {
+        FUZZ_QUEUE_SIZE = (FUZZ_QUEUE_SIZE == 0) ? 64 : 2 * FUZZ_QUEUE_SIZE;
+        FUZZ_QUEUE = realloc(FUZZ_QUEUE, FUZZ_QUEUE_SIZE * sizeof(fuzz_input_t));
+    }
+    FUZZ_QUEUE[FUZZ_QUEUE_LEN].data = malloc(len > 0 ? len : 1);
+    memcpy(FUZZ_QUEUE[FUZZ_QUEUE_LEN].data, data, len);
+    FUZZ_QUEUE[FUZZ_QUEUE_LEN].len = len;
+    FUZZ_QUEUE_LEN++;
+}
+
+/**************************************************************/
+/* Havoc: stack a few random edits (bit flips, random and boundary  */
+/* values, small arithmetic, block deletes/copies, splices from other */
+/* queue entries). buf holds FUZZ_MAX_INPUT bytes; returns the new   */
+/* length.                                                                                  */
+/**************************************************************/
+uint32_t fuzz_mutate(uint8_t *buf, uint32_t len) {
+    static const int32_t interesting[] = { -128, -1, 0, 1, 16, 32, 64, 100, 127, 255, 256, 512, 1000, 1024, 4096, 32767, 65535, -32768, 0x7FFFFFFF, (int32_t)0x80000000 };
+    fuzz_input_t *other;
+    uint32_t n, i, pos, from, size, value, width;
+    
+    n = 1 + fuzz_rand() % FUZZ_HAVOC_STACK;
+    for (i = 0; i < n; i++) {
+        if (len == 0) {
+            buf[len++] = fuzz_rand();
+            continue;
+        }
+        pos = fuzz_rand() % len;
+        switch (fuzz_rand() % 8) {
+            case 0:
+                buf[pos] ^= 1 << (fuzz_rand() % 8);
+                break;
+            case 1:
+                buf[pos] = fuzz_rand();
+                break;
+            case 2:
+                /* boundary value, 1, 2 or 4 bytes little-endian */
+                value = interesting[fuzz_rand() % (sizeof(interesting) / sizeof(interesting[0]))];
+                width = 1 << (fuzz_rand() % 3);
+                for (from = 0; from < width && pos + from < len; from++) {
+                    buf[pos + from] = value >> (8 * from);
+                }
+                break;
+            case 3:
+                buf[pos] += 1 + fuzz_rand() % 35;
+                break;
+            case 4:
+                buf[pos] -= 1 + fuzz_rand() % 35;
+                break;
+            case 5:
+                /* delete a block */
+                size = 1 + fuzz_rand() % (len - pos);
+                memmove(buf + pos, buf + pos + size, len - pos - size);
+                len -= size;
+                break;
+            case 6:
+                /* copy a block of this input over another spot, or insert it */
+                from = fuzz_rand() % len;
+                size = 1 + fuzz_rand() % (len - from);
+                if (fuzz_rand() & 1) {
+                    size = (size > len - pos) ? len - pos : size;
+                    memmove(buf + pos, buf + from, size);
+                }
+                else if (len + size <= FUZZ_MAX_INPUT) {
+                    memmove(buf + pos + size, buf + pos, len - pos);
+                    memmove(buf + pos, buf + (from >= pos ? from + size : from), size);
+                    len += size;
+                }
+                break;
+            case 7:
+                /* splice in the tail of another queue entry */
+                other = &FUZZ_QUEUE[fuzz_rand() % FUZZ_QUEUE_LEN];
+                if (other->len > 0) {
+                    from = fuzz_rand() % other->len;
+                    size = other->len - from;
+                    size = (pos + size > FUZZ_MAX_INPUT) ? FUZZ_MAX_INPUT - pos : size;
+                    memcpy(buf + pos, other->data + from, size);
+                    len = pos + size;
+                }
+                break;
+        }
+    }
+    return len;
+}
+
+/**************************************************************/
+/* Queue every regular file in the corpus directory                       */
+/**************************************************************/
+void fuzz_load_corpus() {
+    DIR *dir;
+    struct dirent *entry;
+    struct stat st;
+    char path[512];
+    uint8_t *data;
+    FILE *fp;
+    uint32_t len;
+    
+    dir = opendir(fuzz_dir);
+    if (dir == NULL) {
+        printf("Error: Can't open corpus directory %s\n", fuzz_dir);
+        exit(-1);
+    }
+    data = malloc(FUZZ_MAX_INPUT);
+    while ((entry = readdir(dir)) != NULL) {
+        snprintf(path, sizeof(path), "%s/%s", fuzz_dir, entry->d_name);
+        if (entry->d_name[0] == '.' || stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        fp = fopen(path, "rb");
+        if (fp == NULL) {
+            continue;
+        }
+        len = fread(data, 1, FUZZ_MAX_INPUT, fp);
+        fclose(fp);
+        fuzz_enqueue(data, len);
+        /* saved ids continue after the existing ones */
+        if (strncmp(entry->d_name, "id_", 3) == 0 && strtoull(entry->d_name + 3, NULL, 10) >= FUZZ_SAVED[FUZZ_OK]) {
+            FUZZ_SAVED[FUZZ_OK] = strtoull(entry->d_name + 3, NULL, 10) + 1;
+        }
+    }
+    closedir(dir);
+    free(data);
+    if (FUZZ_QUEUE_LEN == 0) {
+        /* no seeds: start from a single zero byte */
+        fuzz_enqueue((const uint8_t *)"", 1);
+    }
+    snprintf(path, sizeof(path), "%s/crashes", fuzz_dir);
+    mkdir(path, 0777);
+    snprintf(path, sizeof(path), "%s/hangs", fuzz_dir);
+    mkdir(path, 0777);
+}
+
+/**************************************************************/
+/* SIGINT/SIGTERM: finish the current run and report                     */
+/**************************************************************/
+void fuzz_interrupt(int sig) {
+    (void)sig;
+    FUZZ_STOP = TRUE;
+}
+
+/**************************************************************/
+/* One status line                                                                     */
+/**************************************************************/
+void fuzz_status(const char *event) {
+    static struct timespec start;
+    struct timespec now;
+    double elapsed;
+    uint32_t i, edges = 0;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (start.tv_sec == 0 && start.tv_nsec == 0) {
+        start = now;
+    }
+    elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+    for (i = 0; i < FUZZ_MAP_SIZE; i++) {
+        edges += (FUZZ_VIRGIN[FUZZ_OK][i] != 0xFF);
+    }
+    fprintf(FUZZ_LOG, "[%7.1fs] %-8s execs %llu (%.0f/s)  corpus %u  edges %u  crashes %llu  hangs %llu\n",
+            elapsed, event, (unsigned long long)FUZZ_EXECS, elapsed > 0 ? FUZZ_EXECS / elapsed : 0.0, FUZZ_QUEUE_LEN,
+            edges, (unsigned long long)FUZZ_SAVED[FUZZ_CRASH], (unsigned long long)FUZZ_SAVED[FUZZ_HANG]);
+    fflush(FUZZ_LOG);
+}
+
+/**************************************************************/
+/* Fuzz until interrupted: run the seeds, then keep mutating queue   */
+/* entries round robin, queueing inputs that find new coverage          */
+/**************************************************************/
+void fuzz_run() {
+    uint8_t *buf;
+    uint32_t entry, round, len, seeds;
+    fuzz_result_t result;
+    int devnull;
+    
+    fuzz_load_corpus();
+    seeds = FUZZ_QUEUE_LEN;
+    
+    /* the program's own output (and input) goes nowhere while fuzzing */
+    fflush(stdout);
+    FUZZ_LOG = fdopen(dup(STDOUT_FILENO), "w");
+    devnull = open("/dev/null", O_RDWR);
+    dup2(devnull, STDIN_FILENO);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+    signal(SIGINT, fuzz_interrupt);
+    signal(SIGTERM, fuzz_interrupt);
+    
+    fuzz_snapshot();
+    fuzz_status("start");
+    buf = malloc(FUZZ_MAX_INPUT);
+    for (entry = 0; entry < seeds; entry++) {
+        result = fuzz_exec(FUZZ_QUEUE[entry].data, FUZZ_QUEUE[entry].len);
+        if (fuzz_novel(result) && result != FUZZ_OK) {
+            fuzz_save(result, FUZZ_QUEUE[entry].data, FUZZ_QUEUE[entry].len);
+        }
+    }
+    
+    for (entry = 0; !FUZZ_STOP; entry = (entry + 1) % FUZZ_QUEUE_LEN) {
+        for (round = 0; round < FUZZ_HAVOC_ROUNDS && !FUZZ_STOP; round++) {
+            len = FUZZ_QUEUE[entry].len;
+            memcpy(buf, FUZZ_QUEUE[entry].data, len);
+            len = fuzz_mutate(buf, len);
+            result = fuzz_exec(buf, len);
+            if (result == FUZZ_OK) {
+                if (fuzz_novel(FUZZ_OK)) {
+                    fuzz_enqueue(buf, len);
+                    fuzz_save(FUZZ_OK, buf, len);
+                    fuzz_status("new");
+                }
+            }
+            else if (fuzz_novel(result)) {
+                fuzz_save(result, buf, len);
+                fuzz_status(result == FUZZ_CRASH ? "crash" : "hang");
+            }
+            if ((FUZZ_EXECS & 0xFFFF) == 0) {
+                fuzz_status("pulse");
+            }
+        }
+    }
+    fuzz_status("stop");
+    free(buf);
+}
+
+/**************************************************************/
+/* qsort comparator for page numbers                                      */
+/**************************************************************/
+int compare_pages(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**************************************************************/
+/* Digest of the written pages that are not all zero, as seen by the */
+/* scalar engines (lane < 0) or by one lockstep lane, whose stores    */
+/* are in its overlay rather than in memory. Only the pages written   */
+/* since the last call (DIRTY_PAGES) are hashed again.                   */
+/**************************************************************/
+uint64_t diff_digest(int lane) {
+    uint32_t i, k, page, value;
+    uint64_t h;
+    uint8_t *p;
+    int zero;
+    
+    if (DIFF_PAGE_HASH == NULL) {
+        DIFF_PAGE_HASH = calloc(NUM_PAGES, sizeof(uint64_t));
+    }
+    for (i = 0; i < NUM_DIRTY_PAGES; i++) {
+        page = DIRTY_PAGES[i];
+        PAGE_TABLE[page] &= ~PAGE_DIRTY;
+        if (PAGE_TABLE[page] & PAGE_DEVICE_MASK) {
+            continue;
+        }
+        p = (lane < 0) ? mem_host_ptr(page << PAGE_SHIFT, NULL) : NULL;
+        /* FNV-1a over the words, summed so the page order does not matter */
+        h = 0xCBF29CE484222325ULL ^ page;
+        zero = TRUE;
+        for (k = 0; k < PAGE_SIZE; k += 4) {
+            if (lane >= 0) {
+                value = lane_read(lane, (page << PAGE_SHIFT) + k);
+            }
+            else if (p != NULL) {
+                value = p[k] | (p[k + 1] << 8) | (p[k + 2] << 16) | ((uint32_t)p[k + 3] << 24);
+            }
+            else {
+                value = 0;
+            }
+            zero &= (value == 0);
+            h = (h ^ value) * 0x100000001B3ULL;
+        }
+        h = zero ? 0 : h;
+        DIFF_DIGEST += h - DIFF_PAGE_HASH[page];
+        DIFF_PAGE_HASH[page] = h;
+    }
+    NUM_DIRTY_PAGES = 0;
+    return DIFF_DIGEST;
+}
+
+/**************************************************************/
+/* Send the state after a block (or, with done, the final state) to */
+/* the differential tester                                                      */
+/**************************************************************/
+void diff_emit(int done) {
+    diff_record_t record;
+    uint32_t r;
+    
+    memset(&record, 0, sizeof(record));
+    record.done = done;
+    if (LOCKSTEP.lanes > 0) {
+        /* the lockstep engine runs a single lane */
+        record.count = LOCKSTEP.count[0][0];
+        record.pc = LOCKSTEP.pc[0][0];
+        for (r = 0; r < MIPS_REGS + 2; r++) {
+            record.regs[r] = LOCKSTEP.regs[r][0][0];
+        }
+        record.status = LOCKSTEP.status[0];
+        record.digest = diff_digest(0);
+    }
+    else {
+        record.count = INSTRUCTION_COUNT;
+        record.pc = CURRENT_STATE.PC;
+        memcpy(record.regs, CURRENT_STATE.REGS, sizeof(CURRENT_STATE.REGS));
+        record.regs[MIPS_REGS] = CURRENT_STATE.HI;
+        record.regs[MIPS_REGS + 1] = CURRENT_STATE.LO;
+        record.status = (RUN_FLAG || SPIN_STUCK) ? LANE_LIMIT : LANE_EXITED;
+        record.digest = diff_digest(-1);
+    }
+    fwrite(&record, sizeof(record), 1, DIFF_OUT);
+}
+
+/**************************************************************/
+/* Engine process: run the loaded program on one engine, streaming */
+/* a record per block to fd                                                     */
+/**************************************************************/
+void diff_engine(engine_t engine, int fd) {
+    uint32_t inits[1][MIPS_REGS + 2];
+    int null_fd;
+    
+    null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    DIFF_OUT = fdopen(fd, "w");
+    
+    HLE_ENABLED = (engine == ENGINE_FAST);
+    SPIN_FF = (engine == ENGINE_FAST);
+    if (engine == ENGINE_LOCKSTEP) {
+        memcpy(inits[0], CURRENT_STATE.REGS, sizeof(CURRENT_STATE.REGS));
+        inits[0][MIPS_REGS] = CURRENT_STATE.HI;
+        inits[0][MIPS_REGS + 1] = CURRENT_STATE.LO;
+        lockstep_init(1, inits);
+        lockstep_run();
+    }
+    else {
+        while (RUN_FLAG && INSTRUCTION_COUNT < LOCKSTEP_LIMIT) {
+            run_block();
+        }
+        flush_guest_output();
+    }
+    diff_emit(TRUE);
+    fclose(DIFF_OUT);
+    _exit(0);
+}
+
+/**************************************************************/
+/* Same PC, registers and memory?                                           */
+/**************************************************************/
+int diff_same(const diff_record_t *a, const diff_record_t *b) {
+    return a->pc == b->pc && a->digest == b->digest && memcmp(a->regs, b->regs, sizeof(a->regs)) == 0;
+}
+
+/**************************************************************/
+/* Print what the engines disagree on, then replay the stretch since */
+/* the last agreement on the interpreter, marking the first            */
+/* instruction that writes a differing register (or memory, or the    */
+/* first branch if only the PC differs)                                   */
+/**************************************************************/
+void diff_report(diff_record_t *cur, int *active, uint64_t agreed) {
+    diff_record_t *ref = &cur[ENGINE_INTERPRETER];
+    uint64_t differing = 0, reads, writes, end = 0;
+    uint32_t r, addr, instruction, n = 0, mark = 0;
+    int e, memory = FALSE, hit, found = FALSE;
+    char text[64], marked[64] = "";
+    opcode_t op;
+    
+    printf("%-8s", "");
+    for (e = 0; e < NUM_ENGINES; e++) {
+        if (active[e]) {
+            printf("  %-18s", ENGINE_NAMES[e]);
+        }
+    }
+    printf("\n%-8s", "count");
+    for (e = 0; e < NUM_ENGINES; e++) {
+        if (active[e]) {
+            printf("  %-18llu", (unsigned long long)cur[e].count);
+            end = (cur[e].count > end) ? cur[e].count : end;
+        }
+    }
+    printf("\n%-8s", "pc");
+    for (e = 0; e < NUM_ENGINES; e++) {
+        if (active[e]) {
+            printf("  0x%08x        ", cur[e].pc);
+        }
+    }
+    printf("\n");
+    for (r = 0; r < MIPS_REGS + 2; r++) {
+        for (e = 0; e < NUM_ENGINES; e++) {
+            if (active[e] && cur[e].regs[r] != ref->regs[r]) {
+                differing |= 1ULL << r;
+            }
+        }
+        if (!(differing & (1ULL << r))) {
+            continue;
+        }
+        snprintf(text, sizeof(text), r == MIPS_REGS ? "hi" : r == MIPS_REGS + 1 ? "lo" : "$%u", r);
+        printf("%-8s", text);
+        for (e = 0; e < NUM_ENGINES; e++) {
+            if (active[e]) {
+                printf("  0x%08x        ", cur[e].regs[r]);
+            }
+        }
+        printf("\n");
+    }
+    for (e = 0; e < NUM_ENGINES; e++) {
+        memory |= active[e] && cur[e].digest != ref->digest;
+    }
+    if (memory) {
+        printf("%-8s", "memory");
+        for (e = 0; e < NUM_ENGINES; e++) {
+            if (active[e]) {
+                printf("  %016llx  ", (unsigned long long)cur[e].digest);
+            }
+        }
+        printf("\n");
+    }
+    
+    /* the interpreter is deterministic: rerun it here up to the last agreement */
+    HLE_ENABLED = FALSE;
+    SPIN_FF = FALSE;
+    while (RUN_FLAG && INSTRUCTION_COUNT < agreed) {
+        run_block();
+    }
+    printf("\nInstructions %llu..%llu on the interpreter:\n", (unsigned long long)agreed, (unsigned long long)end);
+    while (RUN_FLAG && INSTRUCTION_COUNT < end) {
+        addr = CURRENT_STATE.PC;
+        instruction = mem_read_32(addr);
+        op = decode_opcode(instruction);
+        disassemble(addr, text, sizeof(text));
+        hit = FALSE;
+        if (!found) {
+            if (differing != 0) {
+                hit = (instruction_regs(instruction, &reads, &writes) && (writes & differing))
+                    || (op == OP_JAL && (differing & (1ULL << 31)));
+            }
+            else if (memory) {
+                hit = OPCODE_CLASS[op] == CLASS_STORE;
+            }
+            else {
+                hit = OPCODE_CLASS[op] == CLASS_BRANCH || OPCODE_CLASS[op] == CLASS_JUMP;
+            }
+        }
+        if (hit) {
+            found = TRUE;
+            mark = addr;
+            memcpy(marked, text, sizeof(marked));
+        }
+        if (n < DIFF_MAX_LISTING || hit) {
+            printf("%c %-10llu 0x%08x  %s\n", hit ? '>' : ' ', (unsigned long long)INSTRUCTION_COUNT, addr, text);
+        }
+        else if (n == DIFF_MAX_LISTING) {
+            printf("  ...\n");
+        }
+        n++;
+        BLOCK_END = FALSE;
+        cycle();
+        if (BLOCK_END) {
+            end_block();
+        }
+    }
+    if (found) {
+        printf("\nFirst divergent instruction: 0x%08x  %s\n", mark, marked);
+    }
+    else {
+        printf("\nNo instruction in this stretch explains the difference; an engine ran a different path.\n");
+    }
+}
+
+/**************************************************************/
+/* Run the loaded program on every engine in parallel and compare  */
+/* their state block by block (-X). Returns 0 if they all agree.       */
+/**************************************************************/
+int diff_run() {
+    FILE *in[NUM_ENGINES];
+    pid_t pids[NUM_ENGINES];
+    diff_record_t cur[NUM_ENGINES];
+    int active[NUM_ENGINES], pipe_fd[2], e, engines, all_done, behind, ahead, limited = FALSE, status, result = 0;
+    uint64_t target, agreed = 0, compared = 0;
+    uint32_t page;
+    
+    /* digest every page written from here on and the program image */
+    DIRTY_PAGES = malloc(NUM_PAGES * sizeof(uint32_t));
+    NUM_DIRTY_PAGES = 0;
+    for (page = 0; page < NUM_PAGES; page++) {
+        PAGE_TABLE[page] &= ~PAGE_DIRTY;
+        if ((PAGE_TABLE[page] & PAGE_WRITTEN) && !(PAGE_TABLE[page] & PAGE_DEVICE_MASK)) {
+            PAGE_TABLE[page] |= PAGE_DIRTY;
+            DIRTY_PAGES[NUM_DIRTY_PAGES++] = page;
+        }
+    }
+    
+    printf("Comparing %d engines on %s (at most %u instructions)...\n\n", NUM_ENGINES, prog_file, LOCKSTEP_LIMIT);
+    fflush(stdout);
+    for (e = 0; e < NUM_ENGINES; e++) {
+        if (pipe(pipe_fd) != 0) {
+            printf("Error: pipe failed\n");
+            exit(-1);
+        }
+        pids[e] = fork();
+        if (pids[e] == 0) {
+            close(pipe_fd[0]);
+            diff_engine(e, pipe_fd[1]);
+        }
+        close(pipe_fd[1]);
+        in[e] = fdopen(pipe_fd[0], "r");
+        active[e] = TRUE;
+        if (fread(&cur[e], sizeof(diff_record_t), 1, in[e]) != 1) {
+            printf("Error: the %s engine died before its first block\n", ENGINE_NAMES[e]);
+            result = -1;
+        }
+    }
+    
+    while (result == 0) {
+        /* an engine that cannot go on (a syscall or CP0 access the lockstep engine lacks) drops out */
+        target = 0;
+        engines = 0;
+        for (e = 0; e < NUM_ENGINES; e++) {
+            if (active[e] && cur[e].done && cur[e].status != LANE_EXITED && cur[e].status != LANE_LIMIT) {
+                printf("Note: the %s engine stopped (%s) at 0x%08x after %llu instructions\n", ENGINE_NAMES[e],
+                       LANE_STATUS_NAMES[cur[e].status], cur[e].pc, (unsigned long long)cur[e].count);
+                active[e] = FALSE;
+            }
+            if (active[e]) {
+                target = (cur[e].count > target) ? cur[e].count : target;
+                engines++;
+            }
+        }
+        if (engines < 2) {
+            break;
+        }
+        
+        /* bring everyone to the furthest block end seen */
+        behind = ahead = FALSE;
+        for (e = 0; e < NUM_ENGINES && result == 0; e++) {
+            while (active[e] && !cur[e].done && cur[e].count < target) {
+                if (fread(&cur[e], sizeof(diff_record_t), 1, in[e]) != 1) {
+                    printf("Error: the %s engine died after %llu instructions\n", ENGINE_NAMES[e], (unsigned long long)cur[e].count);
+                    result = -1;
+                    break;
+                }
+            }
+            if (active[e]) {
+                behind |= cur[e].count < target;
+                ahead |= cur[e].count > target;
+                limited |= cur[e].done && cur[e].status == LANE_LIMIT;
+            }
+        }
+        if (result != 0) {
+            break;
+        }
+        if (behind) {
+            /* some engine finished before the others */
+            if (limited) {
+                break;
+            }
+            printf("Engines disagree on where the program ends:\n");
+            diff_report(cur, active, agreed);
+            result = 1;
+            break;
+        }
+        if (ahead) {
+            continue;
+        }
+        
+        compared++;
+        for (e = 0; e < NUM_ENGINES; e++) {
+            if (active[e] && !diff_same(&cur[e], &cur[ENGINE_INTERPRETER])) {
+                result = 1;
+            }
+        }
+        if (result != 0) {
+            printf("Engines diverge between instructions %llu and %llu:\n", (unsigned long long)agreed, (unsigned long long)target);
+            diff_report(cur, active, agreed);
+            break;
+        }
+        agreed = target;
+        
+        all_done = TRUE;
+        for (e = 0; e < NUM_ENGINES && result == 0; e++) {
+            if (active[e] && !cur[e].done) {
+                all_done = FALSE;
+                if (fread(&cur[e], sizeof(diff_record_t), 1, in[e]) != 1) {
+                    printf("Error: the %s engine died after %llu instructions\n", ENGINE_NAMES[e], (unsigned long long)cur[e].count);
+                    result = -1;
+                }
+            }
+        }
+        if (all_done) {
+            break;
+        }
+    }
+    
+    for (e = 0; e < NUM_ENGINES; e++) {
+        fclose(in[e]);
+        kill(pids[e], SIGKILL);
+        waitpid(pids[e], &status, 0);
+    }
+    if (result == 0) {
+        printf("All engines agree over %llu instructions (%llu block comparisons)%s\n", (unsigned long long)agreed,
+               (unsigned long long)compared, limited ? ", stopped at the instruction budget" : "");
+    }
+    return result;
+}
+
+/**************************************************************/
+/* Start recording (-T only): forget any history and make the current */
+/* state the oldest snapshot, with every page written so far. Called  */
+/* again after reset and after registers are changed by hand, which  */
+/* replay could not reproduce.                                              */
+/**************************************************************/
+void tt_start() {
+    uint32_t page;
+    uint8_t *mem;
+    
+    if (TT_INTERVAL == 0) {
+        return;
+    }
+    tt_free();
+    if (TT_BASE == NULL) {
+        TT_BASE = calloc(NUM_PAGES, sizeof(uint8_t *));
+    }
+    for (page = 0; page < NUM_PAGES; page++) {
+        PAGE_TABLE[page] &= ~PAGE_DIRTY;
+        if (!(PAGE_TABLE[page] & PAGE_WRITTEN) || (PAGE_TABLE[page] & PAGE_DEVICE_MASK)) {
+            continue;
+        }
+        mem = mem_host_ptr(page << PAGE_SHIFT, NULL);
+        if (mem != NULL) {
+            TT_BASE[page] = malloc(PAGE_SIZE);
+            memcpy(TT_BASE[page], mem, PAGE_SIZE);
+        }
+    }
+    if (DIRTY_PAGES == NULL) {
+        DIRTY_PAGES = malloc(NUM_PAGES * sizeof(uint32_t));
+    }
+    NUM_DIRTY_PAGES = 0;
+    TT_LOG_LEN = TT_LOG_POS = 0;
+    TT_LOG_DATA_LEN = 0;
+    tt_save(&TT_SNAPSHOTS[0]);
+    TT_NUM_SNAPSHOTS = 1;
+    TT_CURRENT = 0;
+    TT_FRONTIER = INSTRUCTION_COUNT;
+    TT_NEXT_SNAPSHOT = INSTRUCTION_COUNT + TT_INTERVAL;
+}
+
+void tt_free() {
+    uint32_t i, page;
+    
+    for (i = 0; i < TT_NUM_SNAPSHOTS; i++) {
+        free(TT_SNAPSHOTS[i].pages);
+        free(TT_SNAPSHOTS[i].data);
+    }
+    TT_NUM_SNAPSHOTS = 0;
+    for (page = 0; TT_BASE != NULL && page < NUM_PAGES; page++) {
+        free(TT_BASE[page]);
+        TT_BASE[page] = NULL;
+    }
+}
+
+/**************************************************************/
+/* Everything but memory that replay has to start from                 */
+/**************************************************************/
+void tt_save(tt_snapshot_t *s) {
+    s->state = CURRENT_STATE;
+    s->count = INSTRUCTION_COUNT;
+    s->cycle_count = CYCLE_COUNT;
+    s->next_event_cycle = NEXT_EVENT_CYCLE;
+    s->timer_event_cycle = TIMER_EVENT_CYCLE;
+    s->count_base = COUNT_BASE;
+    s->heap_break = HEAP_BREAK;
+    s->block_start_pc = BLOCK_START_PC;
+    s->block_start_count = BLOCK_START_COUNT;
+    s->exit_code = EXIT_CODE;
+    s->guest_exited = GUEST_EXITED;
+    s->spin_stuck = SPIN_STUCK;
+    s->device_read = DEVICE_READ;
+    s->run_flag = RUN_FLAG;
+    memcpy(s->pmc, PMC, sizeof(PMC));
+    s->block_dev = BLOCK_DEV;
+    s->dma = DMA;
+    s->log_pos = TT_LOG_LEN;
+    s->num_pages = 0;
+    s->pages = NULL;
+    s->data = NULL;
+}
+
+/**************************************************************/
+/* Block boundary at TT_NEXT_SNAPSHOT: when replaying, the next     */
+/* snapshot has been reached and memory is as it was then; otherwise  */
+/* take a new one holding the pages written since the last            */
+/**************************************************************/
+void tt_snapshot() {
+    tt_snapshot_t *s;
+    uint32_t i;
+    uint8_t *mem;
+    
+    if (TT_CURRENT + 1 < TT_NUM_SNAPSHOTS && TT_SNAPSHOTS[TT_CURRENT + 1].count == INSTRUCTION_COUNT) {
+        TT_CURRENT++;
+    }
+    else {
+        /* later snapshots only survive a replay that reaches them */
+        while (TT_NUM_SNAPSHOTS > TT_CURRENT + 1) {
+            TT_NUM_SNAPSHOTS--;
+            free(TT_SNAPSHOTS[TT_NUM_SNAPSHOTS].pages);
+            free(TT_SNAPSHOTS[TT_NUM_SNAPSHOTS].data);
+        }
+        if (TT_NUM_SNAPSHOTS == TT_MAX_SNAPSHOTS) {
+            tt_fold();
+        }
+        s = &TT_SNAPSHOTS[TT_NUM_SNAPSHOTS];
+        tt_save(s);
+        qsort(DIRTY_PAGES, NUM_DIRTY_PAGES, sizeof(uint32_t), compare_pages);
+        s->pages = malloc(NUM_DIRTY_PAGES * sizeof(uint32_t));
+        s->data = malloc((size_t)NUM_DIRTY_PAGES * PAGE_SIZE);
+        for (i = 0; i < NUM_DIRTY_PAGES; i++) {
+            mem = mem_host_ptr(DIRTY_PAGES[i] << PAGE_SHIFT, NULL);
+            if (mem != NULL) {
+                s->pages[s->num_pages] = DIRTY_PAGES[i];
+                memcpy(s->data + (size_t)s->num_pages * PAGE_SIZE, mem, PAGE_SIZE);
+                s->num_pages++;
+            }
+        }
+        TT_CURRENT = TT_NUM_SNAPSHOTS++;
+    }
+    for (i = 0; i < NUM_DIRTY_PAGES; i++) {
+        PAGE_TABLE[DIRTY_PAGES[i]] &= ~PAGE_DIRTY;
+    }
+    NUM_DIRTY_PAGES = 0;
+    TT_NEXT_SNAPSHOT = (TT_CURRENT + 1 < TT_NUM_SNAPSHOTS) ? TT_SNAPSHOTS[TT_CURRENT + 1].count
+                                                           : INSTRUCTION_COUNT + TT_INTERVAL;
+}
+
+/**************************************************************/
+/* Make room: the second-oldest snapshot becomes the oldest, its      */
+/* pages going into TT_BASE, and the log before it is dropped          */
+/**************************************************************/
+void tt_fold() {
+    tt_snapshot_t *s = &TT_SNAPSHOTS[1];
+    uint32_t i, first, page;
+    size_t skip;
+    
+    for (i = 0; i < s->num_pages; i++) {
+        page = s->pages[i];
+        if (TT_BASE[page] == NULL) {
+            TT_BASE[page] = malloc(PAGE_SIZE);
+        }
+        memcpy(TT_BASE[page], s->data + (size_t)i * PAGE_SIZE, PAGE_SIZE);
+    }
+    free(s->pages);
+    free(s->data);
+    TT_SNAPSHOTS[0] = *s;
+    TT_SNAPSHOTS[0].num_pages = 0;
+    TT_SNAPSHOTS[0].pages = NULL;
+    TT_SNAPSHOTS[0].data = NULL;
+    memmove(&TT_SNAPSHOTS[1], &TT_SNAPSHOTS[2], (TT_NUM_SNAPSHOTS - 2) * sizeof(tt_snapshot_t));
+    TT_NUM_SNAPSHOTS--;
+    TT_CURRENT--;
+    
+    first = TT_SNAPSHOTS[0].log_pos;
+    if (first == 0) {
+        return;
+    }
+    skip = (first < TT_LOG_LEN) ? TT_LOG[first].data : TT_LOG_DATA_LEN;
+    memmove(TT_LOG, TT_LOG + first, (TT_LOG_LEN - first) * sizeof(tt_event_t));
+    memmove(TT_LOG_DATA, TT_LOG_DATA + skip, TT_LOG_DATA_LEN - skip);
+    TT_LOG_LEN -= first;
+    TT_LOG_POS -= first;
+    TT_LOG_DATA_LEN -= skip;
+    for (i = 0; i < TT_LOG_LEN; i++) {
+        TT_LOG[i].data -= skip;
+    }
+    for (i = 0; i < TT_NUM_SNAPSHOTS; i++) {
+        TT_SNAPSHOTS[i].log_pos -= first;
+    }
+}
+
+/**************************************************************/
+/* Put a page back as it was at snapshot j: the copy in the latest   */
+/* snapshot up to j that has one, else TT_BASE, else zeros             */
+/**************************************************************/
+void tt_restore_page(uint32_t page, uint32_t j) {
+    uint8_t *mem = mem_host_ptr(page << PAGE_SHIFT, NULL);
+    uint32_t *found;
+    
+    if (mem == NULL) {
+        return;
+    }
+    for (; j > 0; j--) {
+        found = bsearch(&page, TT_SNAPSHOTS[j].pages, TT_SNAPSHOTS[j].num_pages, sizeof(uint32_t), compare_pages);
+        if (found != NULL) {
+            memcpy(mem, TT_SNAPSHOTS[j].data + (size_t)(found - TT_SNAPSHOTS[j].pages) * PAGE_SIZE, PAGE_SIZE);
+            return;
+        }
+    }
+    if (TT_BASE[page] != NULL) {
+        memcpy(mem, TT_BASE[page], PAGE_SIZE);
+    }
+    else {
+        memset(mem, 0, PAGE_SIZE);
+    }
+}
+
+/**************************************************************/
+/* Go back to snapshot j (at most TT_CURRENT), touching only the    */
+/* pages written since TT_CURRENT and those changed in between        */
+/**************************************************************/
+void tt_restore(uint32_t j) {
+    tt_snapshot_t *s = &TT_SNAPSHOTS[j];
+    uint32_t i, k;
+    
+    for (i = 0; i < NUM_DIRTY_PAGES; i++) {
+        PAGE_TABLE[DIRTY_PAGES[i]] &= ~PAGE_DIRTY;
+        tt_restore_page(DIRTY_PAGES[i], j);
+    }
+    NUM_DIRTY_PAGES = 0;
+    for (k = j + 1; k <= TT_CURRENT; k++) {
+        for (i = 0; i < TT_SNAPSHOTS[k].num_pages; i++) {
+            tt_restore_page(TT_SNAPSHOTS[k].pages[i], j);
+        }
+    }
+    
+    CURRENT_STATE = s->state;
+    NEXT_STATE = CURRENT_STATE;
+    INSTRUCTION_COUNT = s->count;
+    CYCLE_COUNT = s->cycle_count;
+    NEXT_EVENT_CYCLE = s->next_event_cycle;
+    TIMER_EVENT_CYCLE = s->timer_event_cycle;
+    COUNT_BASE = s->count_base;
+    HEAP_BREAK = s->heap_break;
+    BLOCK_START_PC = s->block_start_pc;
+    BLOCK_START_COUNT = s->block_start_count;
+    EXIT_CODE = s->exit_code;
+    GUEST_EXITED = s->guest_exited;
+    SPIN_STUCK = s->spin_stuck;
+    DEVICE_READ = s->device_read;
+    RUN_FLAG = s->run_flag;
+    memcpy(PMC, s->pmc, sizeof(PMC));
+    BLOCK_DEV = s->block_dev;
+    DMA = s->dma;
+    TT_LOG_POS = s->log_pos;
+    TT_CURRENT = j;
+    TT_NEXT_SNAPSHOT = (j + 1 < TT_NUM_SNAPSHOTS) ? TT_SNAPSHOTS[j + 1].count : s->count + TT_INTERVAL;
+}
+
+/**************************************************************/
+/* Latest snapshot at or before an instruction count                      */
+/**************************************************************/
+uint32_t tt_find(uint64_t count) {
+    uint32_t lo = 0, hi = TT_NUM_SNAPSHOTS - 1, mid;
+    
+    while (lo < hi) {
+        mid = hi - (hi - lo) / 2;
+        if (TT_SNAPSHOTS[mid].count <= count) {
+            lo = mid;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+/**************************************************************/
+/* One instruction, with the block-boundary work run() does               */
+/**************************************************************/
+void tt_step() {
+    BLOCK_END = FALSE;
+    cycle();
+    if (BLOCK_END) {
+        end_block();
+    }
+}
+
+/**************************************************************/
+/* Move to instruction count target (at most the current one) by    */
+/* replaying from the snapshot before it. A natively run routine or  */
+/* a skipped loop may span the target: then the instruction boundary */
+/* just before it is replayed to instead.                                  */
+/**************************************************************/
+void tt_goto(uint64_t target) {
+    uint64_t before;
+    int verbose = VERBOSE;
+    
+    if (INSTRUCTION_COUNT > TT_FRONTIER) {
+        TT_FRONTIER = INSTRUCTION_COUNT;
+    }
+    if (target < TT_SNAPSHOTS[0].count) {
+        target = TT_SNAPSHOTS[0].count;
+    }
+    VERBOSE = FALSE;
+    tt_restore(tt_find(target) < TT_CURRENT ? tt_find(target) : TT_CURRENT);
+    before = INSTRUCTION_COUNT;
+    while (RUN_FLAG && INSTRUCTION_COUNT < target) {
+        before = INSTRUCTION_COUNT;
+        tt_step();
+    }
+    if (INSTRUCTION_COUNT > target) {
+        tt_restore(tt_find(before));
+        while (RUN_FLAG && INSTRUCTION_COUNT < before) {
+            tt_step();
+        }
+    }
+    VERBOSE = verbose;
+}
+
+/**************************************************************/
+/* rstep [n]: go back n instructions                                        */
+/**************************************************************/
+void tt_rstep(uint32_t n) {
+    uint64_t start;
+    
+    if (TT_INTERVAL == 0) {
+        printf("Time travel is off; start the simulator with -T <n>.\n\n");
+        return;
+    }
+    start = TT_SNAPSHOTS[0].count;
+    if (INSTRUCTION_COUNT == start) {
+        printf("Already at the start of the recorded history.\n\n");
+        return;
+    }
+    tt_goto((n < INSTRUCTION_COUNT - start) ? INSTRUCTION_COUNT - n : start);
+    printf("Stepped back to instruction %llu: [0x%08x]\t", (unsigned long long)INSTRUCTION_COUNT, CURRENT_STATE.PC);
+    print_instruction(CURRENT_STATE.PC);
+    printf("\n");
+}
+
+/**************************************************************/
+/* rcontinue [pc]: go back to the last time the PC was pc, or to the */
+/* start of the recorded history. The intervals between snapshots     */
+/* are replayed newest first until one of them reaches pc.             */
+/**************************************************************/
+void tt_rcontinue(int have_pc, uint32_t pc) {
+    uint64_t now = INSTRUCTION_COUNT, end = now, hit = 0;
+    uint32_t k;
+    int found = FALSE, verbose = VERBOSE;
+    
+    if (TT_INTERVAL == 0) {
+        printf("Time travel is off; start the simulator with -T <n>.\n\n");
+        return;
+    }
+    if (!have_pc) {
+        tt_goto(TT_SNAPSHOTS[0].count);
+        printf("At the start of the recorded history, instruction %llu.\n\n", (unsigned long long)INSTRUCTION_COUNT);
+        return;
+    }
+    if (now > TT_FRONTIER) {
+        TT_FRONTIER = now;
+    }
+    VERBOSE = FALSE;
+    for (k = TT_CURRENT; ; k--) {
+        tt_restore(k);
+        while (RUN_FLAG && INSTRUCTION_COUNT < end) {
+            if (CURRENT_STATE.PC == pc) {
+                hit = INSTRUCTION_COUNT;
+                found = TRUE;
+            }
+            tt_step();
+        }
+        if (found || k == 0) {
+            break;
+        }
+        end = TT_SNAPSHOTS[k].count;
+    }
+    VERBOSE = verbose;
+    
+    tt_goto(found ? hit : now);
+    if (!found) {
+        printf("PC 0x%08x was not reached in the recorded history (from instruction %llu).\n\n", pc,
+               (unsigned long long)TT_SNAPSHOTS[0].count);
+        return;
+    }
+    printf("Reverse continued to instruction %llu: [0x%08x]\t", (unsigned long long)INSTRUCTION_COUNT, CURRENT_STATE.PC);
+    print_instruction(CURRENT_STATE.PC);
+    printf("\n");
+}
+
+/**************************************************************/
+/* Whether a syscall or device access has been done before and must  */
+/* come from the log                                                              */
+/**************************************************************/
+int tt_replaying() {
+    return TT_INTERVAL != 0 && INSTRUCTION_COUNT < TT_FRONTIER;
+}
+
+/**************************************************************/
+/* Copy between guest memory and buf, one region at a time              */
+/**************************************************************/
+void tt_copy_guest(uint32_t address, uint8_t *buf, uint32_t len, int to_guest) {
+    uint32_t avail;
+    uint8_t *p;
+    
+    while (len > 0) {
+        p = mem_host_ptr(address, &avail);
+        if (p == NULL) {
+            return;
+        }
+        if (avail > len) {
+            avail = len;
+        }
+        if (to_guest) {
+            memcpy(p, buf, avail);
+            mem_mark_written(address, avail);
+        }
+        else {
+            memcpy(buf, p, avail);
+        }
+        address += avail;
+        buf += avail;
+        len -= avail;
+    }
+}
+
+/**************************************************************/
+/* Record the outcome of a syscall or device access: a value and the */
+/* guest memory the host filled in                                            */
+/**************************************************************/
+void tt_log(uint32_t value, uint32_t address, uint32_t len) {
+    tt_event_t *e;
+    
+    if (TT_INTERVAL == 0) {
+        return;
+    }
+    if (TT_LOG_LEN == TT_LOG_SIZE) {
+        TT_LOG_SIZE = (TT_LOG_SIZE == 0) ? 256 : 2 * TT_LOG_SIZE;
+        TT_LOG = realloc(TT_LOG, TT_LOG_SIZE * sizeof(tt_event_t));
+    }
+    if (TT_LOG_DATA_LEN + len > TT_LOG_DATA_SIZE) {
+        TT_LOG_DATA_SIZE = (2 * TT_LOG_DATA_SIZE > TT_LOG_DATA_LEN + len) ? 2 * TT_LOG_DATA_SIZE : TT_LOG_DATA_LEN + len;
+        TT_LOG_DATA = realloc(TT_LOG_DATA, TT_LOG_DATA_SIZE);
+    }
+    e = &TT_LOG[TT_LOG_LEN++];
+    e->count = INSTRUCTION_COUNT;
+    e->value = value;
+    e->address = address;
+    e->len = len;
+    e->data = TT_LOG_DATA_LEN;
+    tt_copy_guest(address, TT_LOG_DATA + TT_LOG_DATA_LEN, len, FALSE);
+    TT_LOG_DATA_LEN += len;
+    TT_LOG_POS = TT_LOG_LEN;
+}
+
+/**************************************************************/
+/* Replay the next logged event: its memory goes back into the guest */
+/* and its value is returned                                                     */
+/**************************************************************/
+uint32_t tt_replay() {
+    tt_event_t *e;
+    
+    if (TT_LOG_POS == TT_LOG_LEN || TT_LOG[TT_LOG_POS].count != INSTRUCTION_COUNT) {
+        printf("Error: replay diverged from the recording at instruction %llu\n", (unsigned long long)INSTRUCTION_COUNT);
+        RUN_FLAG = FALSE;
+        return 0;
+    }
+    e = &TT_LOG[TT_LOG_POS++];
+    tt_copy_guest(e->address, TT_LOG_DATA + e->data, e->len, TRUE);
+    return e->value;
+}
+
+/**************************************************************/
+/* Open the host hardware counters for this thread (-E)                 */
+/**************************************************************/
+void host_stats_open() {
+    static const uint64_t configs[HOST_EVENTS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES
+    };
+    struct perf_event_attr attr;
+    int k, opened = 0;
+    
+    for (k = 0; k < HOST_EVENTS; k++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[k];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        HOST.fds[k] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        opened += (HOST.fds[k] >= 0);
+    }
+    if (opened == 0) {
+        printf("Warning: no host performance counters (perf_event_open: %s), timing only\n", strerror(errno));
+    }
+}
+
+/**************************************************************/
+/* Current value of a host counter, scaled up if the kernel had to  */
+/* share the hardware counter with other events                            */
+/**************************************************************/
+uint64_t host_counter(int k) {
+    uint64_t values[3];     /* count, time enabled, time running */
+    
+    if (HOST.fds[k] < 0 || read(HOST.fds[k], values, sizeof(values)) != sizeof(values) || values[2] == 0) {
+        return 0;
+    }
+    return (uint64_t)((double)values[0] * values[1] / values[2]);
+}
+
+/**************************************************************/
+/* Monotonic wall clock in seconds                                            */
+/**************************************************************/
+double host_clock() {
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**************************************************************/
+/* Start measuring a run that begins at guest instruction count guest */
+/**************************************************************/
+void host_stats_start(uint64_t guest) {
+    int k;
+    
+    if (!HOST_STATS) {
+        return;
+    }
+    for (k = 0; k < HOST_EVENTS; k++) {
+        HOST.start[k] = host_counter(k);
+    }
+    HOST.guest_start = guest;
+    HOST.clock_start = host_clock();
+}
+
+/**************************************************************/
+/* End the run, add it to the totals and print its rates                  */
+/**************************************************************/
+void host_stats_stop(engine_t engine, uint64_t guest) {
+    uint64_t used[HOST_EVENTS], instructions = guest - HOST.guest_start;
+    double seconds;
+    int k, shown;
+    
+    if (!HOST_STATS) {
+        return;
+    }
+    seconds = host_clock() - HOST.clock_start;
+    for (k = 0; k < HOST_EVENTS; k++) {
+        used[k] = host_counter(k) - HOST.start[k];
+        HOST.totals[k] += used[k];
+    }
+    HOST.guest_instructions += instructions;
+    HOST.seconds += seconds;
+    HOST.engine = engine;
+    if (instructions == 0) {
+        return;
+    }
+    printf("Host (%s engine): %.2f guest MIPS/s", ENGINE_NAMES[engine], seconds > 0 ? instructions / seconds / 1e6 : 0.0);
+    for (k = 0, shown = 0; k < HOST_EVENTS; k++) {
+        if (HOST.fds[k] >= 0) {
+            printf("%s %.4f %s", shown++ ? "," : "; per guest instruction", (double)used[k] / instructions, HOST_EVENT_NAMES[k]);
+        }
+    }
+    printf("\n\n");
+}
+
+/**************************************************************/
+/* Totals over every measured run, at exit                                 */
+/**************************************************************/
+void host_stats_report() {
+    int k;
+    
+    host_stats_json();
+    if (HOST.guest_instructions == 0) {
+        return;
+    }
+    printf("-------------------------------------------------------------\n");
+    printf("Host efficiency: %llu guest instructions in %.3f s (%.2f MIPS/s)\n",
+           (unsigned long long)HOST.guest_instructions, HOST.seconds,
+           HOST.seconds > 0 ? HOST.guest_instructions / HOST.seconds / 1e6 : 0.0);
+    printf("-------------------------------------------------------------\n");
+    printf("[Event]\t\t[Host total]\t[Per guest instruction]\n");
+    for (k = 0; k < HOST_EVENTS; k++) {
+        if (HOST.fds[k] < 0) {
+            printf("%-14s\tn/a\n", HOST_EVENT_NAMES[k]);
+            continue;
+        }
+        printf("%-14s\t%-12llu\t%.4f\n", HOST_EVENT_NAMES[k], (unsigned long long)HOST.totals[k],
+               (double)HOST.totals[k] / HOST.guest_instructions);
+    }
+    if (HOST.totals[0] > 0) {
+        printf("host IPC\t%.2f\n", (double)HOST.totals[1] / HOST.totals[0]);
+    }
+    printf("-------------------------------------------------------------\n\n");
+}
+
+/**************************************************************/
+/* Load the program and kernel, timing the load and the startup    */
+/* (everything since main() began) for -J                                   */
+/**************************************************************/
+void host_stats_load() {
+    double begin = host_clock();
+    
+    load_program();
+    load_kernel();
+    HOST.load_seconds = host_clock() - begin;
+    HOST.startup_seconds = host_clock() - HOST.process_start;
+}
+
+/**************************************************************/
+/* Write the measured runs as one JSON object to bench_file (-J)    */
+/**************************************************************/
+void host_stats_json() {
+    struct rusage usage;
+    FILE *fp;
+    int k, shown;
+    
+    if (bench_file[0] == '\0') {
+        return;
+    }
+    fp = fopen(bench_file, "w");
+    if (fp == NULL) {
+        printf("Error: Can't write %s\n", bench_file);
+        return;
+    }
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(fp, "{\n  \"program\": \"%s\",\n  \"engine\": \"%s\",\n", prog_file, ENGINE_NAMES[HOST.engine]);
+    fprintf(fp, "  \"instructions\": %llu,\n  \"run_seconds\": %.6f,\n  \"mips\": %.4f,\n",
+            (unsigned long long)HOST.guest_instructions, HOST.seconds,
+            HOST.seconds > 0 ? HOST.guest_instructions / HOST.seconds / 1e6 : 0.0);
+    fprintf(fp, "  \"load_seconds\": %.6f,\n  \"startup_seconds\": %.6f,\n  \"peak_rss_kb\": %ld,\n",
+            HOST.load_seconds, HOST.startup_seconds, usage.ru_maxrss);
+    fprintf(fp, "  \"host_per_instruction\": {");
+    for (k = 0, shown = 0; k < HOST_EVENTS; k++) {
+        if (HOST.fds[k] >= 0 && HOST.guest_instructions > 0) {
+            fprintf(fp, "%s\"%s\": %.4f", shown++ ? ", " : "", HOST_EVENT_NAMES[k],
+                    (double)HOST.totals[k] / HOST.guest_instructions);
+        }
+    }
+    fprintf(fp, "}\n}\n");
+    fclose(fp);
+}
+
+/**************************************************************/
+/* Attach a device to [begin, begin+size) and tag its pages              */
+/**************************************************************/
+void mmio_register(const char *name, uint32_t begin, uint32_t size, uint32_t (*read)(uint32_t), void (*write)(uint32_t, uint32_t)) {
+    mmio_device_t *dev;
+    uint32_t page;
+    
+    if (NUM_MMIO_DEVICES == MAX_MMIO_DEVICES) {
+        printf("Error: too many devices, %s not attached\n", name);
+        return;
+    }
+    dev = &MMIO_DEVICES[NUM_MMIO_DEVICES++];
+    dev->name = name;
+    dev->begin = begin;
+    dev->end = begin + size - 1;
+    dev->read = read;
+    dev->write = write;
+    for (page = begin >> PAGE_SHIFT; page <= dev->end >> PAGE_SHIFT; page++) {
+        PAGE_TABLE[page] = (PAGE_TABLE[page] & ~PAGE_DEVICE_MASK) | NUM_MMIO_DEVICES;
+    }
+}
+
+/**************************************************************/
+/* Route an access on a device page to its device model                */
+/**************************************************************/
+uint32_t mmio_read(uint32_t address) {
+    mmio_device_t *dev = &MMIO_DEVICES[(PAGE_TABLE[address >> PAGE_SHIFT] & PAGE_DEVICE_MASK) - 1];
+    DEVICE_READ = TRUE;
+    if (address > dev->end) {
+        return 0;
+    }
+    return dev->read(address - dev->begin);
+}
+
+void mmio_write(uint32_t address, uint32_t value) {
+    mmio_device_t *dev = &MMIO_DEVICES[(PAGE_TABLE[address >> PAGE_SHIFT] & PAGE_DEVICE_MASK) - 1];
+    if (address <= dev->end) {
+        dev->write(address - dev->begin, value);
+    }
+}
+
+/**************************************************************/
+/* UART: transmit goes to host stdout (or the -u file) through stdio */
+/* buffering, receive comes from host stdin                                 */
+/**************************************************************/
+uint32_t uart_read(uint32_t offset) {
+    struct pollfd pfd;
+    uint32_t value = 0;
+    uint8_t c;
+    
+    if (tt_replaying()) {
+        return tt_replay();
+    }
+    switch (offset) {
+        case UART_DATA:
+            if (read(UART.rx_fd, &c, 1) == 1) {
+                value = c;
+            }
+            break;
+        case UART_STATUS:
+            pfd.fd = UART.rx_fd;
+            pfd.events = POLLIN;
+            value = UART_TX_READY | ((poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN)) ? UART_RX_READY : 0);
+            break;
+    }
+    tt_log(value, 0, 0);
+    return value;
+}
+
+void uart_write(uint32_t offset, uint32_t value) {
+    if (offset == UART_DATA && !tt_replaying()) {
+        putc(value & 0xFF, UART.tx);
+    }
+}
+
+/**************************************************************/
+/* Block device: transfers go between the host image and guest       */
+/* memory with preadv/pwritev, with no staging buffer                    */
+/**************************************************************/
+uint32_t block_read(uint32_t offset) {
+    switch (offset) {
+        case BLOCK_SECTOR: return BLOCK_DEV.sector;
+        case BLOCK_BUFFER: return BLOCK_DEV.buffer;
+        case BLOCK_COUNT: return BLOCK_DEV.count;
+        case BLOCK_STATUS: return BLOCK_DEV.status;
+        case BLOCK_CAPACITY: return BLOCK_DEV.capacity;
+    }
+    return 0;
+}
+
+void block_write(uint32_t offset, uint32_t value) {
+    struct iovec iov[SYSCALL_MAX_IOV];
+    uint32_t len;
+    off_t pos;
+    ssize_t done;
+    int n;
+    
+    switch (offset) {
+        case BLOCK_SECTOR: BLOCK_DEV.sector = value; return;
+        case BLOCK_BUFFER: BLOCK_DEV.buffer = value; return;
+        case BLOCK_COUNT: BLOCK_DEV.count = value; return;
+        case BLOCK_COMMAND: break;
+        default: return;
+    }
+    
+    if (BLOCK_DEV.fd < 0) {
+        BLOCK_DEV.status = 2;
+        return;
+    }
+    if ((uint64_t)BLOCK_DEV.sector + BLOCK_DEV.count > BLOCK_DEV.capacity) {
+        BLOCK_DEV.status = 1;
+        return;
+    }
+    len = BLOCK_DEV.count * BLOCK_SECTOR_SIZE;
+    pos = (off_t)BLOCK_DEV.sector * BLOCK_SECTOR_SIZE;
+    n = guest_iovec(BLOCK_DEV.buffer, len, iov, SYSCALL_MAX_IOV, value == BLOCK_CMD_READ);
+    if (n < 0) {
+        BLOCK_DEV.status = 1;
+        return;
+    }
+    if (tt_replaying()) {
+        /* the image may have been written since */
+        BLOCK_DEV.status = tt_replay();
+        return;
+    }
+    if (value == BLOCK_CMD_READ) {
+        done = preadv(BLOCK_DEV.fd, iov, n, pos);
+    }
+    else if (value == BLOCK_CMD_WRITE) {
+        done = pwritev(BLOCK_DEV.fd, iov, n, pos);
+    }
+    else {
+        done = -1;
+    }
+    BLOCK_DEV.status = (done == (ssize_t)len) ? 0 : 1;
+    tt_log(BLOCK_DEV.status, BLOCK_DEV.buffer, (value == BLOCK_CMD_READ) ? len : 0);
+}
+
+/**************************************************************/
+/* DMA engine: bulk copy between guest addresses, one memmove per */
+/* contiguous host run                                                               */
+/**************************************************************/
+uint32_t dma_read(uint32_t offset) {
+    switch (offset) {
+        case DMA_SRC: return DMA.src;
+        case DMA_DST: return DMA.dst;
+        case DMA_LEN: return DMA.len;
+        case DMA_STATUS: return DMA.status;
+    }
+    return 0;
+}
+
+void dma_write(uint32_t offset, uint32_t value) {
+    uint32_t src_avail, dst_avail, chunk;
+    uint8_t *src, *dst;
+    
+    switch (offset) {
+        case DMA_SRC: DMA.src = value; return;
+        case DMA_DST: DMA.dst = value; return;
+        case DMA_LEN: DMA.len = value; return;
+        case DMA_CONTROL: break;
+        default: return;
+    }
+    if ((value & 1) == 0) {
+        return;
+    }
+    
+    DMA.status = 0;
+    while (DMA.len > 0) {
+        src = mem_host_ptr(DMA.src, &src_avail);
+        dst = mem_host_ptr(DMA.dst, &dst_avail);
+        if (src == NULL || dst == NULL) {
+            DMA.status = 1;
+            return;
+        }
+        chunk = DMA.len;
+        if (chunk > src_avail) {
+            chunk = src_avail;
+        }
+        if (chunk > dst_avail) {
+            chunk = dst_avail;
+        }
+        memmove(dst, src, chunk);
+        mem_mark_written(DMA.dst, chunk);
+        DMA.src += chunk;
+        DMA.dst += chunk;
+        DMA.len -= chunk;
+    }
+}
+
+/**************************************************************/
+/* Open device backing files and map the devices                       */
+/**************************************************************/
+void init_devices() {
+    struct stat st;
+    
+    UART.tx = stdout;
+    UART.rx_fd = 0;
+    if (uart_file[0] != '\0') {
+        UART.tx = fopen(uart_file, "w");
+        if (UART.tx == NULL) {
+            printf("Error: Can't open UART file %s\n", uart_file);
+            exit(-1);
+        }
+    }
+    
+    BLOCK_DEV.fd = -1;
+    if (block_file[0] != '\0') {
+        BLOCK_DEV.fd = open(block_file, O_RDWR);
+        if (BLOCK_DEV.fd < 0 || fstat(BLOCK_DEV.fd, &st) != 0) {
+            printf("Error: Can't open block image %s\n", block_file);
+            exit(-1);
+        }
+        BLOCK_DEV.capacity = st.st_size / BLOCK_SECTOR_SIZE;
+    }
+    
+    mmio_register("uart", UART_BASE, PAGE_SIZE, uart_read, uart_write);
+    mmio_register("block", BLOCK_BASE, PAGE_SIZE, block_read, block_write);
+    mmio_register("dma", DMA_BASE, PAGE_SIZE, dma_read, dma_write);
+}
+
+/**************************************************************/
+/* Push out buffered device output                                          */
+/**************************************************************/
+void flush_devices() {
+    fflush(UART.tx);
+}
+
+/**************************************************************/
+/* Set up stdin/stdout/stderr and the program break                   */
+/**************************************************************/
+void init_syscalls() {
+    int i;
+    for (i = 0; i < SYSCALL_FDS; i++) {
+        GUEST_FDS[i].host_fd = (i < 3) ? i : -1;
+        GUEST_FDS[i].owned = FALSE;
+        GUEST_FDS[i].out_len = 0;
+        GUEST_FDS[i].in_pos = 0;
+        GUEST_FDS[i].in_len = 0;
+    }
+    HEAP_BREAK = MEM_HEAP_BEGIN;
+    EXIT_CODE = 0;
+    GUEST_EXITED = FALSE;
+}
+
+/**************************************************************/
+/* Write out everything buffered for one guest fd                         */
+/**************************************************************/
+void flush_guest_fd(int fd) {
+    guest_fd_t *f = &GUEST_FDS[fd];
+    uint32_t done = 0;
+    ssize_t n;
+    
+    if (f->out_len == 0) {
+        return;
+    }
+    if (f->host_fd <= 2) {
+        /* keep guest output ordered with the simulator's own stdio output */
+        fflush(stdout);
+    }
+    while (done < f->out_len) {
+        n = write(f->host_fd, f->out + done, f->out_len - done);
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    f->out_len = 0;
+}
+
+/**************************************************************/
+/* Flush every guest fd (simulation stopped, exit, or input needed)   */
+/**************************************************************/
+void flush_guest_output() {
+    int i;
+    flush_devices();
+    for (i = 0; i < SYSCALL_FDS; i++) {
+        if (GUEST_FDS[i].host_fd >= 0) {
+            flush_guest_fd(i);
+        }
+    }
+}
+
+/**************************************************************/
+/* Flush and close all guest fds (reset and exit)                          */
+/**************************************************************/
+void close_guest_fds() {
+    int i;
+    flush_guest_output();
+    for (i = 0; i < SYSCALL_FDS; i++) {
+        if (GUEST_FDS[i].owned) {
+            close(GUEST_FDS[i].host_fd);
+        }
+        free(GUEST_FDS[i].out);
+        free(GUEST_FDS[i].in);
+        GUEST_FDS[i].out = NULL;
+        GUEST_FDS[i].in = NULL;
+    }
+    init_syscalls();
+}
+
+/**************************************************************/
+/* Append bytes to a guest fd's output buffer                             */
+/**************************************************************/
+int guest_fd_put(int fd, const uint8_t *data, uint32_t len) {
+    guest_fd_t *f;
+    uint32_t chunk;
+    
+    if (fd < 0 || fd >= SYSCALL_FDS || GUEST_FDS[fd].host_fd < 0) {
+        return -1;
+    }
+    f = &GUEST_FDS[fd];
+    if (f->out == NULL) {
+        f->out = malloc(SYSCALL_BUF_SIZE);
+    }
+    while (len > 0) {
+        if (f->out_len == SYSCALL_BUF_SIZE) {
+            flush_guest_fd(fd);
+        }
+        chunk = SYSCALL_BUF_SIZE - f->out_len;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(f->out + f->out_len, data, chunk);
+        f->out_len += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+/**************************************************************/
+/* Read up to len bytes from a guest fd into dst. Reads from the    */
+/* terminal stop at end of line; file reads are served from a large */
+/* read-ahead buffer.                                                                  */
+/**************************************************************/
+int32_t guest_fd_get(int fd, uint8_t *dst, uint32_t len) {
+    guest_fd_t *f;
+    uint32_t done = 0, chunk;
+    ssize_t n;
+    int c;
+    
+    if (fd < 0 || fd >= SYSCALL_FDS || GUEST_FDS[fd].host_fd < 0) {
+        return -1;
+    }
+    flush_guest_output();
+    f = &GUEST_FDS[fd];
+    if (f->host_fd == 0) {
+        /* share stdio's buffer with the command prompt */
+        while (done < len && (c = getchar()) != EOF) {
+            dst[done++] = c;
+            if (c == '\n') {
+                break;
+            }
+        }
+        return done;
+    }
+    if (f->in == NULL) {
+        f->in = malloc(SYSCALL_BUF_SIZE);
+    }
+    while (done < len) {
+        if (f->in_pos == f->in_len) {
+            n = read(f->host_fd, f->in, SYSCALL_BUF_SIZE);
+            if (n <= 0) {
+                break;
+            }
+            f->in_pos = 0;
+            f->in_len = n;
+        }
+        chunk = f->in_len - f->in_pos;
+        if (chunk > len - done) {
+            chunk = len - done;
+        }
+        memcpy(dst + done, f->in + f->in_pos, chunk);
+        f->in_pos += chunk;
+        done += chunk;
+    }
+    return done;
+}
+
+/**************************************************************/
+/* Guest buffer [address, address+len) as one host range, or NULL. */
+/* With to_guest the host is about to fill it in.                          */
+/**************************************************************/
+uint8_t *guest_buffer(uint32_t address, uint32_t len, int to_guest) {
+    uint32_t avail;
+    uint8_t *p = mem_host_ptr(address, &avail);
+    if (p == NULL || avail < len) {
+        return NULL;
+    }
+    if (to_guest) {
+        mem_mark_written(address, len);
+    }
+    return p;
+}
+
+/**************************************************************/
+/* Describe a guest buffer as iovecs pointing straight into guest    */
+/* memory (one per region it spans), to be read into with to_guest.  */
+/* Returns -1 if any part is unmapped.                                        */
+/**************************************************************/
+int guest_iovec(uint32_t address, uint32_t len, struct iovec *iov, int max_iov, int to_guest) {
+    int n = 0;
+    uint32_t avail;
+    uint8_t *p;
+    
+    while (len > 0) {
+        p = mem_host_ptr(address, &avail);
+        if (p == NULL || n == max_iov) {
+            return -1;
+        }
+        if (avail > len) {
+            avail = len;
+        }
+        if (to_guest) {
+            mem_mark_written(address, avail);
+        }
+        iov[n].iov_base = p;
+        iov[n].iov_len = avail;
+        n++;
+        address += avail;
+        len -= avail;
+    }
+    return n;
+}
+
+/**************************************************************/
+/* Large write: pending buffered bytes and the guest buffer go out   */
+/* in one writev(2) without copying the guest data. Returns how many */
+/* guest bytes went out, or -1 if none did.                                */
+/**************************************************************/
+int32_t guest_fd_write_direct(int fd, uint32_t address, uint32_t len) {
+    struct iovec iov[SYSCALL_MAX_IOV + 1];
+    guest_fd_t *f = &GUEST_FDS[fd];
+    uint32_t pending = f->out_len;
+    uint64_t total = 0;
+    int n, first = 0;
+    ssize_t done;
+    
+    n = guest_iovec(address, len, iov + 1, SYSCALL_MAX_IOV, FALSE);
+    if (n < 0) {
+        return -1;
+    }
+    iov[0].iov_base = f->out;
+    iov[0].iov_len = f->out_len;
+    n++;
+    if (f->host_fd <= 2) {
+        fflush(stdout);
+    }
+    while (first < n) {
+        done = writev(f->host_fd, iov + first, n - first);
+        if (done <= 0) {
+            break;
+        }
+        total += done;
+        /* partial write: skip what went out and retry the rest */
+        while (first < n && (size_t)done >= iov[first].iov_len) {
+            done -= iov[first].iov_len;
+            first++;
+        }
+        if (first < n) {
+            iov[first].iov_base = (uint8_t *)iov[first].iov_base + done;
+            iov[first].iov_len -= done;
+        }
+    }
+    f->out_len = 0;
+    return (total > pending) ? (int32_t)(total - pending) : -1;
+}
+
+/**************************************************************/
+/* Large read: readv(2) lands directly in guest memory, with the fd's */
+/* read-ahead buffer as the last iovec so it is refilled by the same */
+/* call. Only bytes already read ahead are copied.                      */
+/**************************************************************/
+int32_t guest_fd_read_direct(int fd, uint32_t address, uint32_t len) {
+    struct iovec iov[SYSCALL_MAX_IOV + 1];
+    guest_fd_t *f = &GUEST_FDS[fd];
+    uint32_t buffered, copied = 0;
+    ssize_t got;
+    int i, n;
+    
+    flush_guest_output();
+    if (f->in == NULL) {
+        f->in = malloc(SYSCALL_BUF_SIZE);
+    }
+    
+    buffered = f->in_len - f->in_pos;
+    if (buffered > len) {
+        buffered = len;
+    }
+    n = guest_iovec(address, buffered, iov, SYSCALL_MAX_IOV, TRUE);
+    if (n < 0 || guest_iovec(address, len, iov + n, SYSCALL_MAX_IOV + 1 - n, TRUE) < 0) {
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        memcpy(iov[i].iov_base, f->in + f->in_pos + copied, iov[i].iov_len);
+        copied += iov[i].iov_len;
+    }
+    f->in_pos += buffered;
+    if (buffered == len) {
+        return len;
+    }
+    
+    n = guest_iovec(address + buffered, len - buffered, iov, SYSCALL_MAX_IOV, TRUE);
+    iov[n].iov_base = f->in;
+    iov[n].iov_len = SYSCALL_BUF_SIZE;
+    got = readv(f->host_fd, iov, n + 1);
+    if (got <= 0) {
+        f->in_pos = f->in_len = 0;
+        return (buffered > 0) ? (int32_t)buffered : (got == 0 ? 0 : -1);
+    }
+    if ((uint32_t)got > len - buffered) {
+        f->in_pos = 0;
+        f->in_len = got - (len - buffered);
+        return len;
+    }
+    f->in_pos = f->in_len = 0;
+    return buffered + got;
+}
+
+void sys_print_int() {
+    char text[16];
+    int n = snprintf(text, sizeof(text), "%d", (int32_t)CURRENT_STATE.REGS[4]);
+    guest_fd_put(1, (uint8_t *)text, n);
+}
+
+void sys_print_string() {
+    uint32_t avail;
+    uint8_t *p = mem_host_ptr(CURRENT_STATE.REGS[4], &avail);
+    uint8_t *end;
+    
+    if (p == NULL) {
+        return;
+    }
+    end = memchr(p, '\0', avail);
+    guest_fd_put(1, p, (end != NULL) ? (uint32_t)(end - p) : avail);
+}
+
+void sys_read_int() {
+    int value = 0;
+    flush_guest_output();
+    if (scanf("%d", &value) != 1) {
+        value = 0;
+    }
+    NEXT_STATE.REGS[2] = value;
+}
+
+void sys_read_string() {
+    uint32_t len = CURRENT_STATE.REGS[5];
+    uint8_t *p;
+    int32_t n;
+    
+    if (len == 0) {
+        return;
+    }
+    p = guest_buffer(CURRENT_STATE.REGS[4], len, TRUE);
+    if (p == NULL) {
+        return;
+    }
+    /* like fgets: at most len-1 characters plus the terminator */
+    n = guest_fd_get(0, p, len - 1);
+    p[n > 0 ? n : 0] = '\0';
+}
+
+void sys_sbrk() {
+    uint32_t old_break = HEAP_BREAK;
+    uint32_t size = (CURRENT_STATE.REGS[4] + 3) & ~3;
+    
+    if (size > MEM_HEAP_END - HEAP_BREAK + 1) {
+        NEXT_STATE.REGS[2] = 0xFFFFFFFF;
+        return;
+    }
+    HEAP_BREAK += size;
+    NEXT_STATE.REGS[2] = old_break;
+}
+
+void sys_exit() {
+    flush_guest_output();
+    GUEST_EXITED = TRUE;
+    RUN_FLAG = FALSE;
+}
+
+void sys_print_char() {
+    uint8_t c = CURRENT_STATE.REGS[4] & 0xFF;
+    guest_fd_put(1, &c, 1);
+}
+
+void sys_read_char() {
+    uint8_t c;
+    NEXT_STATE.REGS[2] = (guest_fd_get(0, &c, 1) == 1) ? c : 0xFFFFFFFF;
+}
+
+void sys_open() {
+    uint32_t avail;
+    uint8_t *path = mem_host_ptr(CURRENT_STATE.REGS[4], &avail);
+    int fd, flags;
+    
+    NEXT_STATE.REGS[2] = 0xFFFFFFFF;
+    if (path == NULL || memchr(path, '\0', avail) == NULL) {
+        return;
+    }
+    /* MARS flags: 0 = read, 1 = write (create/truncate), 9 = append */
+    switch (CURRENT_STATE.REGS[5]) {
+        case 0: flags = O_RDONLY; break;
+        case 1: flags = O_WRONLY | O_CREAT | O_TRUNC; break;
+        case 9: flags = O_WRONLY | O_CREAT | O_APPEND; break;
+        default: return;
+    }
+    for (fd = 3; fd < SYSCALL_FDS; fd++) {
+        if (GUEST_FDS[fd].host_fd < 0) {
+            break;
+        }
+    }
+    if (fd == SYSCALL_FDS) {
+        return;
+    }
+    GUEST_FDS[fd].host_fd = open((char *)path, flags, 0644);
+    if (GUEST_FDS[fd].host_fd < 0) {
+        return;
+    }
+    GUEST_FDS[fd].owned = TRUE;
+    NEXT_STATE.REGS[2] = fd;
+}
+
+void sys_read() {
+    uint32_t fd = CURRENT_STATE.REGS[4];
+    uint32_t len = CURRENT_STATE.REGS[6];
+    uint8_t *p;
+    
+    if (fd >= SYSCALL_FDS || GUEST_FDS[fd].host_fd < 0) {
+        NEXT_STATE.REGS[2] = 0xFFFFFFFF;
+        return;
+    }
+    if (len >= SYSCALL_DIRECT_MIN && GUEST_FDS[fd].host_fd != 0) {
+        NEXT_STATE.REGS[2] = guest_fd_read_direct(fd, CURRENT_STATE.REGS[5], len);
+        return;
+    }
+    p = guest_buffer(CURRENT_STATE.REGS[5], len, TRUE);
+    NEXT_STATE.REGS[2] = (p != NULL) ? (uint32_t)guest_fd_get(fd, p, len) : 0xFFFFFFFF;
+}
+
+void sys_write() {
+    uint32_t fd = CURRENT_STATE.REGS[4];
+    uint32_t len = CURRENT_STATE.REGS[6];
+    uint8_t *p;
+    
+    if (fd >= SYSCALL_FDS || GUEST_FDS[fd].host_fd < 0) {
+        NEXT_STATE.REGS[2] = 0xFFFFFFFF;
+        return;
+    }
+    if (len >= SYSCALL_DIRECT_MIN) {
+        NEXT_STATE.REGS[2] = guest_fd_write_direct(fd, CURRENT_STATE.REGS[5], len);
+        return;
+    }
+    p = guest_buffer(CURRENT_STATE.REGS[5], len, FALSE);
+    if (p == NULL || guest_fd_put(fd, p, len) != 0) {
+        NEXT_STATE.REGS[2] = 0xFFFFFFFF;
+        return;
+    }
+    NEXT_STATE.REGS[2] = len;
+}
+
+void sys_close() {
+    uint32_t fd = CURRENT_STATE.REGS[4];
+    
+    if (fd >= SYSCALL_FDS || GUEST_FDS[fd].host_fd < 0) {
+        return;
+    }
+    flush_guest_fd(fd);
+    if (GUEST_FDS[fd].owned) {
+        close(GUEST_FDS[fd].host_fd);
+    }
+    GUEST_FDS[fd].host_fd = -1;
+    GUEST_FDS[fd].owned = FALSE;
+    GUEST_FDS[fd].in_pos = 0;
+    GUEST_FDS[fd].in_len = 0;
+}
+
+void sys_exit2() {
+    EXIT_CODE = CURRENT_STATE.REGS[4];
+    sys_exit();
+}
+
+/* indexed by $v0 */
+void (*SYSCALL_TABLE[NUM_SYSCALLS])() = {
+    [SYS_PRINT_INT]    = sys_print_int,
+    [SYS_PRINT_STRING] = sys_print_string,
+    [SYS_READ_INT]     = sys_read_int,
+    [SYS_READ_STRING]  = sys_read_string,
+    [SYS_SBRK]         = sys_sbrk,
+    [SYS_EXIT]         = sys_exit,
+    [SYS_PRINT_CHAR]   = sys_print_char,
+    [SYS_READ_CHAR]    = sys_read_char,
+    [SYS_OPEN]         = sys_open,
+    [SYS_READ]         = sys_read,
+    [SYS_WRITE]        = sys_write,
+    [SYS_CLOSE]        = sys_close,
+    [SYS_EXIT2]        = sys_exit2,
+};
+
+/**************************************************************/
+/* Dispatch a SYSCALL on $v0                                                       */
+/**************************************************************/
+void handle_syscall() {
+    uint32_t service = CURRENT_STATE.REGS[2];
+    
+    if (service >= NUM_SYSCALLS || SYSCALL_TABLE[service] == NULL) {
+        flush_guest_output();
+        printf("Unsupported syscall %u at 0x%08x\n", service, CURRENT_STATE.PC);
+        RUN_FLAG = FALSE;
+        return;
+    }
+    if (TT_INTERVAL == 0 || service == SYS_SBRK || service == SYS_EXIT || service == SYS_EXIT2) {
+        SYSCALL_TABLE[service]();
+        return;
+    }
+    /* I/O happens once; replay gets the result and what was read from the log */
+    if (tt_replaying()) {
+        NEXT_STATE.REGS[2] = tt_replay();
+        return;
+    }
+    SYSCALL_TABLE[service]();
+    switch (service) {
+        case SYS_READ_STRING:
+            tt_log(NEXT_STATE.REGS[2], CURRENT_STATE.REGS[4], CURRENT_STATE.REGS[5]);
             break;
-
-			case 0x00000018: //MULT
-            rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			printf("MULT: $%u * $%u\n", rs, rt);
-			break;
-
-            case 0x00000019: //MULT
-            rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-            printf("MULTU: $%u * $%u\n", rs, rt);
+        case SYS_READ:
+            tt_log(NEXT_STATE.REGS[2], CURRENT_STATE.REGS[5], ((int32_t)NEXT_STATE.REGS[2] > 0) ? NEXT_STATE.REGS[2] : 0);
             break;
-
-            case 0x0000001A: //DIV
-            rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			printf("DIV: $%u / $%u\n", rs, rt);
+        default:
+            tt_log(NEXT_STATE.REGS[2], 0, 0);
             break;
+    }
+}
 
-            case 0x00000001B: //DIVU
-            rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			printf("DIVU: $%u / $%u\n", rs, rt);
-            break;
+/************************************************************/
+/* Instruction handlers, named by INSTRUCTION_SET. Instructions that */
+/* execute identically here (ADD and ADDU, ...) share one.           */
+/************************************************************/
+void execute_add(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RD(instruction)] = CURRENT_STATE.REGS[FIELD_RS(instruction)] + CURRENT_STATE.REGS[FIELD_RT(instruction)];
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
 
-			case 0x00000024: //AND
-            rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-			printf("AND: $%u = $%u & $%u\n", rd, rs, rt);
-			break;
-
-			case 0x00000025: //OR
-            rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-			printf("OR: $%u = $%u | $%u\n", rd, rs, rt);
-			break;
-
-			case 0x00000026: //XOR
-			rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-			printf("XOR: $%u = $%u ^ $%u\n", rd, rs, rt);
-			break;
-
-			case 0x00000027: //NOR
-			rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-			printf("NOR: $%u = ~($%u ^ $%u)\n", rd, rs, rt);
-			break;
-
-            case 0x0000002A: //SLT
-			rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-            printf("SLT: if($%u < $%u) $%u = 0x01 if($%u >= $%u) $%u = 0x00\n", rs, rt, rd, rs, rt, rd);
-            break;
+void execute_sub(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RD(instruction)] = CURRENT_STATE.REGS[FIELD_RS(instruction)] - CURRENT_STATE.REGS[FIELD_RT(instruction)];
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
 
-            case 0x00000000: //SLL
-            rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-            sa = instruction & 0x000007C0;
-            sa = sa >> 6;
-			printf("SLL: $%u = $%u << %u\n", rd, rt, sa);
-            break;
+void execute_mult(uint32_t instruction) {
+    uint32_t temp = CURRENT_STATE.REGS[FIELD_RS(instruction)] * CURRENT_STATE.REGS[FIELD_RT(instruction)];
+    
+    NEXT_STATE.HI = temp & 0xFFFF0000;
+    NEXT_STATE.LO = temp & 0x0000FFFF;
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
 
-            case 0x00000002: //SRL
-            rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-            sa = instruction & 0x000007C0;
-            sa = sa >> 6;
-			printf("SRL: $%u = $%u >> %u\n", rd, rt, sa);
-            break;
+void execute_div(uint32_t instruction) {
+    uint32_t s = CURRENT_STATE.REGS[FIELD_RS(instruction)], t = CURRENT_STATE.REGS[FIELD_RT(instruction)];
+    
+    if (t != 0) {
+        NEXT_STATE.HI = s % t;
+        NEXT_STATE.LO = s / t;
+    }
+    else {
+        NEXT_STATE.HI = CURRENT_STATE.HI;
+        NEXT_STATE.LO = CURRENT_STATE.LO;
+    }
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
 
-            case 0x00000003: //SRA
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-            sa = instruction & 0x000007C0;
-            sa = sa >> 6;
-			printf("SRA: $%u = $%u >> %u\n", rd, rt, sa);
-            break;
+void execute_and(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RD(instruction)] = CURRENT_STATE.REGS[FIELD_RS(instruction)] & CURRENT_STATE.REGS[FIELD_RT(instruction)];
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
 
-            case 0x00000010: //MFHI
-            rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-			printf("MFHI: $%u = CURRENT_STATE.HI\n",rd);
-            break;
+void execute_or(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RD(instruction)] = CURRENT_STATE.REGS[FIELD_RS(instruction)] | CURRENT_STATE.REGS[FIELD_RT(instruction)];
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
 
-            case 0x00000012: //MFLO
-			rd = instruction & 0x0000F800;
-			rd = rd >> 11;
-			printf("MFHI: $%u = CURRENT_STATE.HI\n",rd);
-            break;
+void execute_xor(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RD(instruction)] = CURRENT_STATE.REGS[FIELD_RS(instruction)] ^ CURRENT_STATE.REGS[FIELD_RT(instruction)];
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
 
-            case 0x00000011: //MTHI
-            rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			printf("MTHI: NEXT_STATE.HI = $%u\n", rs);
-            break;
+void execute_nor(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RD(instruction)] = ~(CURRENT_STATE.REGS[FIELD_RS(instruction)] ^ CURRENT_STATE.REGS[FIELD_RT(instruction)]);
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
 
-            case 0x00000013: //MTLO
-			rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			printf("MTLO: NEXT_STATE.LO = $%u\n", rs);
-            break;
+void execute_slt(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RD(instruction)] = (CURRENT_STATE.REGS[FIELD_RS(instruction)] < CURRENT_STATE.REGS[FIELD_RT(instruction)]) ? 0x01 : 0x00;
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
 
-            case 0x00000008: //JR
-            rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			printf("JR: NEXT_STATE.PC = $%u\n", rs);
-            break;
+void execute_sll(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RD(instruction)] = CURRENT_STATE.REGS[FIELD_RT(instruction)] << FIELD_SA(instruction);
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
 
-            case 0x00000009: //JALR
-            rs = instruction & 0x03E00000;
-			rs = rs >> 21;
-			printf("JALR: NEXT_STATE.PC = $%u\n", rs);
-            break;
+void execute_srl(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RD(instruction)] = CURRENT_STATE.REGS[FIELD_RT(instruction)] >> FIELD_SA(instruction);
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
 
-			case 0x0000000C:  //SYSTEMCALL
-			printf("SYTEMCALL\n");
-			break;
-                
-        }
-    }
-    else{
-        op = instruction & 0xFC000000;
-        switch(op){
-            case 0x3C000000: //LUI
-            immediate = instruction & 0x0000FFFF;
-            immediate = immediate << 16;
-            rt = instruction & 0x001F0000;
-            rt = rt >> 16;
-            printf("LUI: $%u = %u\n", rt, immediate);
-            break;
-                
-            case 0x24000000: //ADDIU
-            immediate = instruction & 0x0000FFFF;
-            if((immediate & 0x00008000) == 0x00008000){
-                immediate = immediate | 0xFFFF0000;
-            }
-            else{
-                immediate = immediate & 0x0000FFFF;
-            }
-            rt = instruction & 0x001F0000;
-            rt = rt >> 16;
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            printf("ADDIU: $%u = $%u + %u\n", rt, rs, immediate);
-            break;
+void execute_sra(uint32_t instruction) {
+    uint32_t t = CURRENT_STATE.REGS[FIELD_RT(instruction)], sa = FIELD_SA(instruction);
+    
+    /* negative values shift in a single sign bit whatever the amount (and not at all for 0) */
+    if ((t & 0x80000000) == 0x80000000) {
+        if (sa > 0) {
+            NEXT_STATE.REGS[FIELD_RD(instruction)] = (t >> 1) | 0x80000000;
+        }
+    }
+    else {
+        NEXT_STATE.REGS[FIELD_RD(instruction)] = t >> sa;
+    }
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
 
-            case 0x20000000: //ADDI
-            immediate = instruction & 0x0000FFFF;
-            if((immediate & 0x00008000) == 0x00008000){
-                immediate = immediate | 0xFFFF0000;
-            }
-            else{
-                immediate = immediate & 0x0000FFFF;
-            }
-            rt = instruction & 0x001F0000;
-            rt = rt >> 16;
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            printf("ADDI: $%u = $%u + %u\n", rt, rs, immediate);
-            break;
-                
-            case 0x8C000000: //LW
-            base = instruction & 0x03E00000;
-            base = base >> 21;
-            immediate = instruction & 0x0000FFFF;
-            if((immediate & 0x00008000) == 0x00008000){
-                immediate = immediate | 0xFFFF0000;
-            }
-            else{
-                immediate = immediate & 0x0000FFFF;
-            }
-            rt = instruction & 0x001F0000;
-            rt = rt >> 16;
-            mem_location = CURRENT_STATE.REGS[base] + immediate;
-            mem_location = mem_location | 0x00010000;
-            printf("LW: $%u = MEM[%x]\n",rt, mem_location);
-            break;
+void execute_mfhi(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RD(instruction)] = CURRENT_STATE.HI;
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
 
-            case 0x84000000: //LH
-            base = instruction & 0x03E00000;
-            base = base >> 21;
-            immediate = instruction & 0x0000FFFF;
-            if((immediate & 0x00008000) == 0x00008000){
-                immediate = immediate | 0xFFFF0000;
-            }
-            else{
-                immediate = immediate & 0x0000FFFF;
-            }
-            rt = instruction & 0x001F0000;
-            rt = rt >> 16;
-            mem_location = CURRENT_STATE.REGS[base] + immediate;
-            mem_location = mem_location | 0x00010000;
-            printf("LH: $%u = MEM[%x]\n", rt, mem_location);
-            break;
+void execute_mflo(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RD(instruction)] = CURRENT_STATE.LO;
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
 
-            case 0xAC000000: //SW
-            base = instruction & 0x03E00000;
-			base = base >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			immediate = instruction & 0x0000FFFF;
-            if((immediate & 0x00008000) == 0x00008000){
-                immediate = immediate | 0xFFFF0000;
-            }
-            else{
-                immediate = immediate & 0x0000FFFF;
-            }
-			mem_location = CURRENT_STATE.REGS[base] + immediate;
-            mem_location = mem_location | 0x00010000;
-			printf("SW: MEM[%x] = $%u\n", mem_location, rt);
-			break;
-
-            case 0x30000000: //ANDI
-            immediate = instruction & 0x0000FFFF;
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-            printf("ANDI: $%u = $%u & %u\n", rt, rs, immediate);
-            break;
+void execute_mthi(uint32_t instruction) {
+    NEXT_STATE.HI = CURRENT_STATE.REGS[FIELD_RS(instruction)];
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
 
-            case 0x34000000: //ORI
-            immediate = instruction & 0x0000FFFF;
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-            printf("ORI: $%u = $%u | %u\n", rt, rs, immediate);
-            break;
+void execute_mtlo(uint32_t instruction) {
+    NEXT_STATE.LO = CURRENT_STATE.REGS[FIELD_RS(instruction)];
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
 
-            case 0x38000000: //XORI
-            immediate = instruction & 0x0000FFFF;
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-            printf("XORI: $%u = $%u ^ %u\n", rt, rs, immediate);
-            break;
+void execute_jr(uint32_t instruction) {
+    NEXT_STATE.PC = CURRENT_STATE.REGS[FIELD_RS(instruction)];
+    RETIRED.flags = TRACE_JUMP;
+    BLOCK_END = TRUE;
+}
 
-            case 0x28000000: //SLTI
-            immediate = instruction & 0x0000FFFF;
-            if((immediate & 0x00008000) == 0x00008000){
-                immediate = immediate | 0xFFFF0000;
-            }
-            else{
-                immediate = immediate & 0x0000FFFF;
-            }
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-            printf("SLTI: if($%u < %u) $%u = 0x01 if($%u >= %u) $%u = 0x00\n", rs, immediate, rt, rs, immediate, rt);
-            break;
+void execute_jalr(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RD(instruction)] = CURRENT_STATE.PC + 8;
+    NEXT_STATE.PC = CURRENT_STATE.REGS[FIELD_RS(instruction)];
+    RETIRED.flags = TRACE_JUMP;
+    BLOCK_END = TRUE;
+}
 
-            case 0xA4000000: //SH
-            base = instruction & 0x03E00000;
-			base = base >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			immediate = instruction & 0x0000FFFF;
-            if((immediate & 0x00008000) == 0x00008000){
-                immediate = immediate | 0xFFFF0000;
-            }
-            else{
-                immediate = immediate & 0x0000FFFF;
-            }
-			mem_location = CURRENT_STATE.REGS[base] + immediate;
-            mem_location = mem_location | 0x00010000;
-            printf("SH: MEM[%x] = $%u\n", mem_location, rt);
-            break;
+void execute_syscall(uint32_t instruction) {
+    handle_syscall();
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+    BLOCK_END = TRUE;
+}
 
-            case 0xA0000000: //SB
-            base = instruction & 0x03E00000;
-			base = base >> 21;
-			rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-			immediate = instruction & 0x0000FFFF;
-            if((immediate & 0x00008000) == 0x00008000){
-                immediate = immediate | 0xFFFF0000;
-            }
-            else{
-                immediate = immediate & 0x0000FFFF;
-            }
-			mem_location = CURRENT_STATE.REGS[base] + immediate;
-            mem_location = mem_location | 0x00010000;
-            printf("SB: MEM[%x] = $%u\n", mem_location, rt);
-            break;
+void execute_lui(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RT(instruction)] = FIELD_IMM(instruction) << 16;
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
 
-            case 0x0C000000: //JAL
-            target = instruction & 0x03FFFFFF;
-            target = target << 2; 
-            printf("JAL: %u\n", target);
-            break;
+void execute_addi(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RT(instruction)] = CURRENT_STATE.REGS[FIELD_RS(instruction)] + FIELD_SIMM(instruction);
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
 
-            case 0x08000000: //J
-            target = instruction & 0x03FFFFFF;
-            target = target << 2;
-            printf("J: %u\n", target);
-            break;
+/************************************************************/
+/* Effective address of a load or store, recorded in RETIRED        */
+/************************************************************/
+uint32_t access_address(uint32_t instruction, uint32_t size) {
+    uint32_t address = (CURRENT_STATE.REGS[FIELD_RS(instruction)] + FIELD_SIMM(instruction)) | 0x00010000;
+    
+    RETIRED.addr = address;
+    RETIRED.size = size;
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+    return address;
+}
 
-            case 0x80000000: //LB
-            base = instruction & 0x03E00000;
-            base = base >> 21;
-            immediate = instruction & 0x0000FFFF;
-            if((immediate & 0x00008000) == 0x00008000){
-                immediate = immediate | 0xFFFF0000;
-            }
-            else{
-                immediate = immediate & 0x0000FFFF;
-            }
-            rt = instruction & 0x001F0000;
-            rt = rt >> 16;
-            mem_location = CURRENT_STATE.REGS[base] + immediate;
-            mem_location = mem_location | 0x00010000;
-            printf("LB: $%u = MEM[%x]\n", rt, mem_location);
-            break;
+void execute_lw(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RT(instruction)] = mem_read_32(access_address(instruction, 4));
+}
 
-            case 0x10000000: //BEQ
-            target = instruction & 0x0000FFFF;
-            target = target << 2;
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-            if((target & 0x00008000) == 0x00008000){
-                target = target | 0xFFFF0000;
-            }
-            else{
-                target = target & 0x0000FFFF;
-            }
-            printf("BEQ: if($%u = $%u) PC = PC + %u\n", rs, rt, target);
-            break;
+void execute_lb(uint32_t instruction) {
+    uint32_t value = mem_read_32(access_address(instruction, 1)) & 0x000000FF;
+    
+    NEXT_STATE.REGS[FIELD_RT(instruction)] = (value & 0x00000080) ? value | 0xFFFFFF00 : value;
+}
 
-            case 0x14000000: //BNE
-            target = instruction & 0x0000FFFF;
-            target = target << 2;
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-            if((target & 0x00008000) == 0x00008000){
-                target = target | 0xFFFF0000;
-            }
-            else{
-                target = target & 0x0000FFFF;
-            }
-            printf("BNE: if($%u != $%u) PC = PC + %u\n", rs, rt, target);
-            break; 
-
-            case 0x18000000: //BLEZ
-            target = instruction & 0x0000FFFF;
-            target = target << 2;
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            if((target & 0x00008000) == 0x00008000){
-                target = target | 0xFFFF0000;
-            }
-            else{
-                target = target & 0x0000FFFF;
-            }
-            printf("BLEZ: if($%u <= 0) PC + %u\n", rs, target);
-            break;
+void execute_lh(uint32_t instruction) {
+    uint32_t value = mem_read_32(access_address(instruction, 2)) & 0x0000FFFF;
+    
+    NEXT_STATE.REGS[FIELD_RT(instruction)] = (value & 0x00008000) ? value | 0xFFFF0000 : value;
+}
 
-            case 0x1C000000: //BGTZ
-            target = instruction & 0x0000FFFF;
-            target = target << 2;
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            if((target & 0x00008000) == 0x00008000){
-                target = target | 0xFFFF0000;
-            }
-            else{
-                target = target & 0x0000FFFF;
-            }
-            printf("BGTZ: if($%u > 0) PC + %u\n", rs, target);
-            break; 
+void execute_sw(uint32_t instruction) {
+    RETIRED.flags = TRACE_STORE;
+    mem_write_32(access_address(instruction, 4), CURRENT_STATE.REGS[FIELD_RT(instruction)]);
+}
 
-            case 0x04000000: //BLTZ, BGEZ
-            rt = instruction & 0x001F0000;
-			rt = rt >> 16;
-            target = instruction & 0x0000FFFF;
-            target = target << 2;
-            rs = instruction & 0x03E00000;
-            rs = rs >> 21;
-            if((target & 0x00008000) == 0x00008000){
-                target = target | 0xFFFF0000;
-            }
-            else{
-                target = target & 0x0000FFFF;
-            }
-            if(rt == 0x01){ //BGEZ
-                printf("BGEZ: if($%u >= 0) PC + %u\n", rs, target);
-            }
-            else{ //BLTZ
-                printf("BLTZ: if($%u < 0) PC + %u\n", rs, target);
-            }
-            break; 
-        }
-        
+void execute_sh(uint32_t instruction) {
+    RETIRED.flags = TRACE_STORE;
+    mem_write_partial(access_address(instruction, 2), CURRENT_STATE.REGS[FIELD_RT(instruction)], 2);
+}
+
+void execute_sb(uint32_t instruction) {
+    RETIRED.flags = TRACE_STORE;
+    mem_write_partial(access_address(instruction, 1), CURRENT_STATE.REGS[FIELD_RT(instruction)], 1);
+}
+
+/* ANDI, ORI and XORI take their register operand from rt */
+void execute_andi(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RT(instruction)] = FIELD_IMM(instruction) & CURRENT_STATE.REGS[FIELD_RT(instruction)];
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
+
+void execute_ori(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RT(instruction)] = FIELD_IMM(instruction) | CURRENT_STATE.REGS[FIELD_RT(instruction)];
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
+
+void execute_xori(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RT(instruction)] = FIELD_IMM(instruction) ^ CURRENT_STATE.REGS[FIELD_RT(instruction)];
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
+
+void execute_slti(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RT(instruction)] = (CURRENT_STATE.REGS[FIELD_RS(instruction)] < FIELD_SIMM(instruction)) ? 0x01 : 0x00;
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
+
+void execute_j(uint32_t instruction) {
+    NEXT_STATE.PC = FIELD_TARGET(CURRENT_STATE.PC, instruction);
+    RETIRED.flags = TRACE_JUMP;
+    BLOCK_END = TRUE;
+}
+
+void execute_jal(uint32_t instruction) {
+    NEXT_STATE.REGS[31] = CURRENT_STATE.PC + 8;
+    NEXT_STATE.PC = FIELD_TARGET(CURRENT_STATE.PC, instruction);
+    if (HLE_ENABLED) {
+        hle_call(NEXT_STATE.PC);
+    }
+    RETIRED.flags = TRACE_JUMP;
+    BLOCK_END = TRUE;
+}
+
+/************************************************************/
+/* End the block with a conditional branch (no delay slot)             */
+/************************************************************/
+void branch_if(uint32_t instruction, int taken) {
+    NEXT_STATE.PC = CURRENT_STATE.PC + (taken ? FIELD_OFFSET(instruction) : 4);
+    RETIRED.flags = TRACE_BRANCH;
+    BLOCK_END = TRUE;
+}
+
+void execute_beq(uint32_t instruction) {
+    branch_if(instruction, CURRENT_STATE.REGS[FIELD_RS(instruction)] == CURRENT_STATE.REGS[FIELD_RT(instruction)]);
+}
+
+void execute_bne(uint32_t instruction) {
+    branch_if(instruction, CURRENT_STATE.REGS[FIELD_RS(instruction)] != CURRENT_STATE.REGS[FIELD_RT(instruction)]);
+}
+
+void execute_blez(uint32_t instruction) {
+    uint32_t s = CURRENT_STATE.REGS[FIELD_RS(instruction)];
+    
+    branch_if(instruction, s == 0 || (s & 0x80000000));
+}
+
+void execute_bgtz(uint32_t instruction) {
+    uint32_t s = CURRENT_STATE.REGS[FIELD_RS(instruction)];
+    
+    branch_if(instruction, s != 0 && !(s & 0x80000000));
+}
+
+void execute_bgez(uint32_t instruction) {
+    branch_if(instruction, !(CURRENT_STATE.REGS[FIELD_RS(instruction)] & 0x80000000));
+}
+
+void execute_bltz(uint32_t instruction) {
+    branch_if(instruction, (CURRENT_STATE.REGS[FIELD_RS(instruction)] & 0x80000000) != 0);
+}
+
+void execute_mfc0(uint32_t instruction) {
+    NEXT_STATE.REGS[FIELD_RT(instruction)] = cp0_read(FIELD_RD(instruction), instruction & 0x7);
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+}
+
+void execute_mtc0(uint32_t instruction) {
+    cp0_write(FIELD_RD(instruction), instruction & 0x7, CURRENT_STATE.REGS[FIELD_RT(instruction)]);
+    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+    BLOCK_END = TRUE;
+}
+
+void execute_eret(uint32_t instruction) {
+    NEXT_STATE.CP0[CP0_STATUS] &= ~STATUS_EXL;
+    NEXT_STATE.PC = CURRENT_STATE.CP0[CP0_EPC];
+    NEXT_EVENT_CYCLE = CYCLE_COUNT;
+    BLOCK_END = TRUE;
+}
+
+/* an unknown instruction stops the program before it retires, leaving the PC on it */
+void execute_unknown(uint32_t instruction) {
+    flush_guest_output();
+    printf("Illegal instruction 0x%08x at 0x%08x\n", instruction, CURRENT_STATE.PC);
+    RETIRED.flags |= TRACE_ILLEGAL;
+    RUN_FLAG = FALSE;
+    BLOCK_END = TRUE;
+}
+
+void (*const EXECUTE[NUM_OPCODES])(uint32_t instruction) = {
+    INSTRUCTION_SET(OPCODE_HANDLER)
+    execute_unknown
+};
+
+/************************************************************/
+/* decode and execute instruction                                                                     */
+/************************************************************/
+void handle_instruction()
+{
+    uint32_t instruction = mem_read_32(CURRENT_STATE.PC);
+    
+    RETIRED.pc = CURRENT_STATE.PC;
+    RETIRED.instruction = instruction;
+    RETIRED.size = 0;
+    RETIRED.flags = 0;
+    if (VERBOSE) {
+        printf("Instruction: %x\n",instruction);
+    }
+    EXECUTE[decode_opcode(instruction)](instruction);
+}
+
+
+/************************************************************/
+/* Initialize Memory                                                                                                    */
+/************************************************************/
+void initialize() {
+    init_memory();
+    init_devices();
+    CURRENT_STATE.PC = MEM_TEXT_BEGIN;
+    BLOCK_START_PC = MEM_TEXT_BEGIN;
+    NEXT_STATE = CURRENT_STATE;
+    schedule_timer();
+    init_syscalls();
+    RUN_FLAG = TRUE;
+}
+
+/************************************************************/
+/* Print the program loaded into memory (in MIPS assembly format)    */
+/************************************************************/
+void print_program(){
+    int i;
+    uint32_t addr;
+    
+    for(i=0; i<PROGRAM_SIZE; i++){
+        addr = MEM_TEXT_BEGIN + (i*4);
+        printf("[0x%x]\t", addr);
+        print_instruction(addr);
     }
+}
+
+/************************************************************/
+/* Print the instruction at given memory address (in MIPS assembly format)    */
+/************************************************************/
+void print_instruction(uint32_t addr){
+    fprint_instruction(stdout, addr);
+}
+
+/************************************************************/
+/* Disassemble the instruction at addr to the given stream, from its  */
+/* OPCODE_SYNTAX template                                                      */
+/************************************************************/
+void fprint_instruction(FILE *out, uint32_t addr){
+    uint32_t instruction = mem_read_32(addr);
+    opcode_t op = decode_opcode(instruction);
+    const char *p;
+    int32_t offset;
     
+    fprintf(out, "%s%s", OPCODE_NAMES[op], OPCODE_SYNTAX[op][0] ? ": " : "");
+    for (p = OPCODE_SYNTAX[op]; *p != '\0'; p++) {
+        if (*p != '%') {
+            fputc(*p, out);
+            continue;
+        }
+        switch (*++p) {
+            case 'd': fprintf(out, "%u", FIELD_RD(instruction)); break;
+            case 's': fprintf(out, "%u", FIELD_RS(instruction)); break;
+            case 't': fprintf(out, "%u", FIELD_RT(instruction)); break;
+            case 'a': fprintf(out, "%u", FIELD_SA(instruction)); break;
+            case 'c': fprintf(out, "%u", FIELD_RD(instruction)); break;
+            case 'i': fprintf(out, "%d", (int32_t)FIELD_SIMM(instruction)); break;
+            case 'u': fprintf(out, "%u", FIELD_IMM(instruction)); break;
+            case 'h': fprintf(out, "0x%x", FIELD_IMM(instruction) << 16); break;
+            case 'm':
+                fprintf(out, "%x", (CURRENT_STATE.REGS[FIELD_RS(instruction)] + FIELD_SIMM(instruction)) | 0x00010000);
+                break;
+            case 'b':
+                offset = (int32_t)FIELD_OFFSET(instruction);
+                fprintf(out, "%c %d", offset < 0 ? '-' : '+', offset < 0 ? -offset : offset);
+                break;
+            case 'j': fprintf(out, "0x%08x", FIELD_TARGET(addr, instruction)); break;
+            case 'w': fprintf(out, "0x%08x", instruction); break;
+        }
+    }
+    if (op != OP_UNKNOWN && !instruction_valid(instruction)) {
+        fprintf(out, " (invalid encoding)");
+    }
+    fputc('\n', out);
+}
+
+/***************************************************************/
+/* Print command line options                                                               */
+/***************************************************************/
+void usage(const char *prog) {
+    printf("Usage: %s [options] <input program (.in hex or .s assembly)>\n", prog);
+    printf("       %s -R <trace> [-C <config>]...\n\n", prog);
+    printf("-q\t\t-- do not echo each instruction\n");
+    printf("-k <file>\t-- load an exception handler at 0x%08x\n", EXCEPTION_VECTOR);
+    printf("-u <file>\t-- send UART output to <file>\n");
+    printf("-b <file>\t-- attach <file> as the block device image\n");
+    printf("-p <file>\t-- profile basic blocks, report to <file> (.json or .csv)\n");
+    printf("-s\t\t-- print the instruction mix at exit\n");
+    printf("-t <file>\t-- write a compressed instruction/memory trace\n");
+    printf("-C <config>\t-- add a timing model, e.g. i=16k:2:32,d=32k:4:32,bp=1024,mem=20,br=3\n");
+    printf("-M <file>\t-- write LRU miss-ratio curves for all cache sizes (CSV)\n");
+    printf("-S\t\t-- run the timing models on the simulator thread\n");
+    printf("-B <file>\t-- write SimPoint basic block vectors, one per interval\n");
+    printf("-I <n>\t\t-- interval length in instructions (default %d)\n", INTERVAL_DEFAULT);
+    printf("-P <file>\t-- checkpoint the start of each interval listed in a .simpoints file\n");
+    printf("-L <file>\t-- start from a checkpoint instead of loading a program\n");
+    printf("-D <file>\t-- simulate the checkpointed intervals of a .simpoints file in parallel\n");
+    printf("-H\t\t-- interpret memcpy/memset/strlen instead of running them natively\n");
+    printf("-F\t\t-- interpret idle and polling loops instead of fast-forwarding them\n");
+    printf("-V <file>\t-- run one copy per line of <file> (e.g. \"4=1 5=0x10 hi=0\") in lockstep\n");
+    printf("-N <n>\t\t-- instruction budget of a lockstep lane or -X run (default %d) or fuzz run (default %d)\n",
+           LOCKSTEP_DEFAULT_LIMIT, FUZZ_DEFAULT_BUDGET);
+    printf("-Z <dir>\t-- fuzz the program with the inputs in <dir> ($a0 = input, $a1 = length)\n");
+    printf("-X\t\t-- run the program on every engine and compare their state after each block\n");
+    printf("-E\t\t-- measure host cycles, instructions, branch and cache misses per guest instruction\n");
+    printf("-J <file>\t-- like -E, and write guest MIPS/s, load and startup time and peak RSS as JSON\n");
+    printf("-A <file>\t-- assemble the program (.s) into <file> in the .in hex format and exit\n");
+    printf("-T <n>\t\t-- snapshot every <n> instructions so rstep/rcontinue can go back in time\n");
+    printf("-R <trace>\t-- replay a trace through the timing models instead of simulating\n\n");
 }
 
 /***************************************************************/
@@ -1381,14 +6397,212 @@ int main(int argc, char *argv[]) {
     printf("Welcome to MU-MIPS SIM...\n");
     printf("**************************\n\n");
     
-    if (argc < 2) {
-        printf("Error: You should provide input file.\nUsage: %s <input program> \n\n",  argv[0]);
+    int opt;
+    HOST.process_start = host_clock();
+    decode_init();
+    VERBOSE = TRUE;
+    HLE_ENABLED = TRUE;
+    SPIN_FF = TRUE;
+    while ((opt = getopt(argc, argv, "k:qu:b:p:st:C:R:M:SB:I:P:L:D:HFV:N:Z:XEJ:A:T:")) != -1) {
+        switch (opt) {
+            case 'k':
+                strncpy(kernel_file, optarg, sizeof(kernel_file) - 1);
+                break;
+            case 'u':
+                strncpy(uart_file, optarg, sizeof(uart_file) - 1);
+                break;
+            case 'b':
+                strncpy(block_file, optarg, sizeof(block_file) - 1);
+                break;
+            case 'p':
+                PROFILE = TRUE;
+                strncpy(profile_file, optarg, sizeof(profile_file) - 1);
+                break;
+            case 's':
+                MIX_REPORT = TRUE;
+                break;
+            case 't':
+                strncpy(trace_file, optarg, sizeof(trace_file) - 1);
+                break;
+            case 'C':
+                if (timing_add_config(optarg) != 0) {
+                    exit(1);
+                }
+                break;
+            case 'M':
+                strncpy(reuse_file, optarg, sizeof(reuse_file) - 1);
+                reuse_init();
+                break;
+            case 'S':
+                SERIAL_TIMING = TRUE;
+                break;
+            case 'B':
+                strncpy(bbv_file, optarg, sizeof(bbv_file) - 1);
+                break;
+            case 'I':
+                INTERVAL_LENGTH = strtoull(optarg, NULL, 0);
+                break;
+            case 'P':
+                strncpy(simpoint_file, optarg, sizeof(simpoint_file) - 1);
+                load_simpoints();
+                break;
+            case 'L':
+                strncpy(checkpoint_file, optarg, sizeof(checkpoint_file) - 1);
+                break;
+            case 'D':
+                strncpy(simpoint_file, optarg, sizeof(simpoint_file) - 1);
+                load_simpoints();
+                SAMPLED = TRUE;
+                break;
+            case 'H':
+                HLE_ENABLED = FALSE;
+                break;
+            case 'F':
+                SPIN_FF = FALSE;
+                break;
+            case 'V':
+                strncpy(lanes_file, optarg, sizeof(lanes_file) - 1);
+                break;
+            case 'N':
+                LOCKSTEP_LIMIT = (uint32_t)strtoul(optarg, NULL, 0);
+                FUZZ_BUDGET = LOCKSTEP_LIMIT;
+                break;
+            case 'Z':
+                strncpy(fuzz_dir, optarg, sizeof(fuzz_dir) - 1);
+                break;
+            case 'X':
+                DIFFERENTIAL = TRUE;
+                break;
+            case 'E':
+                HOST_STATS = TRUE;
+                break;
+            case 'J':
+                HOST_STATS = TRUE;
+                strncpy(bench_file, optarg, sizeof(bench_file) - 1);
+                break;
+            case 'R':
+                strncpy(replay_file, optarg, sizeof(replay_file) - 1);
+                break;
+            case 'q':
+                VERBOSE = FALSE;
+                break;
+            case 'A':
+                strncpy(asm_out_file, optarg, sizeof(asm_out_file) - 1);
+                break;
+            case 'T':
+                TT_INTERVAL = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+    
+    if (HOST_STATS) {
+        host_stats_open();
+        atexit(host_stats_report);
+    }
+    
+    if (replay_file[0] != '\0') {
+        if (NUM_TIMING_MODELS == 0) {
+            timing_add_config("");
+        }
+        replay_trace();
+        exit(0);
+    }
+    
+    if (SAMPLED) {
+        if (NUM_TIMING_MODELS == 0) {
+            timing_add_config("");
+        }
+        if (INTERVAL_LENGTH == 0) {
+            INTERVAL_LENGTH = INTERVAL_DEFAULT;
+        }
+        VERBOSE = FALSE;
+        initialize();
+        sampled_run();
+        exit(0);
+    }
+    
+    if (optind >= argc && checkpoint_file[0] == '\0') {
+        printf("Error: You should provide input file.\n");
+        usage(argv[0]);
+        exit(1);
+    }
+    
+    if (asm_out_file[0] != '\0') {
+        initialize();
+        exit(assemble_hex(argv[optind], asm_out_file) != 0);
+    }
+    
+    if (lanes_file[0] != '\0') {
+        VERBOSE = FALSE;
+        initialize();
+        strncpy(prog_file, argv[optind], sizeof(prog_file) - 1);
+        host_stats_load();
+        if (lockstep_load(lanes_file) != 0) {
+            exit(-1);
+        }
+        lockstep_run();
+        exit(0);
+    }
+    
+    if (DIFFERENTIAL) {
+        VERBOSE = FALSE;
+        initialize();
+        strncpy(prog_file, argv[optind], sizeof(prog_file) - 1);
+        load_program();
+        load_kernel();
+        exit(diff_run());
+    }
+    
+    if (fuzz_dir[0] != '\0') {
+        VERBOSE = FALSE;
+        initialize();
+        strncpy(prog_file, argv[optind], sizeof(prog_file) - 1);
+        load_program();
+        load_kernel();
+        fuzz_run();
+        exit(0);
+    }
+    
+    if (TT_INTERVAL != 0 && (trace_file[0] != '\0' || NUM_TIMING_MODELS > 0 || reuse_file[0] != '\0'
+                             || bbv_file[0] != '\0' || NUM_SIMPOINTS > 0)) {
+        printf("Error: -T can't be combined with -t, -C, -M, -B or -P (they would see replayed instructions again)\n");
         exit(1);
     }
+    if (trace_file[0] != '\0') {
+        trace_open();
+        atexit(trace_close);
+    }
+    if (NUM_TIMING_MODELS > 0 && !SERIAL_TIMING && sysconf(_SC_NPROCESSORS_ONLN) > 1) {
+        ring_start();
+    }
+    atexit(timing_report);
+    atexit(reuse_report);
+    atexit(mix_report);
+    if (PROFILE) {
+        atexit(profile_report);
+    }
     
-    strcpy(prog_file, argv[1]);
     initialize();
-    load_program();
+    if (checkpoint_file[0] != '\0') {
+        if (optind < argc) {
+            strncpy(prog_file, argv[optind], sizeof(prog_file) - 1);
+        }
+        if (checkpoint_load(checkpoint_file) != 0) {
+            exit(-1);
+        }
+    }
+    else {
+        strncpy(prog_file, argv[optind], sizeof(prog_file) - 1);
+        host_stats_load();
+    }
+    if (bbv_file[0] != '\0' || NUM_SIMPOINTS > 0) {
+        interval_init();
+        atexit(bbv_close);
+    }
+    tt_start();
     help();
     while (1){
         handle_command();
@@ -1,4 +1,9 @@
 #include <stdint.h>
+#include <stdio.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <signal.h>
 
 #define FALSE 0
 #define TRUE  1
@@ -22,6 +27,10 @@
 #define MEM_STACK_BEGIN 0x7FFFFFFF
 #define MEM_STACK_END  0x10010000
 
+/* sbrk hands out memory upward from here (same base as SPIM/MARS) */
+#define MEM_HEAP_BEGIN 0x10040000
+#define MEM_HEAP_END   0x7FEFFFFF
+
 typedef struct {
 	uint32_t begin, end;
 	uint8_t *mem;
@@ -38,11 +47,111 @@ mem_region_t MEM_REGIONS[] = {
 #define NUM_MEM_REGION 4
 #define MIPS_REGS 32
 
+/******************************************************************************/
+/* Page table: one byte per 4 KiB page. Device pages carry the index of the   */
+/* owning device so plain memory accesses only pay a single table lookup.       */
+/******************************************************************************/
+#define PAGE_SHIFT 12
+#define PAGE_SIZE  (1 << PAGE_SHIFT)
+#define NUM_PAGES  (1 << (32 - PAGE_SHIFT))
+#define PAGE_DEVICE_MASK 0x0F   /* device index + 1, 0 for RAM */
+#define PAGE_WRITTEN     0x10   /* RAM page the program has (possibly) written */
+#define PAGE_DIRTY       0x20   /* written since the last fuzz restore or time-travel snapshot (implies PAGE_WRITTEN) */
+
+uint8_t PAGE_TABLE[NUM_PAGES];
+
+/******************************************************************************/
+/* Memory-mapped devices (in kseg1; bit 16 is set so the $gp remap applied by */
+/* loads and stores leaves these addresses alone)                                           */
+/******************************************************************************/
+#define MAX_MMIO_DEVICES 15
+
+#define UART_BASE   0xBF010000
+#define UART_DATA   0x00      /* read: next received byte, write: transmit byte */
+#define UART_STATUS 0x04      /* bit 0: receive data ready, bit 1: transmitter ready */
+#define UART_RX_READY 0x01
+#define UART_TX_READY 0x02
+
+#define BLOCK_BASE     0xBF011000
+#define BLOCK_SECTOR   0x00   /* first sector of the transfer */
+#define BLOCK_BUFFER   0x04   /* guest address of the transfer buffer */
+#define BLOCK_COUNT    0x08   /* number of sectors */
+#define BLOCK_COMMAND  0x0C   /* write BLOCK_CMD_READ/BLOCK_CMD_WRITE to start */
+#define BLOCK_STATUS   0x10   /* 0 = ok, 1 = error, 2 = no medium */
+#define BLOCK_CAPACITY 0x14   /* image size in sectors */
+#define BLOCK_CMD_READ  1
+#define BLOCK_CMD_WRITE 2
+#define BLOCK_SECTOR_SIZE 512
+
+#define DMA_BASE    0xBF012000
+#define DMA_SRC     0x00
+#define DMA_DST     0x04
+#define DMA_LEN     0x08      /* bytes */
+#define DMA_CONTROL 0x0C      /* write 1 to start the transfer */
+#define DMA_STATUS  0x10      /* 0 = idle/done, 1 = error */
+
+typedef struct {
+	const char *name;
+	uint32_t begin, end;
+	uint32_t (*read)(uint32_t offset);
+	void (*write)(uint32_t offset, uint32_t value);
+} mmio_device_t;
+
+mmio_device_t MMIO_DEVICES[MAX_MMIO_DEVICES];
+int NUM_MMIO_DEVICES;
+
+typedef struct {
+	FILE *tx;          /* host stdout or the file given with -u */
+	int rx_fd;         /* host stdin */
+} uart_t;
+
+typedef struct {
+	int fd;            /* image given with -b, -1 when none */
+	uint32_t sector, buffer, count, status, capacity;
+} block_dev_t;
+
+typedef struct {
+	uint32_t src, dst, len, status;
+} dma_t;
+
+uart_t UART;
+block_dev_t BLOCK_DEV;
+dma_t DMA;
+
+char uart_file[64];
+char block_file[64];
+#define CP0_REGS 32
+
+/******************************************************************************/
+/* Coprocessor 0 (system control)                                                                                                      */
+/******************************************************************************/
+#define CP0_COUNT    9
+#define CP0_COMPARE 11
+#define CP0_STATUS  12
+#define CP0_CAUSE   13
+#define CP0_EPC     14
+#define CP0_PERF    25          /* performance counters, selected by the sel field */
+
+#define STATUS_IE   0x00000001
+#define STATUS_EXL  0x00000002
+#define STATUS_ERL  0x00000004
+#define STATUS_IM7  0x00008000
+#define CAUSE_IP7   0x00008000
+#define CAUSE_IP_MASK 0x0000FF00
+#define CAUSE_EXCCODE_MASK 0x0000007C
+
+/* general exception vector (Status.BEV = 0) */
+#define EXCEPTION_VECTOR 0x80000180
+
+/* Count increments once every COUNT_RATE cycles (every other cycle on the R4400) */
+#define COUNT_RATE_SHIFT 1
+
 typedef struct CPU_State_Struct {
 
   uint32_t PC;		                   /* program counter */
   uint32_t REGS[MIPS_REGS]; /* register file. */
   uint32_t HI, LO;                          /* special regs for mult/div. */
+  uint32_t CP0[CP0_REGS];            /* coprocessor 0 registers (Count is derived from CYCLE_COUNT) */
 } CPU_State;
 
 
@@ -53,10 +162,777 @@ typedef struct CPU_State_Struct {
 
 CPU_State CURRENT_STATE, NEXT_STATE;
 int RUN_FLAG;	/* run flag*/
-uint32_t INSTRUCTION_COUNT;
+uint64_t INSTRUCTION_COUNT;
+uint64_t RUN_END = ~0ULL;       /* instruction count a 'run n' stops at */
 uint32_t PROGRAM_SIZE; /*in words*/
 
-char prog_file[32];
+/***************************************************************/
+/* Timer/interrupt state. Interrupt sources are only polled at basic-block */
+/* boundaries, and only once CYCLE_COUNT reaches NEXT_EVENT_CYCLE.            */
+/***************************************************************/
+uint64_t CYCLE_COUNT;           /* simulated cycles since reset */
+uint64_t NEXT_EVENT_CYCLE;  /* earliest cycle at which an interrupt check is needed */
+uint64_t TIMER_EVENT_CYCLE; /* cycle at which Count will equal Compare */
+uint32_t COUNT_BASE;             /* Count = COUNT_BASE + (CYCLE_COUNT >> COUNT_RATE_SHIFT) */
+int BLOCK_END;                          /* set by control-transfer instructions */
+#define MAX_BLOCK_LENGTH 4096           /* straight-line instructions before a block is split */
+
+/***************************************************************/
+/* Syscall layer: guest file descriptors map onto buffered host fds.    */
+/***************************************************************/
+#define SYSCALL_FDS       16
+#define SYSCALL_BUF_SIZE  65536
+#define SYSCALL_DIRECT_MIN 4096  /* read/write at least this large bypass the fd buffers */
+#define SYSCALL_MAX_IOV    4     /* guest buffers may span this many memory regions */
+
+/* $v0 service numbers (SPIM/MARS) */
+#define SYS_PRINT_INT     1
+#define SYS_PRINT_STRING  4
+#define SYS_READ_INT      5
+#define SYS_READ_STRING   8
+#define SYS_SBRK          9
+#define SYS_EXIT         10
+#define SYS_PRINT_CHAR   11
+#define SYS_READ_CHAR    12
+#define SYS_OPEN         13
+#define SYS_READ         14
+#define SYS_WRITE        15
+#define SYS_CLOSE        16
+#define SYS_EXIT2        17
+#define NUM_SYSCALLS     18
+
+typedef struct {
+	int host_fd;        /* -1 when the guest fd is not open */
+	int owned;          /* host_fd was opened by the guest and is closed with it */
+	uint8_t *out;       /* pending output, written with one write(2) when full */
+	uint32_t out_len;
+	uint8_t *in;        /* read-ahead input */
+	uint32_t in_pos, in_len;
+} guest_fd_t;
+
+guest_fd_t GUEST_FDS[SYSCALL_FDS];
+uint32_t HEAP_BREAK;    /* current program break for sbrk */
+int EXIT_CODE;          /* value passed to exit2 */
+int GUEST_EXITED;       /* the program called exit or exit2 */
+int VERBOSE;            /* echo every instruction as it executes */
+
+/***************************************************************/
+/* The instruction set, one line per instruction: opcode class for the */
+/* instruction mix, encoding (instruction & mask == match), fields that */
+/* must be zero in a valid encoding, assembly operands, the handler   */
+/* that executes it and its disassembly. The opcode enum, the decoder, */
+/* the dispatch table, the disassembler, the encoding validator and   */
+/* the assembler are all generated from this list. Where encodings    */
+/* overlap the earlier line wins: BGEZ is REGIMM with rt = 1 and BLTZ */
+/* takes every other rt, as it always has.                             */
+/* Operands: d s t = rd rs rt, a = sa, c = CP0 register (rd), x = an  */
+/* optional CP0 select, i / u = signed / unsigned immediate,          */
+/* m = offset(base), b = branch target, j = jump target.              */
+/* Disassembly: the same letters after %, and %h = immediate << 16;   */
+/* %m is the effective address and %b the branch offset.             */
+/***************************************************************/
+#define MASK_OP    0xFC000000       /* primary opcode */
+#define MASK_FUNCT 0xFC00003F       /* SPECIAL: primary opcode and funct */
+#define MASK_RT    0xFC1F0000       /* REGIMM: primary opcode and rt */
+#define MASK_RS    0xFFE00000       /* COP0 moves: primary opcode and rs */
+#define MASK_CO    0xFE00003F       /* COP0 functions: primary opcode, CO and funct */
+
+#define INSTRUCTION_SET(X) \
+	X(ADD,     CLASS_ALU,     0x00000020, MASK_FUNCT, 0x000007C0, "d,s,t", execute_add,     "$%d = $%s + $%t") \
+	X(ADDU,    CLASS_ALU,     0x00000021, MASK_FUNCT, 0x000007C0, "d,s,t", execute_add,     "$%d = $%s + $%t") \
+	X(SUB,     CLASS_ALU,     0x00000022, MASK_FUNCT, 0x000007C0, "d,s,t", execute_sub,     "$%d = $%s - $%t") \
+	X(SUBU,    CLASS_ALU,     0x00000023, MASK_FUNCT, 0x000007C0, "d,s,t", execute_sub,     "$%d = $%s - $%t") \
+	X(MULT,    CLASS_MULDIV,  0x00000018, MASK_FUNCT, 0x0000FFC0, "s,t",   execute_mult,    "$%s * $%t") \
+	X(MULTU,   CLASS_MULDIV,  0x00000019, MASK_FUNCT, 0x0000FFC0, "s,t",   execute_mult,    "$%s * $%t") \
+	X(DIV,     CLASS_MULDIV,  0x0000001A, MASK_FUNCT, 0x0000FFC0, "s,t",   execute_div,     "$%s / $%t") \
+	X(DIVU,    CLASS_MULDIV,  0x0000001B, MASK_FUNCT, 0x0000FFC0, "s,t",   execute_div,     "$%s / $%t") \
+	X(AND,     CLASS_ALU,     0x00000024, MASK_FUNCT, 0x000007C0, "d,s,t", execute_and,     "$%d = $%s & $%t") \
+	X(OR,      CLASS_ALU,     0x00000025, MASK_FUNCT, 0x000007C0, "d,s,t", execute_or,      "$%d = $%s | $%t") \
+	X(XOR,     CLASS_ALU,     0x00000026, MASK_FUNCT, 0x000007C0, "d,s,t", execute_xor,     "$%d = $%s ^ $%t") \
+	X(NOR,     CLASS_ALU,     0x00000027, MASK_FUNCT, 0x000007C0, "d,s,t", execute_nor,     "$%d = ~($%s ^ $%t)") \
+	X(SLT,     CLASS_ALU,     0x0000002A, MASK_FUNCT, 0x000007C0, "d,s,t", execute_slt,     "if($%s < $%t) $%d = 0x01 if($%s >= $%t) $%d = 0x00") \
+	X(SLL,     CLASS_ALU,     0x00000000, MASK_FUNCT, 0x03E00000, "d,t,a", execute_sll,     "$%d = $%t << %a") \
+	X(SRL,     CLASS_ALU,     0x00000002, MASK_FUNCT, 0x03E00000, "d,t,a", execute_srl,     "$%d = $%t >> %a") \
+	X(SRA,     CLASS_ALU,     0x00000003, MASK_FUNCT, 0x03E00000, "d,t,a", execute_sra,     "$%d = $%t >> %a") \
+	X(MFHI,    CLASS_MULDIV,  0x00000010, MASK_FUNCT, 0x03FF07C0, "d",     execute_mfhi,    "$%d = HI") \
+	X(MFLO,    CLASS_MULDIV,  0x00000012, MASK_FUNCT, 0x03FF07C0, "d",     execute_mflo,    "$%d = LO") \
+	X(MTHI,    CLASS_MULDIV,  0x00000011, MASK_FUNCT, 0x001FFFC0, "s",     execute_mthi,    "HI = $%s") \
+	X(MTLO,    CLASS_MULDIV,  0x00000013, MASK_FUNCT, 0x001FFFC0, "s",     execute_mtlo,    "LO = $%s") \
+	X(JR,      CLASS_JUMP,    0x00000008, MASK_FUNCT, 0x001FFFC0, "s",     execute_jr,      "PC = $%s") \
+	X(JALR,    CLASS_JUMP,    0x00000009, MASK_FUNCT, 0x001F07C0, "d,s",   execute_jalr,    "$%d = PC + 8, PC = $%s") \
+	X(SYSCALL, CLASS_SYSCALL, 0x0000000C, MASK_FUNCT, 0x00000000, "",      execute_syscall, "") \
+	X(LUI,     CLASS_ALU,     0x3C000000, MASK_OP,    0x03E00000, "t,u",   execute_lui,     "$%t = %h") \
+	X(ADDI,    CLASS_ALU,     0x20000000, MASK_OP,    0x00000000, "t,s,i", execute_addi,    "$%t = $%s + %i") \
+	X(ADDIU,   CLASS_ALU,     0x24000000, MASK_OP,    0x00000000, "t,s,i", execute_addi,    "$%t = $%s + %i") \
+	X(LW,      CLASS_LOAD,    0x8C000000, MASK_OP,    0x00000000, "t,m",   execute_lw,      "$%t = MEM[%m]") \
+	X(LB,      CLASS_LOAD,    0x80000000, MASK_OP,    0x00000000, "t,m",   execute_lb,      "$%t = MEM[%m]") \
+	X(LH,      CLASS_LOAD,    0x84000000, MASK_OP,    0x00000000, "t,m",   execute_lh,      "$%t = MEM[%m]") \
+	X(SW,      CLASS_STORE,   0xAC000000, MASK_OP,    0x00000000, "t,m",   execute_sw,      "MEM[%m] = $%t") \
+	X(SH,      CLASS_STORE,   0xA4000000, MASK_OP,    0x00000000, "t,m",   execute_sh,      "MEM[%m] = $%t") \
+	X(SB,      CLASS_STORE,   0xA0000000, MASK_OP,    0x00000000, "t,m",   execute_sb,      "MEM[%m] = $%t") \
+	X(ANDI,    CLASS_ALU,     0x30000000, MASK_OP,    0x00000000, "t,s,u", execute_andi,    "$%t = $%t & %u") \
+	X(ORI,     CLASS_ALU,     0x34000000, MASK_OP,    0x00000000, "t,s,u", execute_ori,     "$%t = $%t | %u") \
+	X(XORI,    CLASS_ALU,     0x38000000, MASK_OP,    0x00000000, "t,s,u", execute_xori,    "$%t = $%t ^ %u") \
+	X(SLTI,    CLASS_ALU,     0x28000000, MASK_OP,    0x00000000, "t,s,i", execute_slti,    "if($%s < %i) $%t = 0x01 if($%s >= %i) $%t = 0x00") \
+	X(J,       CLASS_JUMP,    0x08000000, MASK_OP,    0x00000000, "j",     execute_j,       "%j") \
+	X(JAL,     CLASS_JUMP,    0x0C000000, MASK_OP,    0x00000000, "j",     execute_jal,     "%j") \
+	X(BEQ,     CLASS_BRANCH,  0x10000000, MASK_OP,    0x00000000, "s,t,b", execute_beq,     "if($%s == $%t) PC = PC %b") \
+	X(BNE,     CLASS_BRANCH,  0x14000000, MASK_OP,    0x00000000, "s,t,b", execute_bne,     "if($%s != $%t) PC = PC %b") \
+	X(BLEZ,    CLASS_BRANCH,  0x18000000, MASK_OP,    0x001F0000, "s,b",   execute_blez,    "if($%s <= 0) PC = PC %b") \
+	X(BGTZ,    CLASS_BRANCH,  0x1C000000, MASK_OP,    0x001F0000, "s,b",   execute_bgtz,    "if($%s > 0) PC = PC %b") \
+	X(BGEZ,    CLASS_BRANCH,  0x04010000, MASK_RT,    0x00000000, "s,b",   execute_bgez,    "if($%s >= 0) PC = PC %b") \
+	X(BLTZ,    CLASS_BRANCH,  0x04000000, MASK_OP,    0x001F0000, "s,b",   execute_bltz,    "if($%s < 0) PC = PC %b") \
+	X(MFC0,    CLASS_SYSTEM,  0x40000000, MASK_RS,    0x000007F8, "t,c,x", execute_mfc0,    "$%t = CP0[%c]") \
+	X(MTC0,    CLASS_SYSTEM,  0x40800000, MASK_RS,    0x000007F8, "t,c,x", execute_mtc0,    "CP0[%c] = $%t") \
+	X(ERET,    CLASS_SYSTEM,  0x42000018, MASK_CO,    0x01FFFFC0, "",      execute_eret,    "")
+
+/* generators for the tables below and the handler prototypes */
+#define OPCODE_ENUM(name, class, match, mask, zero, operands, execute, syntax)        OP_##name,
+#define OPCODE_NAME(name, class, match, mask, zero, operands, execute, syntax)        #name,
+#define OPCODE_CLASS_OF(name, class, match, mask, zero, operands, execute, syntax)    class,
+#define OPCODE_MATCH(name, class, match, mask, zero, operands, execute, syntax)       match,
+#define OPCODE_MASK(name, class, match, mask, zero, operands, execute, syntax)        mask,
+#define OPCODE_ZERO(name, class, match, mask, zero, operands, execute, syntax)        zero,
+#define OPCODE_OPERANDS_OF(name, class, match, mask, zero, operands, execute, syntax) operands,
+#define OPCODE_SYNTAX_OF(name, class, match, mask, zero, operands, execute, syntax)   syntax,
+#define OPCODE_HANDLER(name, class, match, mask, zero, operands, execute, syntax)     execute,
+#define OPCODE_PROTOTYPE(name, class, match, mask, zero, operands, execute, syntax)   void execute(uint32_t instruction);
+
+/* instruction fields */
+#define FIELD_RS(i)     (((i) >> 21) & 0x1F)
+#define FIELD_RT(i)     (((i) >> 16) & 0x1F)
+#define FIELD_RD(i)     (((i) >> 11) & 0x1F)
+#define FIELD_SA(i)     (((i) >> 6) & 0x1F)
+#define FIELD_IMM(i)    ((i) & 0x0000FFFF)
+#define FIELD_SIMM(i)   ((uint32_t)(int32_t)(int16_t)FIELD_IMM(i))
+/* branch offsets are sign-extended from bit 15 after the shift, not before */
+#define FIELD_OFFSET(i) ((uint32_t)(int32_t)(int16_t)((i) << 2))
+#define FIELD_TARGET(pc, i) (((pc) & 0xF0000000) | (((i) & 0x03FFFFFF) << 2))
+
+/***************************************************************/
+/* Opcodes and opcode classes for the dynamic instruction mix                 */
+/***************************************************************/
+typedef enum {
+	INSTRUCTION_SET(OPCODE_ENUM)
+	OP_UNKNOWN,
+	NUM_OPCODES
+} opcode_t;
+
+typedef enum {
+	CLASS_ALU, CLASS_MULDIV, CLASS_LOAD, CLASS_STORE, CLASS_BRANCH,
+	CLASS_JUMP, CLASS_SYSCALL, CLASS_SYSTEM, CLASS_OTHER,
+	NUM_CLASSES
+} opcode_class_t;
+
+const char *OPCODE_NAMES[NUM_OPCODES] = { INSTRUCTION_SET(OPCODE_NAME) "UNKNOWN" };
+
+const char *CLASS_NAMES[NUM_CLASSES] = {
+	"ALU", "mult/div", "load", "store", "branch", "jump", "syscall", "system", "other"
+};
+
+const uint8_t OPCODE_CLASS[NUM_OPCODES] = { INSTRUCTION_SET(OPCODE_CLASS_OF) CLASS_OTHER };
+
+/* OP_UNKNOWN matches anything, so a scan of these always ends */
+const uint32_t OPCODE_MATCHES[NUM_OPCODES] = { INSTRUCTION_SET(OPCODE_MATCH) 0 };
+const uint32_t OPCODE_MASKS[NUM_OPCODES] = { INSTRUCTION_SET(OPCODE_MASK) 0 };
+const uint32_t OPCODE_ZEROS[NUM_OPCODES] = { INSTRUCTION_SET(OPCODE_ZERO) 0 };
+const char *OPCODE_OPERANDS[NUM_OPCODES] = { INSTRUCTION_SET(OPCODE_OPERANDS_OF) "" };
+const char *OPCODE_SYNTAX[NUM_OPCODES] = { INSTRUCTION_SET(OPCODE_SYNTAX_OF) "%w" };
+
+/* Decoder: opcode_t by primary opcode and funct, built from the list at */
+/* startup. DECODE_SCAN marks the cells that need more bits (REGIMM, COP0) */
+#define DECODE_SCAN NUM_OPCODES
+uint8_t DECODE_TABLE[64 * 64];
+
+/***************************************************************/
+/* Block cache: one entry per basic block (keyed by start PC), used for */
+/* per-block accounting such as the execution profile.                      */
+/***************************************************************/
+typedef struct {
+	uint32_t start;         /* PC of the first instruction */
+	uint32_t length;        /* instructions up to and including the control transfer, 0 = free slot */
+	uint64_t count;         /* times the block was executed */
+	uint64_t taken;         /* times its closing branch/jump was taken */
+	uint8_t *ops;           /* opcode_t of each instruction, decoded once */
+	uint32_t bbv_id;        /* basic block vector dimension, 0 = not yet seen */
+	uint64_t bbv_count;     /* instructions executed in the current interval */
+	uint8_t spin;           /* SPIN_* classification when it loops to itself */
+} block_t;
+
+typedef struct {
+	uint32_t pc;
+	uint64_t count;
+} pc_count_t;
+
+block_t *BLOCKS;                /* open-addressed hash table */
+uint32_t BLOCK_TABLE_SIZE, NUM_BLOCKS;
+uint32_t BLOCK_START_PC;        /* block currently executing */
+uint64_t BLOCK_START_COUNT;     /* INSTRUCTION_COUNT when it started */
+
+#define PROFILE_TOP 20          /* hotspots shown in the exit report */
+int PROFILE;                    /* count block executions (-p) */
+char profile_file[64];          /* .json or .csv report */
+int MIX_REPORT;                 /* print the instruction mix at exit (-s) */
+
+/***************************************************************/
+/* Retired-instruction record, filled in by handle_instruction() for     */
+/* tracing and other per-instruction consumers                              */
+/***************************************************************/
+#define TRACE_STORE  0x01   /* memory access is a store */
+#define TRACE_BRANCH 0x02   /* conditional branch */
+#define TRACE_JUMP   0x04   /* unconditional jump */
+#define TRACE_TAKEN  0x08   /* control left the sequential path */
+#define TRACE_ILLEGAL 0x10  /* unknown instruction: stops the run without retiring */
+
+typedef struct {
+	uint32_t pc;
+	uint32_t instruction;
+	uint32_t addr;      /* effective address of a load/store */
+	uint8_t size;       /* bytes accessed, 0 for non-memory instructions */
+	uint8_t flags;
+	uint16_t reserved;
+} retire_t;
+
+retire_t RETIRED;
+
+/***************************************************************/
+/* Binary trace writer (-t). Records are handed off in blocks to a      */
+/* background thread that delta-encodes and deflates them while the */
+/* simulator fills the other buffer.                                               */
+/*                                                                                     */
+/* File: "MUTRACE1", uint32 record size, uint32 records per block,   */
+/* then per block: uint32 raw bytes, uint32 compressed bytes, data. */
+/* Each block holds n fixed-width records stored field by field:      */
+/* n PC deltas (from previous PC + 4), n instruction words, n effective */
+/* address deltas (from the previous access), n sizes, n flag bytes. */
+/***************************************************************/
+#define TRACE_MAGIC "MUTRACE1"
+#define TRACE_BLOCK_RECORDS 65536
+#define TRACE_RECORD_BYTES  14
+
+typedef struct {
+	FILE *fp;
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	retire_t *buf[2];           /* double buffer */
+	int fill;                   /* buffer the simulator is filling */
+	uint32_t count;             /* records in buf[fill] */
+	int pending;                /* buf[fill ^ 1] is waiting for the writer */
+	uint32_t pending_count;
+	int done;                   /* no more records */
+	uint64_t records, raw_bytes, compressed_bytes;
+	uint32_t last_pc, last_addr;    /* delta state (writer thread only) */
+} trace_t;
+
+int TRACING;
+trace_t TRACE;
+char trace_file[64];
+
+/***************************************************************/
+/* Timing models: split L1 I/D caches (LRU) plus a bimodal     */
+/* branch predictor, driven by retired-instruction records     */
+/* either live (-C) or from a recorded trace (-R). Several      */
+/* configurations are fed from the same stream.                */
+/***************************************************************/
+#define MAX_TIMING_MODELS 256
+
+typedef struct {
+	uint32_t sets, assoc, line_shift;
+	uint32_t *lines;        /* sets * assoc line numbers, most recently used first */
+	uint64_t accesses, misses;
+} cache_t;
+
+typedef struct {
+	char name[64];          /* configuration string as given */
+	cache_t icache, dcache;
+	uint8_t *bp_table;      /* 2-bit saturating counters */
+	uint32_t bp_entries;
+	uint32_t miss_penalty, mispredict_penalty;
+	uint64_t instructions, cycles, branches, mispredicts;
+} timing_model_t;
+
+/***************************************************************/
+/* Live timing models run on their own thread by default: the     */
+/* simulator publishes retired records into a single-producer,    */
+/* single-consumer ring and only waits when the ring is full.     */
+/* Each side publishes its index every RING_BATCH records to keep */
+/* the shared cache lines quiet. An idle consumer polls RING_SPIN  */
+/* times, then sleeps until the simulator publishes again.          */
+/***************************************************************/
+#define RING_SIZE  (1 << 16)    /* records, power of 2 */
+#define RING_BATCH 256
+#define RING_SPIN  1024
+
+typedef struct {
+	retire_t records[RING_SIZE];
+	_Alignas(64) atomic_uint_fast64_t head;  /* written by the simulator */
+	_Alignas(64) atomic_uint_fast64_t tail;  /* written by the timing thread */
+	_Alignas(64) uint64_t next;              /* simulator's unpublished head */
+	uint64_t tail_seen;                      /* simulator's last view of tail */
+	atomic_int stop;
+	atomic_int sleeping;                     /* the timing thread waits on wake */
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_t consumer;
+} ring_t;
+
+ring_t RING;
+int DECOUPLED;          /* timing models consume RING on a second thread */
+int SERIAL_TIMING;      /* -S: keep them on the simulator thread */
+
+timing_model_t TIMING_MODELS[MAX_TIMING_MODELS];
+int NUM_TIMING_MODELS;
+int RETIRE_HOOKS;               /* something consumes RETIRED after every instruction */
+char replay_file[64];
+
+/***************************************************************/
+/* Stack-distance profiler: one pass over the program's memory  */
+/* references yields the miss ratio of every LRU cache size.     */
+/* Fully associative distances come from a Fenwick tree over     */
+/* last-access timestamps; set-associative ones from per-set     */
+/* stacks for each power-of-two number of sets.                  */
+/***************************************************************/
+#define REUSE_LINE_SHIFT 5
+#define REUSE_MAX_WAYS   16
+#define REUSE_SET_LEVELS 13     /* 1 .. 4096 sets */
+#define REUSE_EMPTY      0xFFFFFFFF
+
+typedef struct {
+	uint32_t *lines;        /* sets * REUSE_MAX_WAYS lines, most recently used first */
+	uint64_t hits[REUSE_MAX_WAYS];  /* references found at each stack depth */
+} reuse_sets_t;
+
+typedef struct {
+	uint32_t *keys, *stamps;        /* line -> timestamp of its last reference */
+	uint32_t table_size, used;
+	uint32_t *tree;                 /* Fenwick tree marking live timestamps */
+	uint32_t capacity, now;
+	uint64_t *hist;                 /* references by stack distance */
+	uint32_t hist_size;
+	uint64_t accesses, cold;
+	reuse_sets_t sets[REUSE_SET_LEVELS];
+} reuse_t;
+
+reuse_t REUSE;
+int REUSE_PROFILE;
+int REUSE_ACTIVE;
+char reuse_file[64];
+
+/***************************************************************/
+/* SimPoint support. Execution is cut into intervals of           */
+/* INTERVAL_LENGTH instructions (ending at the next block          */
+/* boundary). -B writes one basic block vector per interval in     */
+/* SimPoint .bb format for the simpoint tool to cluster; -P then   */
+/* checkpoints the start of the chosen intervals and -L restores   */
+/* one. Checkpoints hold the CPU state and every written page.     */
+/***************************************************************/
+#define INTERVAL_DEFAULT 1000000
+#define CHECKPOINT_MAGIC "MUCKPT03"
+#define CHECKPOINT_END   0xFFFFFFFF
+
+uint64_t INTERVAL_LENGTH;
+uint64_t INTERVAL_END = ~0ULL;  /* instruction count that closes the current interval */
+uint32_t INTERVAL_INDEX;
+FILE *BBV_FILE;
+uint32_t *BBV_TOUCHED;          /* start PCs of blocks counted this interval */
+uint32_t BBV_NUM_TOUCHED, BBV_TOUCHED_SIZE;
+uint32_t BBV_NEXT_ID;
+uint32_t *SIMPOINTS;            /* intervals to checkpoint */
+uint32_t NUM_SIMPOINTS;
+char bbv_file[64];
+char simpoint_file[64];
+
+/* Sampled simulation (-D): each checkpointed interval runs in its own */
+/* forked copy of the simulator and reports these counters by pipe.    */
+typedef struct {
+	uint64_t instructions, cycles;
+	uint64_t icache_accesses, icache_misses, dcache_accesses, dcache_misses;
+	uint64_t branches, mispredicts;
+} sample_result_t;
+
+int SAMPLED;
+char checkpoint_file[64];
+
+/***************************************************************/
+/* High-level emulation: a JAL into one of these routines (found   */
+/* by signature: $a0-$a2 arguments, $v0 result, one scratch        */
+/* register, jr $ra) is executed natively. Masked fields hold the  */
+/* scratch register. Turned off by -H and whenever retired         */
+/* instructions are traced or profiled.                             */
+/***************************************************************/
+#define HLE_CACHE_SIZE   256
+#define HLE_MAX_STRING   (1 << 24)
+#define HLE_MAX_PATTERN  9
+
+typedef enum { HLE_NONE, HLE_MEMCPY, HLE_MEMSET, HLE_STRLEN, NUM_HLE_ROUTINES } hle_routine_t;
+
+typedef struct {
+	uint32_t word, mask;
+} hle_pattern_t;
+
+typedef struct {
+	uint32_t target;
+	uint8_t valid, routine, temp;
+} hle_entry_t;
+
+const char *HLE_NAMES[NUM_HLE_ROUTINES] = { "", "memcpy", "memset", "strlen" };
+const int HLE_SIGNATURE_LENGTH[NUM_HLE_ROUTINES] = { 0, 9, 7, 7 };
+const hle_pattern_t HLE_SIGNATURES[NUM_HLE_ROUTINES][HLE_MAX_PATTERN] = {
+	{ { 0, 0 } },
+	/* memcpy: byte copy forwards, returns dest */
+	{ { 0x00801021, 0xFFFFFFFF },   /*       addu  $v0, $a0, $zero */
+	  { 0x10C00007, 0xFFFFFFFF },   /* loop: beq   $a2, $zero, done */
+	  { 0x80A00000, 0xFFE0FFFF },   /*       lb    $t, 0($a1) */
+	  { 0xA0800000, 0xFFE0FFFF },   /*       sb    $t, 0($a0) */
+	  { 0x24840001, 0xFFFFFFFF },   /*       addiu $a0, $a0, 1 */
+	  { 0x24A50001, 0xFFFFFFFF },   /*       addiu $a1, $a1, 1 */
+	  { 0x24C6FFFF, 0xFFFFFFFF },   /*       addiu $a2, $a2, -1 */
+	  { 0x1000FFFA, 0xFFFFFFFF },   /*       beq   $zero, $zero, loop */
+	  { 0x03E00008, 0xFFFFFFFF } }, /* done: jr    $ra */
+	/* memset: store the low byte of $a1 $a2 times, returns dest */
+	{ { 0x00801021, 0xFFFFFFFF },   /*       addu  $v0, $a0, $zero */
+	  { 0x10C00005, 0xFFFFFFFF },   /* loop: beq   $a2, $zero, done */
+	  { 0xA0850000, 0xFFFFFFFF },   /*       sb    $a1, 0($a0) */
+	  { 0x24840001, 0xFFFFFFFF },   /*       addiu $a0, $a0, 1 */
+	  { 0x24C6FFFF, 0xFFFFFFFF },   /*       addiu $a2, $a2, -1 */
+	  { 0x1000FFFC, 0xFFFFFFFF },   /*       beq   $zero, $zero, loop */
+	  { 0x03E00008, 0xFFFFFFFF } }, /* done: jr    $ra */
+	/* strlen */
+	{ { 0x00001021, 0xFFFFFFFF },   /*       addu  $v0, $zero, $zero */
+	  { 0x80800000, 0xFFE0FFFF },   /* loop: lb    $t, 0($a0) */
+	  { 0x10000004, 0xFC1FFFFF },   /*       beq   $t, $zero, done */
+	  { 0x24840001, 0xFFFFFFFF },   /*       addiu $a0, $a0, 1 */
+	  { 0x24420001, 0xFFFFFFFF },   /*       addiu $v0, $v0, 1 */
+	  { 0x1000FFFC, 0xFFFFFFFF },   /*       beq   $zero, $zero, loop */
+	  { 0x03E00008, 0xFFFFFFFF } }  /* done: jr    $ra */
+};
+
+hle_entry_t HLE_CACHE[HLE_CACHE_SIZE];
+int HLE_ENABLED;
+uint64_t HLE_CALLS[NUM_HLE_ROUTINES];
+uint64_t HLE_INSTRUCTIONS;      /* guest instructions accounted for natively */
+
+/***************************************************************/
+/* Idle/polling loop fast-forward: a block that branches back to  */
+/* itself without side effects or loop-carried registers repeats  */
+/* the same work until something external changes. Its iterations */
+/* are skipped up to the next timer interrupt or interval end, or, */
+/* when it polls CP0 (Count), up to the iteration that exits.      */
+/***************************************************************/
+#define SPIN_UNKNOWN  0
+#define SPIN_PURE     1
+#define SPIN_TIMED    2
+#define SPIN_NO       3
+#define SPIN_MAX_SKIP (1u << 30)        /* instructions per fast-forward */
+
+int SPIN_FF;
+int DEVICE_READ;                /* a device register was read since the last loop check */
+uint64_t SPIN_SKIPPED;          /* instructions accounted for without interpreting them */
+int SPIN_STUCK;                 /* stopped: spinning with no event pending */
+
+/***************************************************************/
+/* Lockstep batch execution (-V): one copy of the program per line */
+/* of a lanes file, each started from its own registers. Registers */
+/* are kept in structure-of-arrays form, LOCKSTEP_WIDTH lanes per  */
+/* vector, so each instruction is executed for a whole vector of    */
+/* lanes at once (the compiler picks SSE2, AVX2 or AVX-512 at run   */
+/* time). Every step runs the basic block at the lowest PC among    */
+/* the running lanes for all lanes at that PC, with the rest masked */
+/* off: lanes that diverge at a branch regroup where the paths meet. */
+/* Stores go to a private per-lane overlay of the loaded image.     */
+/* Lanes stop at exit, at any other syscall, at CP0 or device       */
+/* accesses, or after LOCKSTEP_LIMIT instructions.                  */
+/***************************************************************/
+#define LOCKSTEP_WIDTH         16
+#define LOCKSTEP_MAX_BLOCK     MAX_BLOCK_LENGTH   /* instructions before regrouping a straight-line run */
+#define LOCKSTEP_DEFAULT_LIMIT 100000000
+#define LANE_EMPTY             0xFFFFFFFF  /* free overlay slot (never a word address) */
+
+typedef uint32_t lane_vec_t __attribute__((vector_size(4 * LOCKSTEP_WIDTH)));
+
+/* the same value in every lane */
+#define LANE_SPLAT(x) ((lane_vec_t){ 0 } + (uint32_t)(x))
+
+/* dst = mask ? value : dst, lane by lane */
+#define LANE_SELECT(dst, value, mask) ((dst) = ((value) & (mask)) | ((dst) & ~(mask)))
+
+typedef enum { LANE_RUNNING, LANE_EXITED, LANE_LIMIT, LANE_SYSCALL, LANE_CP0, LANE_DEVICE, LANE_ILLEGAL, NUM_LANE_STATUS } lane_status_t;
+
+const char *LANE_STATUS_NAMES[NUM_LANE_STATUS] = {
+	"running", "exit", "limit", "syscall", "cp0", "device", "illegal"
+};
+
+typedef struct {
+	uint32_t address, value;
+} lane_word_t;
+
+typedef struct {
+	lane_word_t *words;             /* open addressing on the word address */
+	uint32_t size, used;
+} lane_overlay_t;
+
+typedef struct {
+	uint32_t lanes, chunks, running;
+	lane_vec_t *regs[MIPS_REGS + 2]; /* [reg][chunk]; HI and LO follow the GPRs */
+	lane_vec_t *pc, *count;
+	lane_vec_t *active;              /* all ones while the lane runs */
+	lane_vec_t *mask;                /* lanes executing the current block */
+	uint32_t *live;                  /* chunks with at least one lane in mask */
+	uint8_t *status;
+	uint32_t *code;                  /* exit code, syscall number or faulting address */
+	lane_overlay_t *overlay;
+	uint64_t issued;                 /* instructions issued, each for a vector of lanes */
+} lockstep_t;
+
+lockstep_t LOCKSTEP;
+uint32_t LOCKSTEP_LIMIT = LOCKSTEP_DEFAULT_LIMIT;
+char lanes_file[64];
+
+/***************************************************************/
+/* Coverage-guided fuzzing (-Z <corpus dir>). Each corpus input,   */
+/* and each mutation of one, is copied to FUZZ_INPUT_BASE with     */
+/* $a0 = its address and $a1 = its length, and the program runs for */
+/* at most FUZZ_BUDGET instructions. Edges between basic blocks are */
+/* counted in FUZZ_TRACE with AFL's hit-count buckets; an input that */
+/* reaches a new edge or bucket joins the corpus, and crashes (exit  */
+/* code != 0, unsupported syscall) and hangs are saved when they     */
+/* are new too. Between runs only the pages written since the        */
+/* post-load snapshot (PAGE_DIRTY) are restored.                     */
+/***************************************************************/
+#define FUZZ_MAP_SIZE       (1 << 16)
+#define FUZZ_INPUT_BASE     0x7FF10000     /* bit 16 set, so loads and stores see it unmoved */
+#define FUZZ_MAX_INPUT      0x10000
+#define FUZZ_DEFAULT_BUDGET 1000000
+#define FUZZ_HAVOC_ROUNDS   256            /* mutations of a queue entry per visit */
+#define FUZZ_HAVOC_STACK    16             /* most mutations stacked into one input */
+#define FUZZ_HASH(pc)       ((((pc) >> 2) * 2654435761u) >> 16)
+
+typedef enum { FUZZ_OK, FUZZ_CRASH, FUZZ_HANG } fuzz_result_t;
+
+typedef struct {
+	uint8_t *data;
+	uint32_t len;
+} fuzz_input_t;
+
+uint8_t *FUZZ_TRACE;                        /* edge hit counts of the current run, NULL unless fuzzing */
+uint8_t FUZZ_VIRGIN[3][FUZZ_MAP_SIZE];      /* per fuzz_result_t: bucket bits not seen yet */
+uint8_t FUZZ_BUCKETS[256];                  /* hit count -> bucket bit */
+uint32_t *DIRTY_PAGES;                      /* pages that went PAGE_DIRTY, NULL unless fuzzing, diffing or -T */
+uint32_t NUM_DIRTY_PAGES;
+uint8_t **FUZZ_SNAPSHOT;                    /* page -> contents after loading, NULL if never written */
+CPU_State FUZZ_STATE;
+uint32_t FUZZ_HEAP_BREAK;
+fuzz_input_t *FUZZ_QUEUE;
+uint32_t FUZZ_QUEUE_LEN, FUZZ_QUEUE_SIZE;
+uint64_t FUZZ_EXECS, FUZZ_SAVED[3];
+uint64_t FUZZ_RNG = 0x2545F4914F6CDD1DULL;
+uint32_t FUZZ_BUDGET = FUZZ_DEFAULT_BUDGET;
+volatile sig_atomic_t FUZZ_STOP;
+FILE *FUZZ_LOG;                             /* status output (stdout is /dev/null while fuzzing) */
+char fuzz_dir[64];
+
+/***************************************************************/
+/* Differential testing (-X): the loaded program is run by every   */
+/* execution engine at once, one child process each, and each child */
+/* sends a diff_record_t down a pipe at the end of every basic     */
+/* block. The records are matched up by instruction count (engines */
+/* may split blocks differently) and compared; at the first         */
+/* mismatch the reference interpreter replays the instructions      */
+/* since the last agreeing record with disassembly. Memory is       */
+/* compared by a digest of the written pages: the sum of a hash per */
+/* page, updated for the pages written since the previous record.    */
+/***************************************************************/
+#define DIFF_MAX_LISTING 64             /* instructions shown for a divergent stretch */
+
+typedef enum { ENGINE_INTERPRETER, ENGINE_FAST, ENGINE_LOCKSTEP, NUM_ENGINES } engine_t;
+
+const char *ENGINE_NAMES[NUM_ENGINES] = {
+	"interpreter", "fast", "lockstep"
+};
+
+typedef struct {
+	uint64_t count;                 /* instructions executed */
+	uint64_t digest;                /* of all non-zero written pages */
+	uint32_t pc, start;             /* next PC and start of the block just run */
+	uint32_t regs[MIPS_REGS + 2];   /* HI and LO follow the GPRs */
+	uint32_t done;                  /* last record: the engine stopped */
+	uint32_t status;                /* lane_status_t, when done */
+} diff_record_t;
+
+int DIFFERENTIAL;                   /* -X */
+FILE *DIFF_OUT;                     /* record stream of an engine process, NULL otherwise */
+uint64_t *DIFF_PAGE_HASH;           /* page -> its term of DIFF_DIGEST, 0 if all zero */
+uint64_t DIFF_DIGEST;
+
+/***************************************************************/
+/* Guest performance counters (CP0 register 25, MIPS32 layout:     */
+/* select 2n is PerfCtl n, 2n+1 is PerfCnt n). A counter counts its */
+/* event while any of its U/S/K/EXL enable bits is set. Nothing is  */
+/* counted as instructions run: each counter holds an offset from   */
+/* the simulator statistic behind its event, and its value is only */
+/* computed when MFC0 reads it. Branch and cache events come from   */
+/* the first timing model (-C) and stay at zero without one.        */
+/***************************************************************/
+#define PMC_COUNTERS     4
+#define PMC_CTL_M        0x80000000     /* another counter follows */
+#define PMC_CTL_EVENT    0x000007E0
+#define PMC_EVENT_SHIFT  5
+#define PMC_CTL_IE       0x00000010     /* overflow interrupt enable (kept, never raised) */
+#define PMC_CTL_ENABLE   0x0000000F     /* U, S, K, EXL */
+
+typedef enum {
+	PMC_CYCLES,             /* CYCLE_COUNT, the clock behind Count */
+	PMC_INSTRUCTIONS,       /* retired instructions */
+	PMC_BRANCHES,           /* conditional branches seen by the timing model */
+	PMC_MISPREDICTS,
+	PMC_ICACHE_MISSES,
+	PMC_DCACHE_MISSES,
+	PMC_MODEL_CYCLES,       /* cycles estimated by the timing model */
+	NUM_PMC_EVENTS
+} pmc_event_t;
+
+typedef struct {
+	uint32_t control;
+	uint32_t offset;        /* count - event total while enabled, the count itself while stopped */
+} pmc_t;
+
+pmc_t PMC[PMC_COUNTERS];
+
+/***************************************************************/
+/* Host efficiency (-E): Linux hardware counters for the simulator */
+/* thread, read around run(), runAll() and lockstep_run(), are      */
+/* reported per guest instruction next to the guest's own MIPS/s.   */
+/* Counters the host cannot provide read as zero.                   */
+/* -J also writes the run as one JSON object (engine, MIPS/s, load */
+/* and startup time, peak RSS) for the bench driver.                */
+/***************************************************************/
+#define HOST_EVENTS 4
+
+const char *HOST_EVENT_NAMES[HOST_EVENTS] = {
+	"cycles", "instructions", "branch-misses", "cache-misses"
+};
+
+typedef struct {
+	int fds[HOST_EVENTS];           /* perf_event fds, -1 if unavailable */
+	uint64_t start[HOST_EVENTS], totals[HOST_EVENTS];
+	uint64_t guest_start, guest_instructions;
+	double clock_start, seconds;
+	engine_t engine;                /* engine of the last measured run */
+	double process_start;           /* main() entry */
+	double startup_seconds;         /* main() entry until the program is loaded */
+	double load_seconds;            /* load_program() and load_kernel() */
+} host_stats_t;
+
+int HOST_STATS;
+host_stats_t HOST;
+char bench_file[64];
+
+/***************************************************************/
+/* Assembler: programs (and -k kernels) written in MIPS assembly,    */
+/* .s or .asm, are assembled straight into memory in two passes (lay */
+/* out the labels, then encode); -A writes the text out as .in hex. */
+/* Labels wait for the next statement, so a label before a .word   */
+/* gets its aligned address.                                          */
+/***************************************************************/
+#define ASM_MAX_LINE     1024
+#define ASM_MAX_OPERANDS 64
+#define ASM_MAX_LABEL    64
+#define ASM_MAX_PENDING  16
+
+typedef struct {
+	char *name;             /* NULL = free slot */
+	uint32_t address;
+} asm_symbol_t;
+
+typedef struct {
+	const char *file;
+	int line;
+	int pass;               /* 1 = lay out labels, 2 = encode into memory */
+	int in_data;            /* the current section is .data */
+	uint32_t text, data;    /* location counters */
+	int errors;
+	char pending[ASM_MAX_PENDING][ASM_MAX_LABEL];   /* labels waiting for the next statement */
+	int num_pending;
+} assembler_t;
+
+/* pseudo-instructions with a fixed expansion; li and la are built in */
+typedef struct {
+	const char *name;
+	int operands;
+	const char *expansion;  /* %0, %1 = the operands */
+} asm_pseudo_t;
+
+const asm_pseudo_t ASM_PSEUDOS[] = {
+	{ "nop",  0, "sll $0, $0, 0" },
+	{ "move", 2, "addu %0, %1, $0" },
+	{ "not",  2, "nor %0, %1, $0" },
+	{ "negu", 2, "subu %0, $0, %1" },
+	{ "b",    1, "beq $0, $0, %0" },
+	{ "beqz", 2, "beq %0, $0, %1" },
+	{ "bnez", 2, "bne %0, $0, %1" },
+	{ "jalr", 1, "jalr $31, %0" },
+	{ NULL,   0, NULL }
+};
+
+const char *ASM_REGISTER_NAMES[32] = {
+	"zero", "at", "v0", "v1", "a0", "a1", "a2", "a3", "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+	"s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7", "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"
+};
+
+assembler_t ASM;
+asm_symbol_t *ASM_SYMBOLS;      /* open-addressed hash table */
+uint32_t ASM_SYMBOL_SLOTS, ASM_NUM_SYMBOLS;
+char asm_out_file[64];          /* -A: write the assembled program here */
+
+/***************************************************************/
+/* Time travel (-T <n>): at the first block boundary every n        */
+/* instructions the CPU, counters and devices are saved with the    */
+/* pages written since the previous snapshot (PAGE_DIRTY); the      */
+/* oldest snapshot also has every written page. rstep and rcontinue */
+/* restore the nearest snapshot before the target and run forward   */
+/* to it, so going back costs at most n instructions. Below the     */
+/* furthest point ever reached (the frontier) syscalls and device   */
+/* accesses are not repeated but replayed from TT_LOG.               */
+/***************************************************************/
+#define TT_MAX_SNAPSHOTS 1024   /* then the oldest two are merged: history reaches back this many intervals */
+
+typedef struct {
+	CPU_State state;
+	uint64_t count;                 /* INSTRUCTION_COUNT */
+	uint64_t block_start_count, cycle_count, next_event_cycle, timer_event_cycle;
+	uint32_t count_base, heap_break, block_start_pc;
+	int exit_code, guest_exited, spin_stuck, device_read, run_flag;
+	pmc_t pmc[PMC_COUNTERS];
+	block_dev_t block_dev;
+	dma_t dma;
+	uint32_t log_pos;               /* TT_LOG entries before this one happened earlier */
+	uint32_t num_pages;
+	uint32_t *pages;                /* sorted; written since the previous snapshot */
+	uint8_t *data;                  /* their contents now, PAGE_SIZE each */
+} tt_snapshot_t;
+
+typedef struct {
+	uint64_t count;                 /* instruction that did the syscall or device access */
+	uint32_t value;                 /* $v0, the value read, or the block device status */
+	uint32_t address, len;          /* guest memory the host filled in */
+	size_t data;                    /* offset of those bytes in TT_LOG_DATA */
+} tt_event_t;
+
+uint32_t TT_INTERVAL;                   /* -T, 0 when time travel is off */
+uint64_t TT_NEXT_SNAPSHOT = ~0ULL;      /* instruction count that takes (or passes) the next snapshot */
+tt_snapshot_t TT_SNAPSHOTS[TT_MAX_SNAPSHOTS];
+uint32_t TT_NUM_SNAPSHOTS;
+uint32_t TT_CURRENT;                    /* latest snapshot at or before INSTRUCTION_COUNT; PAGE_DIRTY is relative to it */
+uint8_t **TT_BASE;                      /* page -> contents at TT_SNAPSHOTS[0], NULL if zero */
+uint64_t TT_FRONTIER;
+tt_event_t *TT_LOG;
+uint32_t TT_LOG_LEN, TT_LOG_SIZE, TT_LOG_POS;   /* TT_LOG_POS: next event to replay */
+uint8_t *TT_LOG_DATA;
+size_t TT_LOG_DATA_LEN, TT_LOG_DATA_SIZE;
+
+char prog_file[64];
+char kernel_file[32];  /* optional exception handler image loaded at EXCEPTION_VECTOR */
 
 
 /***************************************************************/
@@ -65,6 +941,7 @@ char prog_file[32];
 void help();
 uint32_t mem_read_32(uint32_t address);
 void mem_write_32(uint32_t address, uint32_t value);
+void mem_write_partial(uint32_t address, uint32_t value, uint32_t size);
 void cycle();
 void run(int num_cycles);
 void runAll();
@@ -75,7 +952,174 @@ void reset();
 void init_memory();
 void load_program();
 void handle_instruction(); /*IMPLEMENT THIS*/
+INSTRUCTION_SET(OPCODE_PROTOTYPE)
+void execute_unknown(uint32_t instruction);
+uint32_t access_address(uint32_t instruction, uint32_t size);
+void branch_if(uint32_t instruction, int taken);
 void initialize();
 void print_program(); /*IMPLEMENT THIS*/
 void print_instruction(uint32_t);
+void fprint_instruction(FILE *out, uint32_t addr);
+void run_block();
+uint32_t cp0_read(uint32_t reg, uint32_t sel);
+void cp0_write(uint32_t reg, uint32_t sel, uint32_t value);
+uint64_t pmc_total(uint32_t event);
+uint32_t pmc_read(uint32_t sel);
+void pmc_write(uint32_t sel, uint32_t value);
+void schedule_timer();
+void check_interrupts();
+void load_kernel();
+uint8_t *mem_host_ptr(uint32_t address, uint32_t *avail);
+void init_syscalls();
+void handle_syscall();
+void flush_guest_fd(int fd);
+void flush_guest_output();
+void close_guest_fds();
+int guest_fd_put(int fd, const uint8_t *data, uint32_t len);
+int32_t guest_fd_get(int fd, uint8_t *dst, uint32_t len);
+uint8_t *guest_buffer(uint32_t address, uint32_t len, int to_guest);
+int guest_iovec(uint32_t address, uint32_t len, struct iovec *iov, int max_iov, int to_guest);
+int32_t guest_fd_write_direct(int fd, uint32_t address, uint32_t len);
+int32_t guest_fd_read_direct(int fd, uint32_t address, uint32_t len);
+block_t *block_lookup(uint32_t pc);
+void clear_blocks();
+void end_block();
+void decode_init();
+opcode_t decode_opcode(uint32_t instruction);
+int instruction_valid(uint32_t instruction);
+void decode_block(block_t *block);
+void print_mix();
+void mix_report();
+int compare_pc_counts(const void *a, const void *b);
+int compare_pcs(const void *a, const void *b);
+uint32_t profile_pc_counts(pc_count_t **out);
+void disassemble(uint32_t addr, char *text, size_t size);
+void profile_report();
+void trace_open();
+void trace_retire();
+void trace_handoff();
+void *trace_writer(void *arg);
+uint32_t trace_encode_block(retire_t *records, uint32_t n, uint8_t *out, uint32_t *last_pc, uint32_t *last_addr);
+void trace_close();
+void retire();
+int cache_init(cache_t *c, uint32_t size, uint32_t assoc, uint32_t line);
+int cache_access(cache_t *c, uint32_t addr);
+int timing_add_config(const char *spec);
+void timing_retire(timing_model_t *m, const retire_t *r);
+void timing_report();
+void replay_trace();
+void reuse_init();
+void reuse_access(uint32_t address);
+void reuse_report();
+void ring_start();
+void ring_publish();
+void ring_push(const retire_t *r);
+void *ring_consumer(void *arg);
+void ring_stop();
+void ring_sync();
+void mem_mark_written(uint32_t address, uint32_t len);
+void interval_init();
+void bbv_count(block_t *block, uint32_t length);
+void bbv_flush();
+void interval_end();
+void bbv_close();
+void load_simpoints();
+void interval_checkpoint();
+int checkpoint_save(const char *path);
+int checkpoint_load(const char *path);
+void load_simpoint_weights(double *weights);
+void sample_worker(uint32_t interval, int fd);
+void sampled_run();
+int hle_match(uint32_t addr, const hle_pattern_t *pattern, int length, uint32_t *temp);
+hle_entry_t *hle_lookup(uint32_t target);
+uint8_t *hle_range(uint32_t address, uint32_t len);
+int hle_pieces(uint32_t dst, uint32_t src, uint32_t n, int copy, uint8_t value, int apply);
+int hle_fits(uint64_t executed);
+int hle_call(uint32_t target);
+void hle_flush();
+int instruction_regs(uint32_t instruction, uint64_t *reads, uint64_t *writes);
+uint8_t spin_classify(block_t *block);
+int spin_exits(block_t *block, uint64_t start_cycle);
+void spin_check(block_t *block, uint32_t length);
+int lockstep_load(const char *path);
+void lockstep_init(uint32_t lanes, uint32_t (*inits)[MIPS_REGS + 2]);
+void lane_stop(uint32_t lane, lane_status_t status, uint32_t pc, uint32_t code);
+uint32_t *lane_overlay_slot(lane_overlay_t *o, uint32_t word, int insert);
+uint32_t lane_read(uint32_t lane, uint32_t address);
+void lane_write(uint32_t lane, uint32_t address, uint32_t value, uint32_t size);
+void lockstep_memory(opcode_t op, uint32_t instruction, uint32_t pc, uint32_t c);
+void lockstep_block(uint32_t pc, uint32_t nlive);
+void lockstep_run();
+uint64_t fuzz_rand();
+void fuzz_snapshot();
+void fuzz_restore();
+fuzz_result_t fuzz_exec(const uint8_t *data, uint32_t len);
+int fuzz_novel(fuzz_result_t kind);
+void fuzz_save(fuzz_result_t kind, const uint8_t *data, uint32_t len);
+void fuzz_enqueue(const uint8_t *data, uint32_t len);
+uint32_t fuzz_mutate(uint8_t *buf, uint32_t len);
+void fuzz_load_corpus();
+void fuzz_interrupt(int sig);
+void fuzz_status(const char *event);
+void fuzz_run();
+int compare_pages(const void *a, const void *b);
+uint64_t diff_digest(int lane);
+void diff_emit(int done);
+void diff_engine(engine_t engine, int fd);
+int diff_same(const diff_record_t *a, const diff_record_t *b);
+void diff_report(diff_record_t *cur, int *active, uint64_t agreed);
+int diff_run();
+void tt_start();
+void tt_free();
+void tt_save(tt_snapshot_t *s);
+void tt_snapshot();
+void tt_fold();
+void tt_restore_page(uint32_t page, uint32_t j);
+void tt_restore(uint32_t j);
+uint32_t tt_find(uint64_t count);
+void tt_step();
+void tt_goto(uint64_t target);
+void tt_rstep(uint32_t n);
+void tt_rcontinue(int have_pc, uint32_t pc);
+int tt_replaying();
+void tt_copy_guest(uint32_t address, uint8_t *buf, uint32_t len, int to_guest);
+void tt_log(uint32_t value, uint32_t address, uint32_t len);
+uint32_t tt_replay();
+void host_stats_open();
+uint64_t host_counter(int k);
+double host_clock();
+void host_stats_start(uint64_t guest);
+void host_stats_stop(engine_t engine, uint64_t guest);
+void host_stats_report();
+void host_stats_load();
+void host_stats_json();
+int is_assembly(const char *file);
+void asm_error(const char *format, ...);
+asm_symbol_t *asm_symbol(const char *name);
+void asm_define(const char *name, uint32_t address);
+void asm_free_symbols();
+int asm_register(const char *text, uint32_t *reg);
+int asm_value(const char *text, uint32_t *value);
+void asm_emit(uint32_t value, uint32_t size);
+void asm_align(uint32_t alignment);
+int asm_split(char *text, char **operands);
+void asm_encode(opcode_t op, char **operands, int count);
+void asm_instruction(const char *mnemonic, char **operands, int count);
+void asm_string(char *text, int terminate);
+void asm_directive(const char *name, char *args);
+void asm_line(char *line);
+int assemble(const char *file, uint32_t text_begin, uint32_t data_begin);
+int assemble_hex(const char *file, const char *out_file);
+void usage(const char *prog);
+void mmio_register(const char *name, uint32_t begin, uint32_t size, uint32_t (*read)(uint32_t), void (*write)(uint32_t, uint32_t));
+uint32_t mmio_read(uint32_t address);
+void mmio_write(uint32_t address, uint32_t value);
+void init_devices();
+void flush_devices();
+uint32_t uart_read(uint32_t offset);
+void uart_write(uint32_t offset, uint32_t value);
+uint32_t block_read(uint32_t offset);
+void block_write(uint32_t offset, uint32_t value);
+uint32_t dma_read(uint32_t offset);
+void dma_write(uint32_t offset, uint32_t value);
 
@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+/***************************************************************/
+/* Per-opcode microbenchmarks for the mu-mips dispatch core. For    */
+/* every opcode two programs are generated: a straight-line run of   */
+/* the instruction, and a loop whose body repeats it LOOP_BODY times */
+/* (so a loop iteration adds one addiu and one bne per LOOP_BODY).   */
+/* benchrun times each one on every engine; the median guest MIPS/s */
+/* is reported as host nanoseconds per guest instruction.           */
+/***************************************************************/
+
+#define TEXT_BEGIN       0x00400000
+#define DATA_BASE        0x10010000
+#define DEFAULT_LENGTH   100000     /* straight-line instructions */
+#define DEFAULT_TRIPS    20000      /* loop iterations */
+#define DEFAULT_REPS     3
+#define LOOP_BODY        64
+#define MAX_WORDS        (1 << 20)
+#define NUM_ENGINES      3
+
+#define R_T0   8                    /* 7 */
+#define R_T1   9                    /* 3 */
+#define R_T2   10                   /* destination */
+#define R_BASE 16                   /* DATA_BASE */
+#define R_LOOP 25
+
+typedef enum { OPERAND_NONE, OPERAND_NEXT_BRANCH, OPERAND_NEXT_JUMP } operand_t;
+
+typedef struct {
+    const char *name;
+    uint32_t word;
+    operand_t operand;              /* what to patch in for the instruction's position */
+} opcode_t;
+
+#define R(rs, rt, rd, sa, funct) (((rs) << 21) | ((rt) << 16) | ((rd) << 11) | ((sa) << 6) | (funct))
+#define I(op, rs, rt, imm)       (((op) << 26) | ((rs) << 21) | ((rt) << 16) | ((imm) & 0xFFFF))
+
+/* branches and jumps go to the next instruction: beq/bgtz taken, bne/blez not */
+const opcode_t OPCODES[] = {
+    { "nop",   0,                                   OPERAND_NONE },
+    { "addu",  R(R_T0, R_T1, R_T2, 0, 0x21),        OPERAND_NONE },
+    { "subu",  R(R_T0, R_T1, R_T2, 0, 0x23),        OPERAND_NONE },
+    { "and",   R(R_T0, R_T1, R_T2, 0, 0x24),        OPERAND_NONE },
+    { "or",    R(R_T0, R_T1, R_T2, 0, 0x25),        OPERAND_NONE },
+    { "xor",   R(R_T0, R_T1, R_T2, 0, 0x26),        OPERAND_NONE },
+    { "nor",   R(R_T0, R_T1, R_T2, 0, 0x27),        OPERAND_NONE },
+    { "slt",   R(R_T0, R_T1, R_T2, 0, 0x2A),        OPERAND_NONE },
+    { "sll",   R(0, R_T0, R_T2, 3, 0x00),           OPERAND_NONE },
+    { "srl",   R(0, R_T0, R_T2, 3, 0x02),           OPERAND_NONE },
+    { "sra",   R(0, R_T0, R_T2, 3, 0x03),           OPERAND_NONE },
+    { "addiu", I(0x09, R_T0, R_T2, 5),              OPERAND_NONE },
+    { "slti",  I(0x0A, R_T0, R_T2, 5),              OPERAND_NONE },
+    { "andi",  I(0x0C, R_T2, R_T2, 0x55),           OPERAND_NONE },
+    { "ori",   I(0x0D, R_T2, R_T2, 0x55),           OPERAND_NONE },
+    { "xori",  I(0x0E, R_T2, R_T2, 0x55),           OPERAND_NONE },
+    { "lui",   I(0x0F, 0, R_T2, 0x1234),            OPERAND_NONE },
+    { "mult",  R(R_T0, R_T1, 0, 0, 0x18),           OPERAND_NONE },
+    { "multu", R(R_T0, R_T1, 0, 0, 0x19),           OPERAND_NONE },
+    { "div",   R(R_T0, R_T1, 0, 0, 0x1A),           OPERAND_NONE },
+    { "divu",  R(R_T0, R_T1, 0, 0, 0x1B),           OPERAND_NONE },
+    { "mfhi",  R(0, 0, R_T2, 0, 0x10),              OPERAND_NONE },
+    { "mflo",  R(0, 0, R_T2, 0, 0x12),              OPERAND_NONE },
+    { "mthi",  R(R_T0, 0, 0, 0, 0x11),              OPERAND_NONE },
+    { "mtlo",  R(R_T0, 0, 0, 0, 0x13),              OPERAND_NONE },
+    { "lw",    I(0x23, R_BASE, R_T2, 0),            OPERAND_NONE },
+    { "lh",    I(0x21, R_BASE, R_T2, 0),            OPERAND_NONE },
+    { "lb",    I(0x20, R_BASE, R_T2, 0),            OPERAND_NONE },
+    { "sw",    I(0x2B, R_BASE, R_T0, 0),            OPERAND_NONE },
+    { "sh",    I(0x29, R_BASE, R_T0, 0),            OPERAND_NONE },
+    { "sb",    I(0x28, R_BASE, R_T0, 0),            OPERAND_NONE },
+    { "beq",   I(0x04, R_T0, R_T0, 0),              OPERAND_NEXT_BRANCH },
+    { "bne",   I(0x05, R_T0, R_T0, 0),              OPERAND_NEXT_BRANCH },
+    { "bgtz",  I(0x07, R_T0, 0, 0),                 OPERAND_NEXT_BRANCH },
+    { "blez",  I(0x06, R_T0, 0, 0),                 OPERAND_NEXT_BRANCH },
+    { "j",     0x08000000,                          OPERAND_NEXT_JUMP },
+};
+
+#define NUM_OPCODES (sizeof(OPCODES) / sizeof(OPCODES[0]))
+
+const char *ENGINE_NAMES[NUM_ENGINES] = { "interpreter", "fast", "lockstep" };
+const char *SHAPES[2] = { "straight", "loop" };
+
+uint32_t WORDS[MAX_WORDS];
+uint32_t NUM_WORDS;
+
+void emit(uint32_t word) {
+    if (NUM_WORDS == MAX_WORDS) {
+        printf("Error: program too large\n");
+        exit(1);
+    }
+    WORDS[NUM_WORDS++] = word;
+}
+
+/***************************************************************/
+/* One copy of an opcode at the current position                         */
+/***************************************************************/
+void emit_opcode(const opcode_t *op) {
+    switch (op->operand) {
+        case OPERAND_NEXT_BRANCH:
+            emit(op->word | 1);                             /* PC + 4 */
+            break;
+        case OPERAND_NEXT_JUMP:
+            emit(op->word | (((TEXT_BEGIN + 4 * (NUM_WORDS + 1)) >> 2) & 0x03FFFFFF));
+            break;
+        default:
+            emit(op->word);
+            break;
+    }
+}
+
+/***************************************************************/
+/* Write the straight-line (loop = 0) or looped program for op      */
+/***************************************************************/
+void write_program(const char *path, const opcode_t *op, int loop, uint32_t length, uint32_t trips) {
+    uint32_t i, head;
+    FILE *out;
+
+    NUM_WORDS = 0;
+    emit(I(0x0F, 0, R_BASE, DATA_BASE >> 16));
+    emit(I(0x09, 0, R_T0, 7));
+    emit(I(0x09, 0, R_T1, 3));
+    if (loop) {
+        emit(I(0x0F, 0, R_LOOP, trips >> 16));
+        emit(I(0x0D, R_LOOP, R_LOOP, trips & 0xFFFF));     /* ori reads rt */
+        head = NUM_WORDS;
+        for (i = 0; i < LOOP_BODY; i++) {
+            emit_opcode(op);
+        }
+        emit(I(0x09, R_LOOP, R_LOOP, 0xFFFF));
+        emit(I(0x05, R_LOOP, 0, head - NUM_WORDS));
+    }
+    else {
+        for (i = 0; i < length; i++) {
+            emit_opcode(op);
+        }
+    }
+    emit(I(0x09, 0, 2, 10));                                /* exit */
+    emit(0x0000000C);
+
+    out = fopen(path, "w");
+    if (out == NULL) {
+        printf("Error: Can't write %s\n", path);
+        exit(-1);
+    }
+    for (i = 0; i < NUM_WORDS; i++) {
+        fprintf(out, "%X\n", WORDS[i]);
+    }
+    fclose(out);
+}
+
+/***************************************************************/
+/* Median guest MIPS/s of one benchmark and engine in benchrun's     */
+/* results, or 0 if it is missing                                             */
+/***************************************************************/
+double median_mips(const char *results, const char *benchmark, const char *engine) {
+    char pattern[128];
+    const char *p;
+
+    snprintf(pattern, sizeof(pattern), "{\"benchmark\": \"%s\", \"engine\": \"%s\"", benchmark, engine);
+    p = strstr(results, pattern);
+    p = (p != NULL) ? strstr(p, "\"mips\": {\"median\": ") : NULL;
+    return (p == NULL) ? 0 : strtod(p + strlen("\"mips\": {\"median\": "), NULL);
+}
+
+int selected(const char *name, int argc, char *argv[], int first) {
+    int i;
+
+    for (i = first; i < argc; i++) {
+        if (strcmp(argv[i], name) == 0) {
+            return 1;
+        }
+    }
+    return first >= argc;
+}
+
+/***************************************************************/
+/* Print usage                                                                         */
+/***************************************************************/
+void usage(const char *prog) {
+    printf("Usage: %s [-n <length>] [-i <iterations>] [-r <repetitions>] [-s <simulator>] [-b <benchrun>]\n", prog);
+    printf("       %*s [-o <results.json>] [opcode...]\n", (int)strlen(prog), "");
+}
+
+/***************************************************************/
+/* main                                                                                */
+/***************************************************************/
+int main(int argc, char *argv[]) {
+    int opt, reps = DEFAULT_REPS, shape, e, status, fd, n = 0, programs, first = 1;
+    uint32_t length = DEFAULT_LENGTH, trips = DEFAULT_TRIPS, k;
+    const char *simulator = "./mu-mips", *benchrun = "./benchrun", *out_path = "opbench.json";
+    const char **args;
+    char dir[] = "/tmp/opbench-XXXXXX", path[256], name[64], reps_text[16], *results;
+    double mips;
+    long size;
+    pid_t pid;
+    FILE *fp, *out;
+
+    while ((opt = getopt(argc, argv, "n:i:r:s:b:o:")) != -1) {
+        switch (opt) {
+            case 'n': length = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'i': trips = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'r': reps = atoi(optarg); break;
+            case 's': simulator = optarg; break;
+            case 'b': benchrun = optarg; break;
+            case 'o': out_path = optarg; break;
+            default: usage(argv[0]); exit(1);
+        }
+    }
+    if (length == 0 || length > MAX_WORDS - 16 || trips == 0 || reps < 1) {
+        usage(argv[0]);
+        exit(1);
+    }
+    for (k = optind; k < (uint32_t)argc; k++) {
+        for (e = 0; e < (int)NUM_OPCODES && strcmp(OPCODES[e].name, argv[k]) != 0; e++);
+        if (e == (int)NUM_OPCODES) {
+            printf("Error: unknown opcode %s\n", argv[k]);
+            exit(1);
+        }
+    }
+    if (mkdtemp(dir) == NULL) {
+        printf("Error: Can't create a temporary directory\n");
+        exit(-1);
+    }
+
+    /* benchrun -r reps -s simulator -o dir/results.json dir/<op>-<shape>.in ... */
+    args = malloc((2 * NUM_OPCODES + 10) * sizeof(char *));
+    snprintf(reps_text, sizeof(reps_text), "%d", reps);
+    args[n++] = benchrun;
+    args[n++] = "-r";
+    args[n++] = reps_text;
+    args[n++] = "-s";
+    args[n++] = simulator;
+    args[n++] = "-o";
+    snprintf(path, sizeof(path), "%s/results.json", dir);
+    args[n++] = strdup(path);
+    programs = n;
+    for (k = 0; k < NUM_OPCODES; k++) {
+        if (!selected(OPCODES[k].name, argc, argv, optind)) {
+            continue;
+        }
+        for (shape = 0; shape < 2; shape++) {
+            snprintf(path, sizeof(path), "%s/%s-%s.in", dir, OPCODES[k].name, SHAPES[shape]);
+            write_program(path, &OPCODES[k], shape, length, trips);
+            args[n++] = strdup(path);
+        }
+    }
+    args[n] = NULL;
+
+    printf("Timing %d programs on %d engines, %d runs each...\n\n", n - programs, NUM_ENGINES, reps);
+    pid = fork();
+    if (pid == 0) {
+        fd = open("/dev/null", O_WRONLY);
+        dup2(fd, 1);
+        execv(benchrun, (char * const *)args);
+        _exit(127);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("Error: %s failed\n", benchrun);
+    }
+
+    snprintf(path, sizeof(path), "%s/results.json", dir);
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        printf("Error: no results from %s\n", benchrun);
+        exit(-1);
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+    results = malloc(size + 1);
+    size = fread(results, 1, size, fp);
+    results[size] = '\0';
+    fclose(fp);
+    for (k = programs - 1; k < (uint32_t)n; k++) {
+        unlink(args[k]);                                    /* results.json and the programs */
+    }
+    rmdir(dir);
+
+    out = fopen(out_path, "w");
+    if (out == NULL) {
+        printf("Error: Can't write %s\n", out_path);
+        exit(-1);
+    }
+    fprintf(out, "{\n  \"loop_body\": %d,\n  \"repetitions\": %d,\n  \"results\": [", LOOP_BODY, reps);
+    printf("Host ns per guest instruction (median of %d runs)\n", reps);
+    printf("%-8s", "[Opcode]");
+    for (e = 0; e < NUM_ENGINES; e++) {
+        for (shape = 0; shape < 2; shape++) {
+            snprintf(name, sizeof(name), "[%s %s]", ENGINE_NAMES[e], SHAPES[shape]);
+            printf(" %22s", name);
+        }
+    }
+    printf("\n");
+    for (k = 0; k < NUM_OPCODES; k++) {
+        if (!selected(OPCODES[k].name, argc, argv, optind)) {
+            continue;
+        }
+        printf("%-8s", OPCODES[k].name);
+        for (e = 0; e < NUM_ENGINES; e++) {
+            for (shape = 0; shape < 2; shape++) {
+                snprintf(name, sizeof(name), "%s-%s", OPCODES[k].name, SHAPES[shape]);
+                mips = median_mips(results, name, ENGINE_NAMES[e]);
+                if (mips <= 0) {
+                    printf(" %22s", "n/a");
+                    continue;
+                }
+                printf(" %22.1f", 1e3 / mips);
+                fprintf(out, "%s\n    {\"opcode\": \"%s\", \"shape\": \"%s\", \"engine\": \"%s\", \"ns_per_instruction\": %.3f}",
+                        first ? "" : ",", OPCODES[k].name, SHAPES[shape], ENGINE_NAMES[e], 1e3 / mips);
+                first = 0;
+            }
+        }
+        printf("\n");
+    }
+    fprintf(out, "\n  ]\n}\n");
+    fclose(out);
+    free(results);
+    printf("\nResults written to %s\n", out_path);
+    return 0;
+}
@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/***************************************************************/
+/* Random program generator for differential testing (mu-mips -X). */
+/* Programs use only the instructions mu-mips implements and always */
+/* terminate:                                                                               */
+/*   - loads and stores stay inside a WINDOW_SIZE data window at    */
+/*     $28, either at a constant offset or at a register masked     */
+/*     into the window;                                                                 */
+/*   - conditional branches and jumps only go forward, past a few    */
+/*     instructions;                                                                     */
+/*   - loops count $24 down from a small constant and do not nest;  */
+/*   - calls (jal, or jalr through $1) go to leaf routines placed    */
+/*     after the exit, followed by a nop since the link is PC + 8.   */
+/* Output is one hex word per line, like the programs in inputs/.   */
+/***************************************************************/
+
+#define TEXT_BEGIN   0x00400000
+#define WINDOW_BASE  0x10010000
+#define WINDOW_SIZE  4096
+#define MAX_WORDS    (1 << 20)
+#define MAX_SKIP     8         /* instructions a forward branch passes over */
+#define MAX_TRIPS    8         /* loop iterations */
+#define NUM_ROUTINES 4
+
+#define R_ADDR 1               /* scratch address / call target */
+#define R_LOOP 24
+#define R_BASE 28
+#define R_RA   31
+#define FIRST_DATA 2           /* $2..$23 hold random data */
+#define LAST_DATA  23
+
+uint32_t WORDS[MAX_WORDS];
+uint32_t NUM_WORDS;
+uint32_t ROUTINES[NUM_ROUTINES];        /* word index of each leaf routine */
+uint32_t CALLS[MAX_WORDS];              /* word index of each jal, routine in the low bits */
+uint32_t NUM_CALLS;
+uint64_t RNG = 0x9E3779B97F4A7C15ULL;
+
+/***************************************************************/
+/* xorshift64                                                                                */
+/***************************************************************/
+uint32_t random_below(uint32_t n) {
+    RNG ^= RNG << 13;
+    RNG ^= RNG >> 7;
+    RNG ^= RNG << 17;
+    return (uint32_t)((RNG >> 11) % n);
+}
+
+uint32_t data_reg() {
+    return FIRST_DATA + random_below(LAST_DATA - FIRST_DATA + 1);
+}
+
+/* any register a program may read */
+uint32_t source_reg() {
+    switch (random_below(8)) {
+        case 0: return 0;
+        case 1: return R_BASE;
+        default: return data_reg();
+    }
+}
+
+void emit(uint32_t word) {
+    if (NUM_WORDS == MAX_WORDS) {
+        printf("Error: program too large\n");
+        exit(1);
+    }
+    WORDS[NUM_WORDS++] = word;
+}
+
+uint32_t r_type(uint32_t rs, uint32_t rt, uint32_t rd, uint32_t sa, uint32_t funct) {
+    return (rs << 21) | (rt << 16) | (rd << 11) | (sa << 6) | funct;
+}
+
+uint32_t i_type(uint32_t op, uint32_t rs, uint32_t rt, uint32_t immediate) {
+    return (op << 26) | (rs << 21) | (rt << 16) | (immediate & 0xFFFF);
+}
+
+/***************************************************************/
+/* Load a 32-bit constant (ori takes its source from rt here, so rs */
+/* and rt are the same register)                                                   */
+/***************************************************************/
+void emit_constant(uint32_t reg, uint32_t value) {
+    emit(i_type(0x0F, 0, reg, value >> 16));
+    emit(i_type(0x0D, reg, reg, value & 0xFFFF));
+}
+
+/***************************************************************/
+/* One load or store inside the data window                                */
+/***************************************************************/
+void emit_memory() {
+    static const uint32_t ops[6] = { 0x23, 0x20, 0x21, 0x2B, 0x28, 0x29 };  /* lw lb lh sw sb sh */
+    static const uint32_t align[6] = { 4, 1, 2, 4, 1, 2 };
+    uint32_t k = random_below(6), offset;
+
+    offset = random_below(WINDOW_SIZE / align[k]) * align[k];
+    if (random_below(2)) {
+        emit(i_type(ops[k], R_BASE, data_reg(), offset));
+        return;
+    }
+    /* $1 = $28 + (register & mask) */
+    emit(r_type(source_reg(), 0, R_ADDR, 0, 0x21));
+    emit(i_type(0x0C, R_ADDR, R_ADDR, (WINDOW_SIZE - 1) & ~(align[k] - 1)));
+    emit(r_type(R_ADDR, R_BASE, R_ADDR, 0, 0x21));
+    emit(i_type(ops[k], R_ADDR, data_reg(), 0));
+}
+
+/***************************************************************/
+/* One random ALU, multiply/divide or memory instruction                */
+/***************************************************************/
+void emit_plain() {
+    static const uint32_t alu[] = { 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x2A };
+    static const uint32_t muldiv[] = { 0x18, 0x19, 0x1A, 0x1B };
+    static const uint32_t shift[] = { 0x00, 0x02, 0x03 };
+    static const uint32_t immediate[] = { 0x08, 0x09, 0x0C, 0x0D, 0x0E, 0x0A };  /* addi addiu andi ori xori slti */
+
+    switch (random_below(16)) {
+        case 0: case 1: case 2: case 3:
+            emit(r_type(source_reg(), source_reg(), data_reg(), 0, alu[random_below(9)]));
+            break;
+        case 4:
+            emit(r_type(source_reg(), source_reg(), 0, 0, muldiv[random_below(4)]));
+            break;
+        case 5:
+            /* mfhi, mflo, mthi, mtlo */
+            switch (random_below(4)) {
+                case 0: emit(r_type(0, 0, data_reg(), 0, 0x10)); break;
+                case 1: emit(r_type(0, 0, data_reg(), 0, 0x12)); break;
+                case 2: emit(r_type(source_reg(), 0, 0, 0, 0x11)); break;
+                case 3: emit(r_type(source_reg(), 0, 0, 0, 0x13)); break;
+            }
+            break;
+        case 6: case 7:
+            emit(r_type(0, source_reg(), data_reg(), random_below(32), shift[random_below(3)]));
+            break;
+        case 8:
+            emit(i_type(0x0F, 0, data_reg(), random_below(0x10000)));
+            break;
+        case 9: case 10: case 11:
+            emit(i_type(immediate[random_below(6)], source_reg(), data_reg(), random_below(0x10000)));
+            break;
+        default:
+            emit_memory();
+            break;
+    }
+}
+
+/***************************************************************/
+/* A call to a random leaf routine (patched once they are placed)  */
+/***************************************************************/
+void emit_call() {
+    uint32_t routine = random_below(NUM_ROUTINES);
+
+    CALLS[NUM_CALLS++] = (NUM_WORDS << 2) | routine;
+    if (random_below(2)) {
+        emit(0x0C000000);                                   /* jal */
+    }
+    else {
+        emit(0);                                            /* lui $1 */
+        emit(0);                                            /* ori $1 */
+        emit(r_type(R_ADDR, 0, R_RA, 0, 0x09));             /* jalr $31, $1 */
+    }
+    emit(0);                                                /* the return lands after this */
+}
+
+/***************************************************************/
+/* About n instructions of straight-line code, forward branches,    */
+/* calls and (outside loops) counted loops                                     */
+/***************************************************************/
+void emit_sequence(uint32_t n, int in_loop) {
+    static const uint32_t branches[] = { 0x04, 0x05, 0x06, 0x07 };  /* beq bne blez bgtz */
+    uint32_t start = NUM_WORDS, branch, skip, head, op, rs;
+
+    while (NUM_WORDS - start < n) {
+        switch (random_below(12)) {
+            case 0: case 1:
+                /* forward branch over a short sequence; the offset is in words from the branch */
+                branch = NUM_WORDS;
+                emit(0);
+                skip = 1 + random_below(MAX_SKIP);
+                emit_sequence(skip, in_loop);
+                switch (random_below(4)) {
+                    case 0:
+                        WORDS[branch] = 0x08000000 | (((TEXT_BEGIN + 4 * NUM_WORDS) >> 2) & 0x03FFFFFF);   /* j */
+                        break;
+                    case 1:
+                        WORDS[branch] = i_type(0x01, source_reg(), random_below(2), NUM_WORDS - branch);  /* bltz, bgez */
+                        break;
+                    default:
+                        op = branches[random_below(4)];
+                        rs = source_reg();
+                        /* blez and bgtz have rt = 0 */
+                        WORDS[branch] = i_type(op, rs, (op >= 0x06) ? 0 : source_reg(), NUM_WORDS - branch);
+                        break;
+                }
+                break;
+            case 2:
+                emit_call();
+                break;
+            case 3:
+                if (!in_loop) {
+                    emit(i_type(0x09, 0, R_LOOP, 1 + random_below(MAX_TRIPS)));
+                    head = NUM_WORDS;
+                    emit_sequence(1 + random_below(4 * MAX_SKIP), 1);
+                    emit(i_type(0x09, R_LOOP, R_LOOP, 0xFFFF));
+                    emit(i_type(0x05, R_LOOP, 0, head - NUM_WORDS));
+                    break;
+                }
+                /* fall through */
+            default:
+                emit_plain();
+                break;
+        }
+    }
+}
+
+/***************************************************************/
+/* Print usage                                                                         */
+/***************************************************************/
+void usage(const char *prog) {
+    printf("Usage: %s [-n <instructions>] [-s <seed>] <output.in>\n", prog);
+}
+
+/***************************************************************/
+/* main                                                                                */
+/***************************************************************/
+int main(int argc, char *argv[]) {
+    int opt;
+    uint32_t length = 200, r, i, routine, address;
+    unsigned long long seed = 1;
+    FILE *out;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+            case 'n': length = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 's': seed = strtoull(optarg, NULL, 0); break;
+            default: usage(argv[0]); exit(1);
+        }
+    }
+    if (argc - optind != 1) {
+        usage(argv[0]);
+        exit(1);
+    }
+    RNG ^= seed * 0xD1B54A32D192ED03ULL;
+    if (RNG == 0) {
+        RNG = 1;
+    }
+
+    /* prologue: window base, random registers and window contents */
+    emit(i_type(0x0F, 0, R_BASE, WINDOW_BASE >> 16));
+    for (r = FIRST_DATA; r <= LAST_DATA; r++) {
+        emit_constant(r, (uint32_t)random_below(0x10000) << 16 | random_below(0x10000));
+    }
+    for (i = 0; i < 16; i++) {
+        emit(i_type(0x2B, R_BASE, data_reg(), 4 * random_below(WINDOW_SIZE / 4)));
+    }
+
+    emit_sequence(length, 0);
+    emit(i_type(0x09, 0, 2, 10));                           /* exit */
+    emit(0x0000000C);
+
+    for (routine = 0; routine < NUM_ROUTINES; routine++) {
+        ROUTINES[routine] = NUM_WORDS;
+        for (i = 1 + random_below(2 * MAX_SKIP); i > 0; i--) {
+            emit_plain();
+        }
+        emit(r_type(R_RA, 0, 0, 0, 0x08));                  /* jr $31 */
+    }
+    for (i = 0; i < NUM_CALLS; i++) {
+        r = CALLS[i] >> 2;
+        address = TEXT_BEGIN + 4 * ROUTINES[CALLS[i] & 3];
+        if (WORDS[r] == 0x0C000000) {
+            WORDS[r] |= (address >> 2) & 0x03FFFFFF;
+        }
+        else {
+            WORDS[r] = i_type(0x0F, 0, R_ADDR, address >> 16);
+            WORDS[r + 1] = i_type(0x0D, R_ADDR, R_ADDR, address & 0xFFFF);
+        }
+    }
+
+    out = fopen(argv[optind], "w");
+    if (out == NULL) {
+        printf("Error: Can't write %s\n", argv[optind]);
+        exit(1);
+    }
+    for (i = 0; i < NUM_WORDS; i++) {
+        fprintf(out, "%X\n", WORDS[i]);
+    }
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <float.h>
+#include <unistd.h>
+
+/***************************************************************/
+/* Offline SimPoint clustering for basic block vectors written by   */
+/* mu-mips -B. Each interval's vector is normalized, randomly         */
+/* projected to a few dimensions and clustered with k-means for       */
+/* k = 1..max; the smallest k whose BIC score reaches 90% of the      */
+/* best one is kept. For every cluster the interval closest to the    */
+/* centroid is picked as its simulation point and weighted by the     */
+/* fraction of intervals in the cluster.                                        */
+/*                                                                                          */
+/* Output, as in SimPoint 3.0: <prefix>.simpoints ("interval cluster") */
+/* and <prefix>.weights ("weight cluster").                                 */
+/***************************************************************/
+
+#define DEFAULT_MAX_K    10
+#define DEFAULT_DIMS     15
+#define KMEANS_SEEDS     5     /* random initializations per k */
+#define KMEANS_MAX_ITERS 100
+#define BIC_THRESHOLD    0.9
+
+typedef struct {
+    uint32_t id;
+    double count;
+} bbv_entry_t;
+
+typedef struct {
+    bbv_entry_t *entries;
+    uint32_t n;
+} bbv_t;
+
+bbv_t *INTERVALS;
+uint32_t NUM_INTERVALS;
+uint32_t MAX_ID;
+
+double *POINTS;          /* NUM_INTERVALS x DIMS projected vectors */
+int DIMS = DEFAULT_DIMS;
+
+/***************************************************************/
+/* Read a .bb file: one line per interval, "T:id:count :id:count ..." */
+/***************************************************************/
+void read_bbv(const char *path) {
+    FILE *fp;
+    char *line = NULL, *p;
+    size_t size = 0;
+    uint32_t id, capacity = 0;
+    unsigned long long count;
+    int used;
+    bbv_t *v;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        printf("Error: Can't open BBV file %s\n", path);
+        exit(-1);
+    }
+    while (getline(&line, &size, fp) != -1) {
+        if (line[0] != 'T') {
+            continue;
+        }
+        if (NUM_INTERVALS == capacity) {
+            capacity = (capacity == 0) ? 1024 : 2 * capacity;
+            INTERVALS = realloc(INTERVALS, capacity * sizeof(bbv_t));
+        }
+        v = &INTERVALS[NUM_INTERVALS++];
+        v->entries = NULL;
+        v->n = 0;
+        for (p = line + 1; sscanf(p, " :%u:%llu%n", &id, &count, &used) == 2; p += used) {
+            v->entries = realloc(v->entries, (v->n + 1) * sizeof(bbv_entry_t));
+            v->entries[v->n].id = id;
+            v->entries[v->n].count = (double)count;
+            v->n++;
+            if (id > MAX_ID) {
+                MAX_ID = id;
+            }
+        }
+    }
+    free(line);
+    fclose(fp);
+}
+
+/***************************************************************/
+/* Normalize each vector to sum 1 and project it onto DIMS random  */
+/* directions (uniform in [-1, 1], one fixed row per block)          */
+/***************************************************************/
+void project(unsigned seed) {
+    double *matrix, total;
+    uint32_t i, j;
+    int d;
+
+    srand(seed);
+    matrix = malloc((size_t)(MAX_ID + 1) * DIMS * sizeof(double));
+    for (i = 0; i < (MAX_ID + 1) * (uint32_t)DIMS; i++) {
+        matrix[i] = 2.0 * rand() / RAND_MAX - 1.0;
+    }
+    POINTS = calloc((size_t)NUM_INTERVALS * DIMS, sizeof(double));
+    for (i = 0; i < NUM_INTERVALS; i++) {
+        total = 0;
+        for (j = 0; j < INTERVALS[i].n; j++) {
+            total += INTERVALS[i].entries[j].count;
+        }
+        for (j = 0; j < INTERVALS[i].n && total > 0; j++) {
+            for (d = 0; d < DIMS; d++) {
+                POINTS[i * DIMS + d] += INTERVALS[i].entries[j].count / total
+                    * matrix[INTERVALS[i].entries[j].id * DIMS + d];
+            }
+        }
+    }
+    free(matrix);
+}
+
+/***************************************************************/
+/* Squared distance between point i and a centroid                        */
+/***************************************************************/
+double distance2(uint32_t i, const double *centroid) {
+    double sum = 0, diff;
+    int d;
+
+    for (d = 0; d < DIMS; d++) {
+        diff = POINTS[i * DIMS + d] - centroid[d];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+/***************************************************************/
+/* Lloyd's k-means seeded with k random intervals. Returns the     */
+/* total squared distance; fills assign[] and centroids[k * DIMS].    */
+/***************************************************************/
+double kmeans(int k, uint32_t *assign, double *centroids) {
+    uint32_t i, *sizes;
+    int c, best, iter, changed, d;
+    double dist, best_dist, sse = 0;
+
+    sizes = malloc(k * sizeof(uint32_t));
+    for (c = 0; c < k; c++) {
+        i = (uint32_t)(((double)rand() / ((double)RAND_MAX + 1)) * NUM_INTERVALS);
+        memcpy(&centroids[c * DIMS], &POINTS[i * DIMS], DIMS * sizeof(double));
+    }
+    for (i = 0; i < NUM_INTERVALS; i++) {
+        assign[i] = (uint32_t)-1;
+    }
+
+    for (iter = 0; iter < KMEANS_MAX_ITERS; iter++) {
+        changed = 0;
+        for (i = 0; i < NUM_INTERVALS; i++) {
+            best = 0;
+            best_dist = DBL_MAX;
+            for (c = 0; c < k; c++) {
+                dist = distance2(i, &centroids[c * DIMS]);
+                if (dist < best_dist) {
+                    best_dist = dist;
+                    best = c;
+                }
+            }
+            if (assign[i] != (uint32_t)best) {
+                assign[i] = best;
+                changed = 1;
+            }
+        }
+        if (!changed) {
+            break;
+        }
+        memset(centroids, 0, k * DIMS * sizeof(double));
+        memset(sizes, 0, k * sizeof(uint32_t));
+        for (i = 0; i < NUM_INTERVALS; i++) {
+            sizes[assign[i]]++;
+            for (d = 0; d < DIMS; d++) {
+                centroids[assign[i] * DIMS + d] += POINTS[i * DIMS + d];
+            }
+        }
+        for (c = 0; c < k; c++) {
+            if (sizes[c] == 0) {
+                /* reseed an empty cluster */
+                i = (uint32_t)(((double)rand() / ((double)RAND_MAX + 1)) * NUM_INTERVALS);
+                memcpy(&centroids[c * DIMS], &POINTS[i * DIMS], DIMS * sizeof(double));
+                continue;
+            }
+            for (d = 0; d < DIMS; d++) {
+                centroids[c * DIMS + d] /= sizes[c];
+            }
+        }
+    }
+
+    for (i = 0; i < NUM_INTERVALS; i++) {
+        sse += distance2(i, &centroids[assign[i] * DIMS]);
+    }
+    free(sizes);
+    return sse;
+}
+
+/***************************************************************/
+/* Bayesian information criterion of a clustering (Pelleg & Moore)  */
+/***************************************************************/
+double bic(int k, const uint32_t *assign, double sse) {
+    double R = NUM_INTERVALS, M = DIMS, variance, likelihood = 0, params;
+    uint32_t i, *sizes;
+    int c;
+
+    sizes = calloc(k, sizeof(uint32_t));
+    for (i = 0; i < NUM_INTERVALS; i++) {
+        sizes[assign[i]]++;
+    }
+    variance = (R > k) ? sse / (M * (R - k)) : 0;
+    if (variance < 1e-12) {
+        variance = 1e-12;
+    }
+    for (c = 0; c < k; c++) {
+        if (sizes[c] == 0) {
+            continue;
+        }
+        likelihood += sizes[c] * log((double)sizes[c]) - sizes[c] * log(R)
+            - sizes[c] / 2.0 * log(2 * M_PI) - sizes[c] * M / 2.0 * log(variance)
+            - (sizes[c] - 1) * M / 2.0;
+    }
+    free(sizes);
+    params = (k - 1) + M * k + 1;
+    return likelihood - params / 2.0 * log(R);
+}
+
+/***************************************************************/
+/* Print usage                                                                         */
+/***************************************************************/
+void usage(const char *prog) {
+    printf("Usage: %s [-k <max clusters>] [-d <dimensions>] [-r <seed>] <input.bb> <output prefix>\n", prog);
+}
+
+/***************************************************************/
+/* main                                                                                */
+/***************************************************************/
+int main(int argc, char *argv[]) {
+    int opt, max_k = DEFAULT_MAX_K, k, best_k = 1, seed_run, c;
+    unsigned seed = 1;
+    uint32_t i, **assigns, *trial, rep;
+    double *scores, *centroids, *trial_centroids, **all_centroids, sse, best_sse, lo, hi, dist, best_dist;
+    char path[256];
+    FILE *points, *weights;
+
+    while ((opt = getopt(argc, argv, "k:d:r:")) != -1) {
+        switch (opt) {
+            case 'k': max_k = atoi(optarg); break;
+            case 'd': DIMS = atoi(optarg); break;
+            case 'r': seed = (unsigned)strtoul(optarg, NULL, 0); break;
+            default: usage(argv[0]); exit(1);
+        }
+    }
+    if (argc - optind != 2 || max_k < 1 || DIMS < 1) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    read_bbv(argv[optind]);
+    if (NUM_INTERVALS == 0) {
+        printf("Error: no intervals in %s\n", argv[optind]);
+        exit(-1);
+    }
+    if ((uint32_t)max_k > NUM_INTERVALS) {
+        max_k = NUM_INTERVALS;
+    }
+    project(seed);
+
+    scores = malloc((max_k + 1) * sizeof(double));
+    assigns = malloc((max_k + 1) * sizeof(uint32_t *));
+    all_centroids = malloc((max_k + 1) * sizeof(double *));
+    trial = malloc(NUM_INTERVALS * sizeof(uint32_t));
+    trial_centroids = malloc(max_k * DIMS * sizeof(double));
+    for (k = 1; k <= max_k; k++) {
+        assigns[k] = malloc(NUM_INTERVALS * sizeof(uint32_t));
+        all_centroids[k] = malloc(k * DIMS * sizeof(double));
+        best_sse = DBL_MAX;
+        for (seed_run = 0; seed_run < KMEANS_SEEDS; seed_run++) {
+            sse = kmeans(k, trial, trial_centroids);
+            if (sse < best_sse) {
+                best_sse = sse;
+                memcpy(assigns[k], trial, NUM_INTERVALS * sizeof(uint32_t));
+                memcpy(all_centroids[k], trial_centroids, k * DIMS * sizeof(double));
+            }
+        }
+        scores[k] = bic(k, assigns[k], best_sse);
+        printf("k = %-3d  BIC = %.2f\n", k, scores[k]);
+    }
+
+    lo = hi = scores[1];
+    for (k = 2; k <= max_k; k++) {
+        lo = (scores[k] < lo) ? scores[k] : lo;
+        hi = (scores[k] > hi) ? scores[k] : hi;
+    }
+    for (k = 1; k <= max_k; k++) {
+        if (scores[k] >= lo + BIC_THRESHOLD * (hi - lo)) {
+            best_k = k;
+            break;
+        }
+    }
+    centroids = all_centroids[best_k];
+
+    snprintf(path, sizeof(path), "%s.simpoints", argv[optind + 1]);
+    points = fopen(path, "w");
+    snprintf(path, sizeof(path), "%s.weights", argv[optind + 1]);
+    weights = fopen(path, "w");
+    if (points == NULL || weights == NULL) {
+        printf("Error: Can't write %s.simpoints/.weights\n", argv[optind + 1]);
+        exit(-1);
+    }
+    printf("\n%u intervals, %d clusters\n[Cluster]\t[Interval]\t[Weight]\n", NUM_INTERVALS, best_k);
+    for (c = 0; c < best_k; c++) {
+        rep = (uint32_t)-1;
+        best_dist = DBL_MAX;
+        k = 0;
+        for (i = 0; i < NUM_INTERVALS; i++) {
+            if (assigns[best_k][i] != (uint32_t)c) {
+                continue;
+            }
+            k++;
+            dist = distance2(i, &centroids[c * DIMS]);
+            if (dist < best_dist) {
+                best_dist = dist;
+                rep = i;
+            }
+        }
+        if (k == 0) {
+            continue;
+        }
+        fprintf(points, "%u %d\n", rep, c);
+        fprintf(weights, "%.6f %d\n", (double)k / NUM_INTERVALS, c);
+        printf("%d\t\t%u\t\t%.4f\n", c, rep, (double)k / NUM_INTERVALS);
+    }
+    fclose(points);
+    fclose(weights);
+    return 0;
+}